@@ -0,0 +1,437 @@
+/*
+ ============================================================================
+ Name        : hev-bypass-table.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bypass Table
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+
+#include "hev-bypass-table.h"
+
+typedef struct _HevBypassNode HevBypassNode;
+typedef struct _HevBypassRule HevBypassRule;
+
+/*
+ * A path-compressed binary trie over 128-bit keys, IPv4 prefixes are
+ * stored v4-mapped. Children and rules are indices, so the arrays can
+ * grow while loading, index 0 of either means none.
+ */
+struct _HevBypassNode
+{
+    uint32_t key[4];
+    uint32_t child[2];
+    uint32_t rule;
+    unsigned int len;
+};
+
+struct _HevBypassRule
+{
+    uint32_t next;
+    uint16_t port_lo;
+    uint16_t port_hi;
+    int proxy;
+};
+
+static HevBypassNode *nodes;
+static HevBypassRule *rules;
+static unsigned int node_count;
+static unsigned int node_size;
+static unsigned int rule_count;
+static unsigned int rule_size;
+
+static int
+hev_bypass_table_bit (const uint32_t *key, unsigned int pos)
+{
+    return (key[pos >> 5] >> (31 - (pos & 31))) & 1;
+}
+
+static unsigned int
+hev_bypass_table_common (const uint32_t *a, const uint32_t *b,
+                         unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i += 32) {
+        uint32_t x = a[i >> 5] ^ b[i >> 5];
+
+        if (x) {
+            i += __builtin_clz (x);
+            break;
+        }
+    }
+
+    return (i < len) ? i : len;
+}
+
+static void
+hev_bypass_table_mask (uint32_t *key, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < 4; i++) {
+        if (len >= 32) {
+            len -= 32;
+            continue;
+        }
+
+        key[i] = len ? key[i] & ~(0xffffffffU >> len) : 0;
+        len = 0;
+    }
+}
+
+static void
+hev_bypass_table_key (uint32_t *key, const struct in6_addr *addr)
+{
+    unsigned int i;
+
+    for (i = 0; i < 4; i++)
+        key[i] = ((uint32_t)addr->s6_addr[i * 4] << 24) |
+                 ((uint32_t)addr->s6_addr[i * 4 + 1] << 16) |
+                 ((uint32_t)addr->s6_addr[i * 4 + 2] << 8) |
+                 addr->s6_addr[i * 4 + 3];
+}
+
+static int
+hev_bypass_table_alloc_node (const uint32_t *key, unsigned int len)
+{
+    HevBypassNode *node;
+
+    if (node_count == node_size) {
+        unsigned int size = node_size ? node_size * 2 : 1024;
+        void *ptr;
+
+        ptr = hev_realloc (nodes, sizeof (HevBypassNode) * size);
+        if (!ptr)
+            return -1;
+
+        nodes = ptr;
+        node_size = size;
+    }
+
+    node = &nodes[node_count];
+    memcpy (node->key, key, sizeof (node->key));
+    hev_bypass_table_mask (node->key, len);
+    node->child[0] = 0;
+    node->child[1] = 0;
+    node->rule = 0;
+    node->len = len;
+
+    return node_count++;
+}
+
+static int
+hev_bypass_table_insert (const uint32_t *key, unsigned int len)
+{
+    unsigned int idx = 0;
+
+    for (;;) {
+        unsigned int common;
+        int b, c, n, m;
+
+        if (nodes[idx].len == len)
+            return idx;
+
+        b = hev_bypass_table_bit (key, nodes[idx].len);
+        c = nodes[idx].child[b];
+        if (!c) {
+            n = hev_bypass_table_alloc_node (key, len);
+            if (n > 0)
+                nodes[idx].child[b] = n;
+            return n;
+        }
+
+        common = (len < nodes[c].len) ? len : nodes[c].len;
+        common = hev_bypass_table_common (key, nodes[c].key, common);
+        if (common == nodes[c].len) {
+            idx = c;
+            continue;
+        }
+
+        /* split the compressed edge where the keys diverge */
+        n = hev_bypass_table_alloc_node (key, common);
+        if (n < 0)
+            return -1;
+
+        nodes[n].child[hev_bypass_table_bit (nodes[c].key, common)] = c;
+        nodes[idx].child[b] = n;
+        if (common == len)
+            return n;
+
+        m = hev_bypass_table_alloc_node (key, len);
+        if (m > 0)
+            nodes[n].child[hev_bypass_table_bit (key, common)] = m;
+        return m;
+    }
+}
+
+static int
+hev_bypass_table_add (const uint32_t *key, unsigned int len,
+                      HevBypassRule *rule)
+{
+    uint32_t *link;
+    int idx;
+
+    if (rule_count == rule_size) {
+        unsigned int size = rule_size * 2;
+        void *ptr;
+
+        ptr = hev_realloc (rules, sizeof (HevBypassRule) * size);
+        if (!ptr)
+            return -1;
+
+        rules = ptr;
+        rule_size = size;
+    }
+
+    idx = hev_bypass_table_insert (key, len);
+    if (idx < 0)
+        return -1;
+
+    /* keep the file order among the rules of one prefix */
+    link = &nodes[idx].rule;
+    while (*link)
+        link = &rules[*link].next;
+
+    rules[rule_count] = *rule;
+    rules[rule_count].next = 0;
+    *link = rule_count++;
+
+    return 0;
+}
+
+static int
+hev_bypass_table_parse (char *line, uint32_t *key, unsigned int *len,
+                        HevBypassRule *rule)
+{
+    struct in6_addr addr;
+    char *cidr, *port, *save, *end;
+    unsigned long val;
+    unsigned int bits;
+    char *mask;
+
+    cidr = strtok_r (line, " \t\r\n", &save);
+    if (!cidr || cidr[0] == '#')
+        return 0;
+
+    port = strtok_r (NULL, " \t\r\n", &save);
+    if (port && port[0] == '#')
+        port = NULL;
+
+    memset (rule, 0, sizeof (HevBypassRule));
+    rule->port_hi = 65535;
+    if (cidr[0] == '!') {
+        rule->proxy = 1;
+        cidr++;
+    }
+
+    mask = strchr (cidr, '/');
+    if (mask)
+        *mask++ = '\0';
+
+    if (inet_pton (AF_INET6, cidr, &addr) == 1) {
+        bits = 128;
+    } else {
+        memset (&addr, 0, sizeof (addr));
+        addr.s6_addr[10] = 0xff;
+        addr.s6_addr[11] = 0xff;
+        if (inet_pton (AF_INET, cidr, &addr.s6_addr[12]) != 1)
+            return -1;
+        bits = 32;
+    }
+
+    *len = bits;
+    if (mask) {
+        if (!isdigit (mask[0]))
+            return -1;
+        val = strtoul (mask, &end, 10);
+        if (*end || val > bits)
+            return -1;
+        *len = val;
+    }
+
+    /* an IPv4 prefix lives below the v4-mapped ::ffff:0:0/96 */
+    if (bits == 32)
+        *len += 96;
+
+    hev_bypass_table_key (key, &addr);
+
+    if (port) {
+        if (!isdigit (port[0]))
+            return -1;
+        val = strtoul (port, &end, 10);
+        if (val > 65535)
+            return -1;
+        rule->port_lo = val;
+        rule->port_hi = val;
+        if (*end == '-') {
+            val = strtoul (end + 1, &end, 10);
+            if (val > 65535 || val < rule->port_lo)
+                return -1;
+            rule->port_hi = val;
+        }
+        if (*end)
+            return -1;
+    }
+
+    return 1;
+}
+
+static int
+hev_bypass_table_load (const char *path)
+{
+    char line[256];
+    unsigned int lineno = 0;
+    FILE *fp;
+    int res = 0;
+
+    fp = fopen (path, "r");
+    if (!fp) {
+        LOG_E ("bypass table open %s", path);
+        return -1;
+    }
+
+    while (fgets (line, sizeof (line), fp)) {
+        HevBypassRule rule;
+        unsigned int len;
+        uint32_t key[4];
+
+        lineno++;
+        res = hev_bypass_table_parse (line, key, &len, &rule);
+        if (res == 0)
+            continue;
+        if (res < 0) {
+            LOG_E ("bypass table %s:%u invalid rule", path, lineno);
+            break;
+        }
+
+        res = hev_bypass_table_add (key, len, &rule);
+        if (res < 0) {
+            LOG_E ("bypass table %s:%u out of memory", path, lineno);
+            break;
+        }
+    }
+
+    fclose (fp);
+    return (res < 0) ? -1 : 0;
+}
+
+int
+hev_bypass_table_init (void)
+{
+    const char *path = hev_config_get_bypass_file ();
+    uint32_t root[4] = { 0 };
+
+    LOG_D ("bypass table init");
+
+    if (!path)
+        return 0;
+
+    rule_size = 1024;
+    rules = hev_malloc (sizeof (HevBypassRule) * rule_size);
+    if (!rules)
+        return -1;
+
+    /* entry 0 stands for none, the root is a real node of length 0 */
+    rule_count = 1;
+    if (hev_bypass_table_alloc_node (root, 0) < 0)
+        goto exit;
+
+    if (hev_bypass_table_load (path) < 0)
+        goto exit;
+
+    LOG_I ("bypass table %u rules %u nodes", rule_count - 1, node_count);
+
+    return 0;
+
+exit:
+    hev_bypass_table_fini ();
+    return -1;
+}
+
+void
+hev_bypass_table_fini (void)
+{
+    LOG_D ("bypass table fini");
+
+    if (nodes)
+        hev_free (nodes);
+    if (rules)
+        hev_free (rules);
+
+    nodes = NULL;
+    rules = NULL;
+    node_count = 0;
+    node_size = 0;
+    rule_count = 0;
+    rule_size = 0;
+}
+
+static int
+hev_bypass_table_prefix (const uint32_t *key, const HevBypassNode *node)
+{
+    unsigned int i;
+
+    for (i = 0; i < node->len; i += 32) {
+        uint32_t x = key[i >> 5] ^ node->key[i >> 5];
+
+        if (node->len - i < 32)
+            x &= ~(0xffffffffU >> (node->len - i));
+        if (x)
+            return 0;
+    }
+
+    return 1;
+}
+
+int
+hev_bypass_table_match (const struct sockaddr_in6 *addr)
+{
+    unsigned int port;
+    uint32_t key[4];
+    int proxy = 1;
+    unsigned int idx = 0;
+
+    if (!node_count)
+        return 0;
+
+    hev_bypass_table_key (key, &addr->sin6_addr);
+    port = ntohs (addr->sin6_port);
+
+    /* every node on the path is a shorter prefix, the last hit wins */
+    for (;;) {
+        const HevBypassNode *node = &nodes[idx];
+        uint32_t r;
+
+        if (!hev_bypass_table_prefix (key, node))
+            break;
+
+        for (r = node->rule; r; r = rules[r].next) {
+            if (port >= rules[r].port_lo && port <= rules[r].port_hi) {
+                proxy = rules[r].proxy;
+                break;
+            }
+        }
+
+        if (node->len == 128)
+            break;
+
+        idx = node->child[hev_bypass_table_bit (key, node->len)];
+        if (!idx)
+            break;
+    }
+
+    return !proxy;
+}
@@ -0,0 +1,24 @@
+/*
+ ============================================================================
+ Name        : hev-bypass-table.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Bypass Table
+ ============================================================================
+ */
+
+#ifndef __HEV_BYPASS_TABLE_H__
+#define __HEV_BYPASS_TABLE_H__
+
+#include <netinet/in.h>
+
+int hev_bypass_table_init (void);
+void hev_bypass_table_fini (void);
+
+/*
+ * Whether a flow to the destination is relayed directly. The table is
+ * loaded once from the rule file and shared read-only by all workers.
+ */
+int hev_bypass_table_match (const struct sockaddr_in6 *addr);
+
+#endif /* __HEV_BYPASS_TABLE_H__ */
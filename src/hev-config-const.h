@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-config-const.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2017 - 2024 hev
+ Copyright   : Copyright (c) 2017 - 2025 hev
  Description : Config Const
  ============================================================================
  */
@@ -16,6 +16,7 @@
 
 static const int UDP_BUF_SIZE = 1500;
 static const int UDP_POOL_SIZE = 512;
-static const int TSOCKS_MAX_CACHED = 64;
+static const int DNS_POOL_SIZE = 256;
+static const int DNS_TCP_SESSION_MAX = 256;
 
 #endif /* __HEV_CONFIG_CONST_H__ */
@@ -13,24 +13,57 @@
 #include "hev-logger.h"
 #include "hev-config.h"
 
+#define SERVER_MAX (16)
+
 static unsigned int workers;
-static HevConfigServer srv;
+static HevConfigServer srvs[SERVER_MAX];
+static unsigned int srv_count;
+static int srv_balance;
 static char tcp_address[256];
 static char tcp_port[8];
 static char udp_address[256];
 static char udp_port[8];
-static char dns_upstream[256];
+static char dns_upstream[1024];
 static char dns_address[256];
 static char dns_port[8];
+static int dns_upstream_sockets;
+static int dns_mode;
+static int dns_upstream_race;
+static int dns_cache_size;
+static int dns_cache_min_ttl;
+static int dns_cache_max_ttl;
+static int dns_cache_negative_ttl;
+static int dns_cache_stale_ttl;
+static int dns_cache_prefetch;
+static char dns_fake_ip_range[64];
+static char dns_fake_ip_range6[64];
+static int dns_fake_ip_size;
+static char dns_preconnect_ports[64];
+static int dns_preconnect_max;
+static int dns_preconnect_idle;
+static char bypass_file[1024];
+static unsigned int bypass_mark;
 
 static char log_file[1024];
 static char pid_file[1024];
 static int task_stack_size;
+static int tcp_stack_size;
+static int udp_stack_size;
+static int dns_stack_size;
+static int task_stack_watermark;
+static int task_pool_size;
 static int udp_recv_buffer_size;
 static int udp_copy_buffer_nums;
+static int udp_packet_pool_size;
+static int tsocks_cache_size;
+static int udp_reply_mode;
 static int connect_timeout;
 static int tcp_read_write_timeout;
 static int udp_read_write_timeout;
+static int tcp_kernel_splice;
+static int tcp_splice_pipe_size;
+static int tcp_splice_threshold;
+static int tcp_park_idle;
 static int limit_nofile;
 static int log_level;
 
@@ -70,10 +103,90 @@ hev_config_parse_main (yaml_document_t *doc, yaml_node_t *base)
     return 0;
 }
 
+static int
+hev_config_parse_server_list (yaml_document_t *doc, yaml_node_t *base,
+                              const char *sec, HevConfigServer *srv)
+{
+    yaml_node_item_t *item;
+
+    for (item = base->data.sequence.items.start;
+         item < base->data.sequence.items.top; item++) {
+        yaml_node_t *node = yaml_document_get_node (doc, *item);
+        yaml_node_pair_t *pair;
+        const char *addr = NULL;
+        const char *port = NULL;
+        const char *udpa = NULL;
+        const char *wght = NULL;
+        HevConfigServer *ext;
+
+        if (!node || YAML_MAPPING_NODE != node->type)
+            return -1;
+
+        if (srv_count == SERVER_MAX) {
+            fprintf (stderr, "Too many %s.servers, max %d!\n", sec,
+                     SERVER_MAX - 1);
+            return -1;
+        }
+
+        for (pair = node->data.mapping.pairs.start;
+             pair < node->data.mapping.pairs.top; pair++) {
+            yaml_node_t *n;
+            const char *key, *value;
+
+            if (!pair->key || !pair->value)
+                continue;
+
+            n = yaml_document_get_node (doc, pair->key);
+            if (!n || YAML_SCALAR_NODE != n->type)
+                break;
+            key = (const char *)n->data.scalar.value;
+
+            n = yaml_document_get_node (doc, pair->value);
+            if (!n || YAML_SCALAR_NODE != n->type)
+                break;
+            value = (const char *)n->data.scalar.value;
+
+            if (0 == strcmp (key, "port"))
+                port = value;
+            else if (0 == strcmp (key, "address"))
+                addr = value;
+            else if (0 == strcmp (key, "udp-address"))
+                udpa = value;
+            else if (0 == strcmp (key, "weight"))
+                wght = value;
+        }
+
+        if (!port || !addr) {
+            fprintf (stderr, "Can't found %s.servers address or port!\n",
+                     sec);
+            return -1;
+        }
+
+        /* credentials and socket options are shared with the first one */
+        ext = &srv[srv_count++];
+        memcpy (ext, srv, sizeof (HevConfigServer));
+        memset (ext->udp_addr, 0, sizeof (ext->udp_addr));
+        memset (ext->addr, 0, sizeof (ext->addr));
+
+        strncpy (ext->addr, addr, 256 - 1);
+        ext->port = strtoul (port, NULL, 10);
+
+        if (udpa)
+            strncpy (ext->udp_addr, udpa, 256 - 1);
+
+        ext->weight = 1;
+        if (wght)
+            ext->weight = strtoul (wght, NULL, 10);
+    }
+
+    return 0;
+}
+
 static int
 hev_config_parse_server (yaml_document_t *doc, yaml_node_t *base,
                          const char *sec, HevConfigServer *srv)
 {
+    yaml_node_t *list = NULL;
     yaml_node_pair_t *pair;
     static char _user[256];
     static char _pass[256];
@@ -86,6 +199,18 @@ hev_config_parse_server (yaml_document_t *doc, yaml_node_t *base,
     const char *mark = NULL;
     const char *pipe = NULL;
     const char *tfso = NULL;
+    const char *psiz = NULL;
+    const char *prat = NULL;
+    const char *pidl = NULL;
+    const char *wght = NULL;
+    const char *bala = NULL;
+    const char *hint = NULL;
+    const char *hris = NULL;
+    const char *hfal = NULL;
+    const char *bfai = NULL;
+    const char *bcoo = NULL;
+    const char *fopn = NULL;
+    const char *cdel = NULL;
 
     if (!base || YAML_MAPPING_NODE != base->type || !srv)
         return -1;
@@ -104,6 +229,11 @@ hev_config_parse_server (yaml_document_t *doc, yaml_node_t *base,
         key = (const char *)node->data.scalar.value;
 
         node = yaml_document_get_node (doc, pair->value);
+        if (node && YAML_SEQUENCE_NODE == node->type &&
+            0 == strcmp (key, "servers")) {
+            list = node;
+            continue;
+        }
         if (!node || YAML_SCALAR_NODE != node->type)
             break;
         value = (const char *)node->data.scalar.value;
@@ -112,6 +242,10 @@ hev_config_parse_server (yaml_document_t *doc, yaml_node_t *base,
             port = value;
         else if (0 == strcmp (key, "address"))
             addr = value;
+        else if (0 == strcmp (key, "weight"))
+            wght = value;
+        else if (0 == strcmp (key, "balance"))
+            bala = value;
         else if (0 == strcmp (key, "udp"))
             udpm = value;
         else if (0 == strcmp (key, "udp-address"))
@@ -126,6 +260,26 @@ hev_config_parse_server (yaml_document_t *doc, yaml_node_t *base,
             mark = value;
         else if (0 == strcmp (key, "tcp-fastopen"))
             tfso = value;
+        else if (0 == strcmp (key, "pool-size"))
+            psiz = value;
+        else if (0 == strcmp (key, "pool-refill-rate"))
+            prat = value;
+        else if (0 == strcmp (key, "pool-max-idle"))
+            pidl = value;
+        else if (0 == strcmp (key, "health-check-interval"))
+            hint = value;
+        else if (0 == strcmp (key, "health-check-rise"))
+            hris = value;
+        else if (0 == strcmp (key, "health-check-fall"))
+            hfal = value;
+        else if (0 == strcmp (key, "breaker-failures"))
+            bfai = value;
+        else if (0 == strcmp (key, "breaker-cooldown"))
+            bcoo = value;
+        else if (0 == strcmp (key, "fail-open"))
+            fopn = value;
+        else if (0 == strcmp (key, "connect-attempt-delay"))
+            cdel = value;
     }
 
     if (!port) {
@@ -168,6 +322,55 @@ hev_config_parse_server (yaml_document_t *doc, yaml_node_t *base,
     if (tfso)
         srv->fastopen = (0 == strcasecmp (tfso, "true")) ? 1 : 0;
 
+    if (psiz)
+        srv->pool_size = strtoul (psiz, NULL, 10);
+
+    srv->pool_rate = 10;
+    if (prat)
+        srv->pool_rate = strtoul (prat, NULL, 10);
+
+    srv->pool_idle = 30000;
+    if (pidl)
+        srv->pool_idle = strtoul (pidl, NULL, 10);
+
+    srv->weight = 1;
+    if (wght)
+        srv->weight = strtoul (wght, NULL, 10);
+
+    if (hint)
+        srv->health_interval = strtoul (hint, NULL, 10);
+
+    srv->health_rise = 2;
+    if (hris)
+        srv->health_rise = strtoul (hris, NULL, 10);
+
+    srv->health_fall = 3;
+    if (hfal)
+        srv->health_fall = strtoul (hfal, NULL, 10);
+
+    srv->breaker_failures = 5;
+    if (bfai)
+        srv->breaker_failures = strtoul (bfai, NULL, 10);
+
+    srv->breaker_cooldown = 10000;
+    if (bcoo)
+        srv->breaker_cooldown = strtoul (bcoo, NULL, 10);
+
+    srv->fail_open = 1;
+    if (fopn)
+        srv->fail_open = (0 == strcasecmp (fopn, "true")) ? 1 : 0;
+
+    srv->connect_delay = 250;
+    if (cdel)
+        srv->connect_delay = strtoul (cdel, NULL, 10);
+
+    if (bala && (strcasecmp (bala, "p2c") == 0))
+        srv_balance = HEV_CONFIG_BALANCE_P2C;
+
+    srv_count = 1;
+    if (list)
+        return hev_config_parse_server_list (doc, list, sec, srv);
+
     return 0;
 }
 
@@ -221,6 +424,15 @@ hev_config_parse_addr (yaml_document_t *doc, yaml_node_t *base, const char *sec,
     return 0;
 }
 
+static int
+hev_config_parse_dns_mode (const char *value)
+{
+    if (0 == strcmp (value, "event"))
+        return HEV_CONFIG_DNS_MODE_EVENT;
+
+    return HEV_CONFIG_DNS_MODE_TASK;
+}
+
 static int
 hev_config_parse_dns_addr (yaml_document_t *doc, yaml_node_t *base,
                            const char *sec)
@@ -257,6 +469,36 @@ hev_config_parse_dns_addr (yaml_document_t *doc, yaml_node_t *base,
             addr = value;
         else if (0 == strcmp (key, "upstream"))
             upstream = value;
+        else if (0 == strcmp (key, "upstream-sockets"))
+            dns_upstream_sockets = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "mode"))
+            dns_mode = hev_config_parse_dns_mode (value);
+        else if (0 == strcmp (key, "upstream-race"))
+            dns_upstream_race = (0 == strcasecmp (value, "true")) ? 1 : 0;
+        else if (0 == strcmp (key, "cache-size"))
+            dns_cache_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-min-ttl"))
+            dns_cache_min_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-max-ttl"))
+            dns_cache_max_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-negative-ttl"))
+            dns_cache_negative_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-stale-ttl"))
+            dns_cache_stale_ttl = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "cache-prefetch"))
+            dns_cache_prefetch = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "fake-ip-range"))
+            strncpy (dns_fake_ip_range, value, 64 - 1);
+        else if (0 == strcmp (key, "fake-ip-range6"))
+            strncpy (dns_fake_ip_range6, value, 64 - 1);
+        else if (0 == strcmp (key, "fake-ip-size"))
+            dns_fake_ip_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "preconnect-ports"))
+            strncpy (dns_preconnect_ports, value, 64 - 1);
+        else if (0 == strcmp (key, "preconnect-max"))
+            dns_preconnect_max = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "preconnect-idle"))
+            dns_preconnect_idle = strtoul (value, NULL, 10);
     }
 
     if (!port) {
@@ -274,12 +516,47 @@ hev_config_parse_dns_addr (yaml_document_t *doc, yaml_node_t *base,
         return -1;
     }
 
-    strncpy (dns_upstream, upstream, 256 - 1);
+    strncpy (dns_upstream, upstream, 1024 - 1);
     strncpy (dns_address, addr, 256 - 1);
     strncpy (dns_port, port, 8 - 1);
     return 0;
 }
 
+static int
+hev_config_parse_bypass (yaml_document_t *doc, yaml_node_t *base)
+{
+    yaml_node_pair_t *pair;
+
+    if (!base || YAML_MAPPING_NODE != base->type)
+        return -1;
+
+    for (pair = base->data.mapping.pairs.start;
+         pair < base->data.mapping.pairs.top; pair++) {
+        yaml_node_t *node;
+        const char *key, *value;
+
+        if (!pair->key || !pair->value)
+            continue;
+
+        node = yaml_document_get_node (doc, pair->key);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        key = (const char *)node->data.scalar.value;
+
+        node = yaml_document_get_node (doc, pair->value);
+        if (!node || YAML_SCALAR_NODE != node->type)
+            break;
+        value = (const char *)node->data.scalar.value;
+
+        if (0 == strcmp (key, "file"))
+            strncpy (bypass_file, value, 1024 - 1);
+        else if (0 == strcmp (key, "mark"))
+            bypass_mark = strtoul (value, NULL, 0);
+    }
+
+    return 0;
+}
+
 static int
 hev_config_parse_log_level (const char *value)
 {
@@ -293,6 +570,15 @@ hev_config_parse_log_level (const char *value)
     return HEV_LOGGER_WARN;
 }
 
+static int
+hev_config_parse_udp_reply_mode (const char *value)
+{
+    if (0 == strcmp (value, "pktinfo"))
+        return HEV_CONFIG_UDP_REPLY_PKTINFO;
+
+    return HEV_CONFIG_UDP_REPLY_CACHE;
+}
+
 static int
 hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
 {
@@ -324,10 +610,26 @@ hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
 
         if (0 == strcmp (key, "task-stack-size"))
             task_stack_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-stack-size"))
+            tcp_stack_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-stack-size"))
+            udp_stack_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "dns-stack-size"))
+            dns_stack_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "task-stack-watermark"))
+            task_stack_watermark = (0 == strcasecmp (value, "true")) ? 1 : 0;
+        else if (0 == strcmp (key, "task-pool-size"))
+            task_pool_size = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "udp-recv-buffer-size"))
             udp_recv_buffer_size = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "udp-copy-buffer-nums"))
             udp_copy_buffer_nums = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-packet-pool-size"))
+            udp_packet_pool_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tsocks-cache-size"))
+            tsocks_cache_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "udp-reply-mode"))
+            udp_reply_mode = hev_config_parse_udp_reply_mode (value);
         else if (0 == strcmp (key, "connect-timeout"))
             connect_timeout = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "read-write-timeout"))
@@ -336,6 +638,14 @@ hev_config_parse_misc (yaml_document_t *doc, yaml_node_t *base)
             tcp_rw_timeout = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "udp-read-write-timeout"))
             udp_rw_timeout = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-kernel-splice"))
+            tcp_kernel_splice = (0 == strcasecmp (value, "true")) ? 1 : 0;
+        else if (0 == strcmp (key, "tcp-splice-pipe-size"))
+            tcp_splice_pipe_size = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-splice-threshold"))
+            tcp_splice_threshold = strtoul (value, NULL, 10);
+        else if (0 == strcmp (key, "tcp-park-idle"))
+            tcp_park_idle = strtoul (value, NULL, 10);
         else if (0 == strcmp (key, "pid-file"))
             strncpy (pid_file, value, 1024 - 1);
         else if (0 == strcmp (key, "log-file"))
@@ -388,13 +698,15 @@ hev_config_parse_doc (yaml_document_t *doc)
         if (0 == strcmp (key, "main"))
             res = hev_config_parse_main (doc, node);
         else if (0 == strcmp (key, "socks5"))
-            res = hev_config_parse_server (doc, node, key, &srv);
+            res = hev_config_parse_server (doc, node, key, srvs);
         else if (0 == strcmp (key, "tcp"))
             res = hev_config_parse_addr (doc, node, key, tcp_address, tcp_port);
         else if (0 == strcmp (key, "udp"))
             res = hev_config_parse_addr (doc, node, key, udp_address, udp_port);
         else if (0 == strcmp (key, "dns"))
             res = hev_config_parse_dns_addr (doc, node, key);
+        else if (0 == strcmp (key, "bypass"))
+            res = hev_config_parse_bypass (doc, node);
         else if (0 == strcmp (key, "misc"))
             res = hev_config_parse_misc (doc, node);
 
@@ -410,15 +722,42 @@ hev_config_reset (void)
 {
     workers = 1;
     task_stack_size = 20480;
+    tcp_stack_size = 0;
+    udp_stack_size = 0;
+    dns_stack_size = 0;
+    task_stack_watermark = 0;
+    task_pool_size = 64;
     udp_recv_buffer_size = 1048576;
     udp_copy_buffer_nums = 10;
+    udp_packet_pool_size = 4096;
+    tsocks_cache_size = 256;
+    dns_upstream_sockets = 4;
+    dns_mode = HEV_CONFIG_DNS_MODE_TASK;
+    dns_upstream_race = 0;
+    dns_cache_size = 0;
+    dns_cache_min_ttl = 0;
+    dns_cache_max_ttl = 86400;
+    dns_cache_negative_ttl = 300;
+    dns_cache_stale_ttl = 0;
+    dns_cache_prefetch = 0;
+    dns_fake_ip_size = 65536;
+    dns_preconnect_max = 64;
+    dns_preconnect_idle = 3000;
+    bypass_mark = 0;
+    udp_reply_mode = HEV_CONFIG_UDP_REPLY_CACHE;
     connect_timeout = 10000;
     tcp_read_write_timeout = 300000;
     udp_read_write_timeout = 60000;
+    tcp_kernel_splice = 0;
+    tcp_splice_pipe_size = 65536;
+    tcp_splice_threshold = 0;
+    tcp_park_idle = 0;
     limit_nofile = 65535;
     log_level = HEV_LOGGER_WARN;
 
-    memset (&srv, 0, sizeof (srv));
+    srv_count = 0;
+    srv_balance = HEV_CONFIG_BALANCE_LEAST_CONN;
+    memset (srvs, 0, sizeof (srvs));
     memset (tcp_address, 0, sizeof (tcp_address));
     memset (tcp_port, 0, sizeof (tcp_port));
     memset (udp_address, 0, sizeof (udp_address));
@@ -426,6 +765,10 @@ hev_config_reset (void)
     memset (dns_upstream, 0, sizeof (dns_upstream));
     memset (dns_address, 0, sizeof (dns_address));
     memset (dns_port, 0, sizeof (dns_port));
+    memset (dns_fake_ip_range, 0, sizeof (dns_fake_ip_range));
+    memset (dns_fake_ip_range6, 0, sizeof (dns_fake_ip_range6));
+    memset (dns_preconnect_ports, 0, sizeof (dns_preconnect_ports));
+    memset (bypass_file, 0, sizeof (bypass_file));
     memset (log_file, 0, sizeof (log_file));
     memset (pid_file, 0, sizeof (pid_file));
 }
@@ -475,7 +818,20 @@ hev_config_get_workers (void)
 HevConfigServer *
 hev_config_get_socks5_server (void)
 {
-    return &srv;
+    return &srvs[0];
+}
+
+HevConfigServer *
+hev_config_get_socks5_servers (unsigned int *count)
+{
+    *count = srv_count;
+    return srvs;
+}
+
+int
+hev_config_get_socks5_balance (void)
+{
+    return srv_balance;
 }
 
 const char *
@@ -529,12 +885,156 @@ hev_config_get_dns_port (void)
     return dns_port;
 }
 
+int
+hev_config_get_dns_upstream_sockets (void)
+{
+    return dns_upstream_sockets;
+}
+
+int
+hev_config_get_dns_upstream_race (void)
+{
+    return dns_upstream_race;
+}
+
+int
+hev_config_get_dns_mode (void)
+{
+    return dns_mode;
+}
+
+int
+hev_config_get_dns_cache_size (void)
+{
+    return dns_cache_size;
+}
+
+int
+hev_config_get_dns_cache_min_ttl (void)
+{
+    return dns_cache_min_ttl;
+}
+
+int
+hev_config_get_dns_cache_max_ttl (void)
+{
+    return dns_cache_max_ttl;
+}
+
+int
+hev_config_get_dns_cache_negative_ttl (void)
+{
+    return dns_cache_negative_ttl;
+}
+
+int
+hev_config_get_dns_cache_stale_ttl (void)
+{
+    return dns_cache_stale_ttl;
+}
+
+int
+hev_config_get_dns_cache_prefetch (void)
+{
+    return dns_cache_prefetch;
+}
+
+const char *
+hev_config_get_dns_fake_ip_range (void)
+{
+    if ('\0' == dns_fake_ip_range[0])
+        return NULL;
+
+    return dns_fake_ip_range;
+}
+
+const char *
+hev_config_get_dns_fake_ip_range6 (void)
+{
+    if ('\0' == dns_fake_ip_range6[0])
+        return NULL;
+
+    return dns_fake_ip_range6;
+}
+
+int
+hev_config_get_dns_fake_ip_size (void)
+{
+    return dns_fake_ip_size;
+}
+
+const char *
+hev_config_get_dns_preconnect_ports (void)
+{
+    if ('\0' == dns_preconnect_ports[0])
+        return NULL;
+
+    return dns_preconnect_ports;
+}
+
+int
+hev_config_get_dns_preconnect_max (void)
+{
+    return dns_preconnect_max;
+}
+
+int
+hev_config_get_dns_preconnect_idle (void)
+{
+    return dns_preconnect_idle;
+}
+
+const char *
+hev_config_get_bypass_file (void)
+{
+    if ('\0' == bypass_file[0])
+        return NULL;
+
+    return bypass_file;
+}
+
+unsigned int
+hev_config_get_bypass_mark (void)
+{
+    return bypass_mark;
+}
+
 int
 hev_config_get_misc_task_stack_size (void)
 {
     return task_stack_size;
 }
 
+int
+hev_config_get_misc_tcp_stack_size (void)
+{
+    return tcp_stack_size ? tcp_stack_size : task_stack_size;
+}
+
+int
+hev_config_get_misc_udp_stack_size (void)
+{
+    return udp_stack_size ? udp_stack_size : task_stack_size;
+}
+
+int
+hev_config_get_misc_dns_stack_size (void)
+{
+    return dns_stack_size ? dns_stack_size : task_stack_size;
+}
+
+int
+hev_config_get_misc_task_stack_watermark (void)
+{
+    return task_stack_watermark;
+}
+
+int
+hev_config_get_misc_task_pool_size (void)
+{
+    return task_pool_size;
+}
+
 int
 hev_config_get_misc_udp_recv_buffer_size (void)
 {
@@ -547,6 +1047,24 @@ hev_config_get_misc_udp_copy_buffer_nums (void)
     return udp_copy_buffer_nums;
 }
 
+int
+hev_config_get_misc_udp_packet_pool_size (void)
+{
+    return udp_packet_pool_size;
+}
+
+int
+hev_config_get_misc_tsocks_cache_size (void)
+{
+    return tsocks_cache_size;
+}
+
+int
+hev_config_get_misc_udp_reply_mode (void)
+{
+    return udp_reply_mode;
+}
+
 int
 hev_config_get_misc_connect_timeout (void)
 {
@@ -565,6 +1083,30 @@ hev_config_get_misc_udp_read_write_timeout (void)
     return udp_read_write_timeout;
 }
 
+int
+hev_config_get_misc_tcp_kernel_splice (void)
+{
+    return tcp_kernel_splice;
+}
+
+int
+hev_config_get_misc_tcp_splice_pipe_size (void)
+{
+    return tcp_splice_pipe_size;
+}
+
+int
+hev_config_get_misc_tcp_splice_threshold (void)
+{
+    return tcp_splice_threshold;
+}
+
+int
+hev_config_get_misc_tcp_park_idle (void)
+{
+    return tcp_park_idle;
+}
+
 int
 hev_config_get_misc_limit_nofile (void)
 {
@@ -12,15 +12,44 @@
 
 typedef struct _HevConfigServer HevConfigServer;
 
+enum
+{
+    HEV_CONFIG_UDP_REPLY_CACHE,
+    HEV_CONFIG_UDP_REPLY_PKTINFO,
+};
+
+enum
+{
+    HEV_CONFIG_BALANCE_LEAST_CONN,
+    HEV_CONFIG_BALANCE_P2C,
+};
+
+enum
+{
+    HEV_CONFIG_DNS_MODE_TASK,
+    HEV_CONFIG_DNS_MODE_EVENT,
+};
+
 struct _HevConfigServer
 {
     const char *user;
     const char *pass;
     unsigned int mark;
+    unsigned int pool_size;
+    unsigned int pool_rate;
+    unsigned int pool_idle;
+    unsigned int weight;
+    unsigned int health_interval;
+    unsigned int health_rise;
+    unsigned int health_fall;
+    unsigned int breaker_failures;
+    unsigned int breaker_cooldown;
+    unsigned int connect_delay;
     short udp_in_udp;
     unsigned short port;
     unsigned char pipeline;
     unsigned char fastopen;
+    unsigned char fail_open;
     char udp_addr[256];
     char addr[256];
 };
@@ -30,6 +59,8 @@ int hev_config_init (const char *path);
 unsigned int hev_config_get_workers (void);
 
 HevConfigServer *hev_config_get_socks5_server (void);
+HevConfigServer *hev_config_get_socks5_servers (unsigned int *count);
+int hev_config_get_socks5_balance (void);
 const char *hev_config_get_tcp_address (void);
 const char *hev_config_get_tcp_port (void);
 const char *hev_config_get_udp_address (void);
@@ -37,13 +68,42 @@ const char *hev_config_get_udp_port (void);
 const char *hev_config_get_dns_upstream (void);
 const char *hev_config_get_dns_address (void);
 const char *hev_config_get_dns_port (void);
+int hev_config_get_dns_upstream_sockets (void);
+int hev_config_get_dns_upstream_race (void);
+int hev_config_get_dns_mode (void);
+int hev_config_get_dns_cache_size (void);
+int hev_config_get_dns_cache_min_ttl (void);
+int hev_config_get_dns_cache_max_ttl (void);
+int hev_config_get_dns_cache_negative_ttl (void);
+int hev_config_get_dns_cache_stale_ttl (void);
+int hev_config_get_dns_cache_prefetch (void);
+const char *hev_config_get_dns_fake_ip_range (void);
+const char *hev_config_get_dns_fake_ip_range6 (void);
+int hev_config_get_dns_fake_ip_size (void);
+const char *hev_config_get_dns_preconnect_ports (void);
+int hev_config_get_dns_preconnect_max (void);
+int hev_config_get_dns_preconnect_idle (void);
+const char *hev_config_get_bypass_file (void);
+unsigned int hev_config_get_bypass_mark (void);
 
 int hev_config_get_misc_task_stack_size (void);
+int hev_config_get_misc_tcp_stack_size (void);
+int hev_config_get_misc_udp_stack_size (void);
+int hev_config_get_misc_dns_stack_size (void);
+int hev_config_get_misc_task_stack_watermark (void);
+int hev_config_get_misc_task_pool_size (void);
 int hev_config_get_misc_udp_recv_buffer_size (void);
 int hev_config_get_misc_udp_copy_buffer_nums (void);
+int hev_config_get_misc_udp_packet_pool_size (void);
+int hev_config_get_misc_tsocks_cache_size (void);
+int hev_config_get_misc_udp_reply_mode (void);
 int hev_config_get_misc_connect_timeout (void);
 int hev_config_get_misc_tcp_read_write_timeout (void);
 int hev_config_get_misc_udp_read_write_timeout (void);
+int hev_config_get_misc_tcp_kernel_splice (void);
+int hev_config_get_misc_tcp_splice_pipe_size (void);
+int hev_config_get_misc_tcp_splice_threshold (void);
+int hev_config_get_misc_tcp_park_idle (void);
 int hev_config_get_misc_limit_nofile (void);
 const char *hev_config_get_misc_pid_file (void);
 const char *hev_config_get_misc_log_file (void);
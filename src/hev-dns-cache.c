@@ -0,0 +1,367 @@
+/*
+ ============================================================================
+ Name        : hev-dns-cache.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Cache
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-list.h"
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-compiler.h"
+#include "hev-dns-msg.h"
+
+#include "hev-dns-cache.h"
+
+#define STALE_ANSWER_TTL (30)
+#define REFRESH_RETRY (5000)
+
+typedef struct _HevDNSCacheEntry HevDNSCacheEntry;
+typedef struct _HevDNSCacheTTL HevDNSCacheTTL;
+
+struct _HevDNSCacheEntry
+{
+    HevListNode node;
+    HevDNSCacheEntry *next;
+    int64_t expire;
+    int64_t refresh;
+    uint32_t hash;
+    uint32_t ttl;
+    unsigned int hits;
+    unsigned short klen;
+    unsigned short len;
+    unsigned char data[0];
+};
+
+struct _HevDNSCache
+{
+    HevDNSCacheEntry **buckets;
+    HevList lru;
+    unsigned int mask;
+    unsigned int size;
+    unsigned int count;
+    uint32_t seed;
+
+    unsigned int min_ttl;
+    unsigned int max_ttl;
+    unsigned int neg_ttl;
+    unsigned int stale_ttl;
+    unsigned int prefetch;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evicts;
+    unsigned long stales;
+    unsigned long refreshes;
+};
+
+struct _HevDNSCacheTTL
+{
+    uint32_t ttl;
+    int soa;
+};
+
+HevDNSCache *
+hev_dns_cache_new (unsigned int size)
+{
+    HevDNSCache *self;
+    unsigned int s;
+
+    self = hev_malloc0 (sizeof (HevDNSCache));
+    if (!self)
+        return NULL;
+
+    for (s = 16; s < size; s <<= 1)
+        ;
+
+    self->buckets = hev_malloc0 (sizeof (HevDNSCacheEntry *) * s);
+    if (!self->buckets) {
+        hev_free (self);
+        return NULL;
+    }
+
+    self->mask = s - 1;
+    self->size = size;
+    self->seed = (uintptr_t)self ^ get_monotonic_ms ();
+    self->min_ttl = hev_config_get_dns_cache_min_ttl ();
+    self->max_ttl = hev_config_get_dns_cache_max_ttl ();
+    self->neg_ttl = hev_config_get_dns_cache_negative_ttl ();
+    self->stale_ttl = hev_config_get_dns_cache_stale_ttl ();
+    self->prefetch = hev_config_get_dns_cache_prefetch ();
+
+    LOG_D ("%p dns cache new", self);
+
+    return self;
+}
+
+void
+hev_dns_cache_destroy (HevDNSCache *self)
+{
+    HevListNode *node;
+
+    LOG_D ("%p dns cache destroy", self);
+    LOG_I ("%p dns cache hits %lu misses %lu evicts %lu stales %lu "
+           "refreshes %lu",
+           self, self->hits, self->misses, self->evicts, self->stales,
+           self->refreshes);
+
+    node = hev_list_first (&self->lru);
+    while (node) {
+        HevDNSCacheEntry *entry;
+
+        entry = container_of (node, HevDNSCacheEntry, node);
+        node = hev_list_node_next (node);
+        hev_free (entry);
+    }
+
+    hev_free (self->buckets);
+    hev_free (self);
+}
+
+static HevDNSCacheEntry *
+hev_dns_cache_find (HevDNSCache *self, HevDNSKey *key, uint32_t hash)
+{
+    HevDNSCacheEntry *entry = self->buckets[hash & self->mask];
+
+    for (; entry; entry = entry->next) {
+        if (entry->hash == hash &&
+            hev_dns_key_equal (key, entry->data, entry->klen))
+            break;
+    }
+
+    return entry;
+}
+
+static void
+hev_dns_cache_remove (HevDNSCache *self, HevDNSCacheEntry *entry)
+{
+    HevDNSCacheEntry **pp = &self->buckets[entry->hash & self->mask];
+
+    for (; *pp != entry; pp = &(*pp)->next)
+        ;
+
+    *pp = entry->next;
+    hev_list_del (&self->lru, &entry->node);
+    hev_free (entry);
+    self->count--;
+}
+
+static int
+hev_dns_cache_age (unsigned char *rr, int section, void *user)
+{
+    uint32_t *remain = user;
+
+    if (hev_dns_msg_get16 (rr) == HEV_DNS_TYPE_OPT)
+        return 0;
+
+    if (hev_dns_msg_get32 (rr + 4) > *remain)
+        hev_dns_msg_set32 (rr + 4, *remain);
+
+    return 0;
+}
+
+static int
+hev_dns_cache_refresh_due (HevDNSCache *self, HevDNSCacheEntry *entry,
+                           int64_t now)
+{
+    int64_t left = entry->expire - now;
+
+    if (entry->refresh && now - entry->refresh < REFRESH_RETRY)
+        return 0;
+
+    /* expired, or popular and within the last tenth of its lifetime */
+    if (left > 0 && (!self->prefetch || entry->hits < self->prefetch ||
+                     left * 10 > entry->ttl * 1000LL))
+        return 0;
+
+    entry->refresh = now;
+    self->refreshes++;
+
+    return 1;
+}
+
+int
+hev_dns_cache_lookup (HevDNSCache *self, void *msg, size_t len, size_t cap,
+                      int stream, HevDNSKey *refresh)
+{
+    unsigned char *buf = msg;
+    HevDNSCacheEntry *entry;
+    HevDNSKey key;
+    uint32_t remain;
+    uint32_t hash;
+    int64_t now;
+    int qend;
+
+    if (refresh)
+        refresh->len = 0;
+
+    if (hev_dns_msg_is_response (buf) || (buf[2] & 0x78))
+        return -1;
+
+    qend = hev_dns_msg_key (buf, len, &key);
+    if (qend < 0)
+        return -1;
+
+    hash = hev_dns_key_hash (&key, self->seed);
+    entry = hev_dns_cache_find (self, &key, hash);
+    if (!entry)
+        goto miss;
+
+    now = get_monotonic_ms ();
+    if (entry->expire + self->stale_ttl * 1000LL <= now) {
+        hev_dns_cache_remove (self, entry);
+        goto miss;
+    }
+
+    if (entry->len > cap || (!stream && entry->len > key.udp_size))
+        goto miss;
+
+    hev_list_del (&self->lru, &entry->node);
+    hev_list_add_tail (&self->lru, &entry->node);
+    entry->hits++;
+    self->hits++;
+
+    if (refresh && hev_dns_cache_refresh_due (self, entry, now)) {
+        memcpy (refresh->data, entry->data, entry->klen);
+        refresh->len = entry->klen;
+        refresh->udp_size = 1232;
+    }
+
+    hev_dns_msg_answer (buf, qend, cap, entry->data + entry->klen, entry->len);
+
+    /* RFC 8767: a stale answer goes out with a short ttl */
+    if (entry->expire <= now) {
+        remain = STALE_ANSWER_TTL;
+        self->stales++;
+    } else {
+        remain = (entry->expire - now + 999) / 1000;
+    }
+    hev_dns_msg_foreach_rr (buf, entry->len, hev_dns_cache_age, &remain);
+
+    return entry->len;
+
+miss:
+    self->misses++;
+    return -1;
+}
+
+static int
+hev_dns_cache_min_ttl (unsigned char *rr, int section, void *user)
+{
+    HevDNSCacheTTL *t = user;
+    uint32_t ttl;
+
+    if (section == HEV_DNS_SECTION_ADDITIONAL)
+        return 1;
+
+    ttl = hev_dns_msg_get32 (rr + 4);
+
+    /* RFC 2308: negative answers live min(SOA ttl, SOA minimum) */
+    if (section == HEV_DNS_SECTION_AUTHORITY &&
+        hev_dns_msg_get16 (rr) == HEV_DNS_TYPE_SOA) {
+        unsigned int rdlen = hev_dns_msg_get16 (rr + 8);
+
+        if (rdlen >= 22) {
+            uint32_t min = hev_dns_msg_get32 (rr + 10 + rdlen - 4);
+
+            if (min < ttl)
+                ttl = min;
+        }
+        t->soa = 1;
+    }
+
+    if (ttl < t->ttl)
+        t->ttl = ttl;
+
+    return 0;
+}
+
+static unsigned int
+hev_dns_cache_ttl (HevDNSCache *self, void *msg, size_t len)
+{
+    HevDNSCacheTTL t = { UINT32_MAX, 0 };
+    int negative;
+    int rcode;
+
+    rcode = hev_dns_msg_rcode (msg);
+    if (rcode != HEV_DNS_RCODE_NOERROR && rcode != HEV_DNS_RCODE_NXDOMAIN)
+        return 0;
+
+    if (hev_dns_msg_foreach_rr (msg, len, hev_dns_cache_min_ttl, &t) < 0)
+        return 0;
+
+    negative = rcode == HEV_DNS_RCODE_NXDOMAIN ||
+               hev_dns_msg_get16 ((unsigned char *)msg + 6) == 0;
+
+    if (negative) {
+        if (!t.soa || t.ttl > self->neg_ttl)
+            t.ttl = self->neg_ttl;
+        return t.ttl;
+    }
+
+    if (t.ttl < self->min_ttl)
+        t.ttl = self->min_ttl;
+    if (t.ttl > self->max_ttl)
+        t.ttl = self->max_ttl;
+
+    return t.ttl;
+}
+
+void
+hev_dns_cache_insert (HevDNSCache *self, void *msg, size_t len)
+{
+    HevDNSCacheEntry *entry;
+    unsigned int ttl;
+    HevDNSKey key;
+    uint32_t hash;
+
+    if (len < HEV_DNS_MSG_HDR_SIZE || !hev_dns_msg_is_response (msg) ||
+        hev_dns_msg_is_truncated (msg))
+        return;
+
+    if (hev_dns_msg_key (msg, len, &key) < 0)
+        return;
+
+    ttl = hev_dns_cache_ttl (self, msg, len);
+    if (!ttl)
+        return;
+
+    hash = hev_dns_key_hash (&key, self->seed);
+    entry = hev_dns_cache_find (self, &key, hash);
+    if (entry)
+        hev_dns_cache_remove (self, entry);
+
+    if (self->count >= self->size) {
+        HevListNode *node = hev_list_first (&self->lru);
+
+        hev_dns_cache_remove (self,
+                              container_of (node, HevDNSCacheEntry, node));
+        self->evicts++;
+    }
+
+    entry = hev_malloc (sizeof (HevDNSCacheEntry) + key.len + len);
+    if (!entry)
+        return;
+
+    entry->hash = hash;
+    entry->klen = key.len;
+    entry->len = len;
+    entry->expire = get_monotonic_ms () + ttl * 1000LL;
+    entry->refresh = 0;
+    entry->ttl = ttl;
+    entry->hits = 0;
+    memcpy (entry->data, key.data, key.len);
+    memcpy (entry->data + key.len, msg, len);
+
+    entry->next = self->buckets[hash & self->mask];
+    self->buckets[hash & self->mask] = entry;
+    hev_list_add_tail (&self->lru, &entry->node);
+    self->count++;
+}
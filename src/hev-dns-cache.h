@@ -0,0 +1,36 @@
+/*
+ ============================================================================
+ Name        : hev-dns-cache.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Cache
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_CACHE_H__
+#define __HEV_DNS_CACHE_H__
+
+#include <stddef.h>
+
+#include "hev-dns-msg.h"
+
+typedef struct _HevDNSCache HevDNSCache;
+
+HevDNSCache *hev_dns_cache_new (unsigned int size);
+void hev_dns_cache_destroy (HevDNSCache *self);
+
+/*
+ * Answer the query in msg from the cache. On a hit msg is rewritten in
+ * place into the answer and its length is returned, otherwise -1. Unless
+ * the query came over a stream, the answer must also fit the payload size
+ * it advertises. An expired answer is still served within the stale
+ * window. When the entry should be fetched again, stale or popular and
+ * close to expiry, its key is copied to refresh, otherwise refresh->len is
+ * set to zero.
+ */
+int hev_dns_cache_lookup (HevDNSCache *self, void *msg, size_t len,
+                          size_t cap, int stream, HevDNSKey *refresh);
+
+void hev_dns_cache_insert (HevDNSCache *self, void *msg, size_t len);
+
+#endif /* __HEV_DNS_CACHE_H__ */
@@ -0,0 +1,1471 @@
+/*
+ ============================================================================
+ Name        : hev-dns-forwarder.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Forwarder
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-dns-msg.h"
+#include "hev-compiler.h"
+#include "hev-config-const.h"
+
+#include "hev-dns-forwarder.h"
+
+#define EXCHANGE_BUCKETS (256)
+#define EXCHANGE_MAX (16384)
+#define SOCK_ROTATE (64)
+#define RAND_POOL (64)
+#define RECV_BUF_SIZE (65536)
+#define UPSTREAM_MAX (8)
+#define RETRY_MAX (3)
+#define RTO_INIT (1000)
+#define RTO_MIN (50)
+#define RTO_MAX (4000)
+#define DEMOTE_FAILS (3)
+#define DEMOTE_TIME (30000)
+#define STREAM_BUF_SIZE (2 + 65535)
+#define STREAM_TIMEOUT (5000)
+#define STREAM_IDLE (30000)
+
+typedef struct _HevDNSForwarderSock HevDNSForwarderSock;
+typedef struct _HevDNSForwarderStream HevDNSForwarderStream;
+typedef struct _HevDNSForwarderUpstream HevDNSForwarderUpstream;
+typedef struct _HevDNSForwarderExchange HevDNSForwarderExchange;
+typedef struct _HevDNSForwarderRefresh HevDNSForwarderRefresh;
+
+struct _HevDNSForwarderSock
+{
+    int fd;
+    unsigned int inflight;
+    unsigned int uses;
+};
+
+/*
+ * Persistent TCP connection to one upstream, opened on the first truncated
+ * reply. Requests are pipelined, replies are matched by transaction ID.
+ */
+struct _HevDNSForwarderStream
+{
+    HevDNSForwarder *forwarder;
+    HevTask *task;
+    unsigned char *wbuf;
+    size_t wlen;
+    size_t woff;
+    size_t wcap;
+    size_t rlen;
+    unsigned int idx;
+    unsigned int inflight;
+    int run;
+    unsigned char rbuf[STREAM_BUF_SIZE];
+};
+
+/*
+ * Round trip state of one upstream, kept as in RFC 6298. An upstream that
+ * keeps timing out is demoted behind the others until it answers again or
+ * the demotion expires.
+ */
+struct _HevDNSForwarderUpstream
+{
+    struct sockaddr_in6 addr;
+    int64_t demoted;
+    unsigned int srtt;
+    unsigned int rttvar;
+    unsigned int rto;
+    unsigned int fails;
+
+    unsigned long sent;
+    unsigned long answered;
+    unsigned long timeouts;
+};
+
+struct _HevDNSForwarderExchange
+{
+    HevDNSForwarderExchange *next;
+    HevDNSForwarderExchange *knext;
+    HevDNSQuery *queries;
+    unsigned int slot;
+    int64_t start;
+    int64_t deadline;
+    uint32_t hash;
+    unsigned short uid;
+    unsigned short sock;
+    unsigned short len;
+    unsigned char upstream;
+    unsigned char tries;
+    unsigned char tried;
+    unsigned char round;
+    unsigned char stream;
+    HevDNSKey key;
+    unsigned char request[0];
+};
+
+struct _HevDNSForwarderRefresh
+{
+    HevDNSQuery query;
+    HevDNSCache *cache;
+    unsigned char buffer[0];
+};
+
+struct _HevDNSForwarder
+{
+    HevTask *task;
+    HevTask *owner;
+    HevDNSForwarderSock *socks;
+    HevDNSForwarderExchange *by_uid[EXCHANGE_BUCKETS];
+    HevDNSForwarderExchange *by_key[EXCHANGE_BUCKETS];
+    HevDNSForwarderUpstream upstreams[UPSTREAM_MAX];
+    HevDNSForwarderStream *streams[UPSTREAM_MAX];
+    HevDNSForwarderExchange **heap;
+    unsigned int nheap;
+    unsigned int heap_size;
+    unsigned char *buffer;
+    unsigned int nupstreams;
+    unsigned int nsocks;
+    unsigned int count;
+    uint64_t rand;
+    uint32_t rands[RAND_POOL];
+    unsigned int nrands;
+    uint32_t seed;
+    int race;
+    int run;
+
+    unsigned long queries;
+    unsigned long coalesced;
+    unsigned long retries;
+    unsigned long streamed;
+};
+
+static int
+hev_dns_forwarder_parse_ip (const char *addr, int port,
+                            struct sockaddr_in6 *saddr)
+{
+    saddr->sin6_family = AF_INET6;
+    saddr->sin6_port = htons (port);
+
+    if (inet_pton (AF_INET, addr, &saddr->sin6_addr.s6_addr[12]) == 1) {
+        saddr->sin6_addr.s6_addr[10] = 0xff;
+        saddr->sin6_addr.s6_addr[11] = 0xff;
+        return 0;
+    }
+
+    if (inet_pton (AF_INET6, addr, &saddr->sin6_addr) == 1)
+        return 0;
+
+    return -1;
+}
+
+static int
+hev_dns_forwarder_parse_upstream (const char *str, struct sockaddr_in6 *saddr)
+{
+    const char *port = NULL;
+    const char *end;
+    char host[256];
+    size_t len;
+    long num = 53;
+
+    /* host, host:port, ipv6 or [ipv6]:port */
+    if (str[0] == '[') {
+        end = strchr (str, ']');
+        if (!end)
+            return -1;
+        if (end[1] == ':')
+            port = end + 2;
+        else if (end[1])
+            return -1;
+        str++;
+    } else {
+        end = strchr (str, ':');
+        if (end && !strchr (end + 1, ':'))
+            port = end + 1;
+        else
+            end = str + strlen (str);
+    }
+
+    len = end - str;
+    if (len >= sizeof (host))
+        return -1;
+
+    memcpy (host, str, len);
+    host[len] = '\0';
+
+    if (port) {
+        num = strtol (port, NULL, 10);
+        if (num <= 0 || num > 65535)
+            return -1;
+    }
+
+    return hev_dns_forwarder_parse_ip (host, num, saddr);
+}
+
+static int
+hev_dns_forwarder_parse_upstreams (HevDNSForwarder *self, const char *list)
+{
+    char buf[1024];
+    char *save;
+    char *tok;
+
+    strncpy (buf, list, sizeof (buf) - 1);
+    buf[sizeof (buf) - 1] = '\0';
+
+    for (tok = strtok_r (buf, ", \t", &save); tok;
+         tok = strtok_r (NULL, ", \t", &save)) {
+        HevDNSForwarderUpstream *up;
+
+        if (self->nupstreams == UPSTREAM_MAX) {
+            LOG_W ("%p dns forwarder upstreams over %d", self, UPSTREAM_MAX);
+            break;
+        }
+
+        up = &self->upstreams[self->nupstreams];
+        if (hev_dns_forwarder_parse_upstream (tok, &up->addr) < 0) {
+            LOG_E ("dns forwarder upstream %s", tok);
+            return -1;
+        }
+
+        up->rto = RTO_INIT;
+        self->nupstreams++;
+    }
+
+    return self->nupstreams ? 0 : -1;
+}
+
+/*
+ * Transaction IDs and source sockets are all an off-path attacker has to
+ * guess, so they come from the kernel. The generator only stands in when
+ * getrandom is unavailable.
+ */
+static unsigned int
+hev_dns_forwarder_rand (HevDNSForwarder *self)
+{
+    uint64_t x = self->rand;
+
+    if (self->nrands)
+        return self->rands[--self->nrands];
+
+    if (getrandom (self->rands, sizeof (self->rands), GRND_NONBLOCK) ==
+        sizeof (self->rands)) {
+        self->nrands = RAND_POOL;
+        return self->rands[--self->nrands];
+    }
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    self->rand = x;
+
+    return (x * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static int
+hev_dns_forwarder_sock_open (HevDNSForwarder *self)
+{
+    HevConfigServer *srv = hev_config_get_socks5_server ();
+    int fd;
+
+    fd = hev_task_io_socket_socket (AF_INET6, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+
+    if (srv->mark && set_sock_mark (fd, srv->mark) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * A socket that has been used enough takes no new exchanges, so it drains
+ * and is replaced soon even under steady load.
+ */
+static unsigned int
+hev_dns_forwarder_sock_pick (HevDNSForwarder *self)
+{
+    unsigned int idx = hev_dns_forwarder_rand (self) % self->nsocks;
+    unsigned int i;
+
+    for (i = 0; i < self->nsocks; i++) {
+        unsigned int j = (idx + i) % self->nsocks;
+
+        if (self->socks[j].uses < SOCK_ROTATE)
+            return j;
+    }
+
+    return idx;
+}
+
+HevDNSForwarder *
+hev_dns_forwarder_new (void)
+{
+    HevDNSForwarder *self;
+    const char *upstream;
+    int i;
+
+    self = hev_malloc0 (sizeof (HevDNSForwarder));
+    if (!self)
+        return NULL;
+
+    upstream = hev_config_get_dns_upstream ();
+    if (hev_dns_forwarder_parse_upstreams (self, upstream) < 0) {
+        LOG_E ("dns forwarder upstream %s", upstream);
+        goto free;
+    }
+
+    self->race = hev_config_get_dns_upstream_race ();
+
+    self->nsocks = hev_config_get_dns_upstream_sockets ();
+    if (!self->nsocks)
+        self->nsocks = 1;
+
+    self->socks = hev_malloc0 (sizeof (HevDNSForwarderSock) * self->nsocks);
+    if (!self->socks)
+        goto free;
+
+    for (i = 0; i < self->nsocks; i++)
+        self->socks[i].fd = -1;
+
+    for (i = 0; i < self->nsocks; i++) {
+        self->socks[i].fd = hev_dns_forwarder_sock_open (self);
+        if (self->socks[i].fd < 0) {
+            LOG_E ("dns forwarder socket");
+            goto free_socks;
+        }
+    }
+
+    self->buffer = hev_malloc (RECV_BUF_SIZE);
+    if (!self->buffer)
+        goto free_socks;
+
+    self->heap_size = 256;
+    self->heap = hev_malloc (sizeof (HevDNSForwarderExchange *) *
+                             self->heap_size);
+    if (!self->heap)
+        goto free_buffer;
+
+    self->task = hev_task_new (-1);
+    if (!self->task)
+        goto free_heap;
+
+    self->rand = ((uintptr_t)self ^ get_monotonic_ms () ^ getpid ()) | 1;
+    self->seed = hev_dns_forwarder_rand (self);
+
+    LOG_D ("%p dns forwarder new", self);
+
+    return self;
+
+free_heap:
+    hev_free (self->heap);
+free_buffer:
+    hev_free (self->buffer);
+free_socks:
+    for (i = 0; i < self->nsocks; i++)
+        if (self->socks[i].fd >= 0)
+            close (self->socks[i].fd);
+    hev_free (self->socks);
+free:
+    hev_free (self);
+    return NULL;
+}
+
+void
+hev_dns_forwarder_destroy (HevDNSForwarder *self)
+{
+    int i;
+
+    LOG_D ("%p dns forwarder destroy", self);
+    LOG_I ("%p dns forwarder queries %lu coalesced %lu retries %lu "
+           "streamed %lu",
+           self, self->queries, self->coalesced, self->retries,
+           self->streamed);
+
+    for (i = 0; i < self->nupstreams; i++) {
+        HevDNSForwarderUpstream *up = &self->upstreams[i];
+
+        LOG_I ("%p dns forwarder upstream %d sent %lu answered %lu "
+               "timeouts %lu srtt %u rto %u",
+               self, i, up->sent, up->answered, up->timeouts, up->srtt,
+               up->rto);
+    }
+
+    for (i = 0; i < self->nsocks; i++)
+        if (self->socks[i].fd >= 0)
+            close (self->socks[i].fd);
+
+    hev_task_unref (self->task);
+    hev_free (self->heap);
+    hev_free (self->buffer);
+    hev_free (self->socks);
+    hev_free (self);
+}
+
+static void
+hev_dns_forwarder_heap_set (HevDNSForwarder *self, unsigned int i,
+                            HevDNSForwarderExchange *ex)
+{
+    self->heap[i] = ex;
+    ex->slot = i;
+}
+
+static void
+hev_dns_forwarder_heap_up (HevDNSForwarder *self, unsigned int i)
+{
+    HevDNSForwarderExchange *ex = self->heap[i];
+
+    while (i) {
+        unsigned int p = (i - 1) / 2;
+
+        if (self->heap[p]->deadline <= ex->deadline)
+            break;
+
+        hev_dns_forwarder_heap_set (self, i, self->heap[p]);
+        i = p;
+    }
+
+    hev_dns_forwarder_heap_set (self, i, ex);
+}
+
+static void
+hev_dns_forwarder_heap_down (HevDNSForwarder *self, unsigned int i)
+{
+    HevDNSForwarderExchange *ex = self->heap[i];
+
+    for (;;) {
+        unsigned int c = i * 2 + 1;
+
+        if (c >= self->nheap)
+            break;
+
+        if (c + 1 < self->nheap &&
+            self->heap[c + 1]->deadline < self->heap[c]->deadline)
+            c++;
+
+        if (ex->deadline <= self->heap[c]->deadline)
+            break;
+
+        hev_dns_forwarder_heap_set (self, i, self->heap[c]);
+        i = c;
+    }
+
+    hev_dns_forwarder_heap_set (self, i, ex);
+}
+
+static void
+hev_dns_forwarder_heap_fix (HevDNSForwarder *self, unsigned int i)
+{
+    HevDNSForwarderExchange *ex = self->heap[i];
+
+    if (i && self->heap[(i - 1) / 2]->deadline > ex->deadline)
+        hev_dns_forwarder_heap_up (self, i);
+    else
+        hev_dns_forwarder_heap_down (self, i);
+}
+
+static int
+hev_dns_forwarder_heap_reserve (HevDNSForwarder *self)
+{
+    HevDNSForwarderExchange **heap;
+    unsigned int size;
+
+    if (self->nheap < self->heap_size)
+        return 0;
+
+    size = self->heap_size * 2;
+    heap = hev_realloc (self->heap, sizeof (HevDNSForwarderExchange *) * size);
+    if (!heap)
+        return -1;
+
+    self->heap = heap;
+    self->heap_size = size;
+
+    return 0;
+}
+
+static void
+hev_dns_forwarder_heap_add (HevDNSForwarder *self, HevDNSForwarderExchange *ex)
+{
+    self->heap[self->nheap] = ex;
+    hev_dns_forwarder_heap_up (self, self->nheap++);
+}
+
+static void
+hev_dns_forwarder_heap_del (HevDNSForwarder *self, HevDNSForwarderExchange *ex)
+{
+    unsigned int i = ex->slot;
+    HevDNSForwarderExchange *last;
+
+    last = self->heap[--self->nheap];
+    if (last == ex)
+        return;
+
+    hev_dns_forwarder_heap_set (self, i, last);
+    hev_dns_forwarder_heap_fix (self, i);
+}
+
+static HevDNSForwarderExchange *
+hev_dns_forwarder_find_uid (HevDNSForwarder *self, unsigned int uid)
+{
+    HevDNSForwarderExchange *ex = self->by_uid[uid % EXCHANGE_BUCKETS];
+
+    for (; ex; ex = ex->next)
+        if (ex->uid == uid)
+            break;
+
+    return ex;
+}
+
+static HevDNSForwarderExchange *
+hev_dns_forwarder_find_key (HevDNSForwarder *self, HevDNSKey *key,
+                            uint32_t hash)
+{
+    HevDNSForwarderExchange *ex = self->by_key[hash % EXCHANGE_BUCKETS];
+
+    for (; ex; ex = ex->knext)
+        if (ex->hash == hash && hev_dns_key_equal (key, ex->key.data,
+                                                   ex->key.len))
+            break;
+
+    return ex;
+}
+
+static void
+hev_dns_forwarder_rotate (HevDNSForwarder *self, HevDNSForwarderSock *sock)
+{
+    int fd;
+
+    /* a fresh socket gets a fresh random source port from the kernel */
+    fd = hev_dns_forwarder_sock_open (self);
+    if (fd < 0)
+        return;
+
+    hev_task_del_fd (self->owner, sock->fd);
+    close (sock->fd);
+
+    sock->fd = fd;
+    sock->uses = 0;
+    hev_task_add_fd (self->owner, fd, POLLIN);
+}
+
+static void
+hev_dns_forwarder_unlink (HevDNSForwarder *self, HevDNSForwarderExchange *ex)
+{
+    HevDNSForwarderExchange **pp;
+    HevDNSForwarderSock *sock;
+
+    for (pp = &self->by_uid[ex->uid % EXCHANGE_BUCKETS]; *pp != ex;
+         pp = &(*pp)->next)
+        ;
+    *pp = ex->next;
+
+    for (pp = &self->by_key[ex->hash % EXCHANGE_BUCKETS]; *pp != ex;
+         pp = &(*pp)->knext)
+        ;
+    *pp = ex->knext;
+
+    hev_dns_forwarder_heap_del (self, ex);
+    if (ex->stream)
+        self->streams[ex->stream - 1]->inflight--;
+    self->count--;
+
+    sock = &self->socks[ex->sock];
+    if (!--sock->inflight && sock->uses >= SOCK_ROTATE && self->owner &&
+        READ_ONCE (self->run))
+        hev_dns_forwarder_rotate (self, sock);
+}
+
+/*
+ * Waiters on one exchange may accept different reply sizes. A datagram
+ * sender gets at most its EDNS payload size, a larger reply is turned
+ * into a truncated one, the same as an answer from the cache.
+ */
+static void
+hev_dns_forwarder_answer (HevDNSQuery *query, const void *reply, int len)
+{
+    int res = -1;
+
+    query->next = NULL;
+    query->exchange = NULL;
+
+    if (len > 0) {
+        size_t limit = query->udp_size;
+
+        if (limit > query->size)
+            limit = query->size;
+
+        if (!query->stream && (size_t)len > limit)
+            res = hev_dns_msg_truncate (query->buffer, query->qend, reply);
+        else if ((size_t)len <= query->size || !query->resize ||
+                 query->resize (query, len) == 0)
+            res = hev_dns_msg_answer (query->buffer, query->qend,
+                                      query->size, reply, len);
+    }
+
+    query->done (query, res);
+}
+
+static void
+hev_dns_forwarder_complete (HevDNSForwarder *self, HevDNSForwarderExchange *ex,
+                            const void *reply, int len)
+{
+    HevDNSQuery *query = ex->queries;
+
+    hev_dns_forwarder_unlink (self, ex);
+
+    while (query) {
+        HevDNSQuery *next = query->next;
+
+        hev_dns_forwarder_answer (query, reply, len);
+        query = next;
+    }
+
+    hev_free (ex);
+}
+
+static unsigned int
+hev_dns_forwarder_score (HevDNSForwarderUpstream *up, int64_t now)
+{
+    /* demoted upstreams rank behind every healthy one */
+    if (up->demoted > now)
+        return up->rto + RTO_MAX;
+
+    return up->rto;
+}
+
+static int
+hev_dns_forwarder_pick (HevDNSForwarder *self, unsigned int skip, int64_t now)
+{
+    unsigned int best_score = -1;
+    int best = -1;
+    int i;
+
+    for (i = 0; i < self->nupstreams; i++) {
+        unsigned int score;
+
+        if (skip & (1 << i))
+            continue;
+
+        score = hev_dns_forwarder_score (&self->upstreams[i], now);
+        if (score < best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+static void
+hev_dns_forwarder_sample (HevDNSForwarderUpstream *up, unsigned int rtt)
+{
+    unsigned int var;
+
+    if (!up->srtt) {
+        up->srtt = rtt ? rtt : 1;
+        up->rttvar = rtt / 2;
+    } else {
+        unsigned int delta = up->srtt > rtt ? up->srtt - rtt : rtt - up->srtt;
+
+        up->rttvar = (up->rttvar * 3 + delta) / 4;
+        up->srtt = (up->srtt * 7 + rtt) / 8;
+    }
+
+    var = up->rttvar * 4;
+    if (var < 10)
+        var = 10;
+
+    up->rto = up->srtt + var;
+    if (up->rto < RTO_MIN)
+        up->rto = RTO_MIN;
+    else if (up->rto > RTO_MAX)
+        up->rto = RTO_MAX;
+}
+
+static void
+hev_dns_forwarder_penalize (HevDNSForwarder *self, unsigned int idx,
+                            int64_t now)
+{
+    HevDNSForwarderUpstream *up = &self->upstreams[idx];
+
+    up->timeouts++;
+    up->rto *= 2;
+    if (up->rto > RTO_MAX)
+        up->rto = RTO_MAX;
+
+    /* a dead upstream is demoted again each time the last one runs out */
+    if (++up->fails >= DEMOTE_FAILS && up->demoted <= now) {
+        up->demoted = now + DEMOTE_TIME;
+        LOG_I ("%p dns forwarder upstream %u demoted", self, idx);
+    }
+}
+
+static int
+hev_dns_forwarder_send (HevDNSForwarder *self, HevDNSForwarderExchange *ex,
+                        unsigned int idx)
+{
+    HevDNSForwarderUpstream *up = &self->upstreams[idx];
+    ssize_t res;
+
+    res = sendto (self->socks[ex->sock].fd, ex->request, ex->len, 0,
+                  (struct sockaddr *)&up->addr, sizeof (up->addr));
+    if (res <= 0) {
+        LOG_D ("%p dns forwarder send", self);
+        return -1;
+    }
+
+    ex->tried |= 1 << idx;
+    ex->round |= 1 << idx;
+    up->sent++;
+
+    return 0;
+}
+
+/*
+ * Deadlines follow the RTO of the upstream at the time of sending, which
+ * changes with every sample, so the exchanges are kept in a heap.
+ */
+static void
+hev_dns_forwarder_arm (HevDNSForwarder *self, HevDNSForwarderExchange *ex,
+                       unsigned int idx, int64_t deadline)
+{
+    ex->upstream = idx;
+    ex->deadline = deadline;
+    hev_dns_forwarder_heap_fix (self, ex->slot);
+}
+
+static void
+hev_dns_forwarder_retry (HevDNSForwarder *self, HevDNSForwarderExchange *ex,
+                         int64_t now)
+{
+    int i;
+
+    /* every upstream asked in this round stayed silent */
+    for (i = 0; i < self->nupstreams; i++)
+        if (ex->round & (1 << i))
+            hev_dns_forwarder_penalize (self, i, now);
+
+    if (ex->tries == RETRY_MAX) {
+        hev_dns_forwarder_complete (self, ex, NULL, -1);
+        return;
+    }
+
+    i = hev_dns_forwarder_pick (self, ex->tried, now);
+    if (i < 0)
+        i = hev_dns_forwarder_pick (self, 0, now);
+
+    ex->round = 0;
+    ex->tries++;
+    self->retries++;
+
+    hev_dns_forwarder_send (self, ex, i);
+    hev_dns_forwarder_arm (self, ex, i, now + self->upstreams[i].rto);
+}
+
+static void
+hev_dns_forwarder_expire (HevDNSForwarder *self, int64_t now)
+{
+    while (self->nheap && self->heap[0]->deadline <= now)
+        hev_dns_forwarder_retry (self, self->heap[0], now);
+}
+
+int
+hev_dns_forwarder_timeout (HevDNSForwarder *self)
+{
+    int64_t deadline;
+    int64_t now;
+
+    if (!self->nheap)
+        return -1;
+
+    deadline = self->heap[0]->deadline;
+    now = get_monotonic_ms ();
+    if (deadline <= now)
+        return 0;
+
+    return deadline - now;
+}
+
+int
+hev_dns_forwarder_submit (HevDNSForwarder *self, HevDNSQuery *query)
+{
+    HevDNSForwarderExchange *ex;
+    HevDNSForwarderSock *sock;
+    unsigned int uid;
+    HevDNSKey key;
+    uint32_t hash;
+    int64_t now;
+    int qend;
+    int idx;
+
+    if (!READ_ONCE (self->run))
+        return -1;
+
+    qend = hev_dns_msg_key (query->buffer, query->len, &key);
+    if (qend < 0)
+        return -1;
+
+    self->queries++;
+    query->qend = qend;
+    query->udp_size = key.udp_size;
+
+    hash = hev_dns_key_hash (&key, self->seed);
+    ex = hev_dns_forwarder_find_key (self, &key, hash);
+    if (ex) {
+        query->next = ex->queries;
+        query->exchange = ex;
+        ex->queries = query;
+        self->coalesced++;
+        return 0;
+    }
+
+    if (self->count >= EXCHANGE_MAX || hev_dns_forwarder_heap_reserve (self))
+        return -1;
+
+    ex = hev_malloc (sizeof (HevDNSForwarderExchange) + query->len);
+    if (!ex)
+        return -1;
+
+    do {
+        uid = hev_dns_forwarder_rand (self) & 0xffff;
+    } while (hev_dns_forwarder_find_uid (self, uid));
+
+    now = get_monotonic_ms ();
+
+    ex->uid = uid;
+    ex->sock = hev_dns_forwarder_sock_pick (self);
+    ex->hash = hash;
+    ex->len = query->len;
+    ex->start = now;
+    ex->tries = 0;
+    ex->tried = 0;
+    ex->round = 0;
+    ex->stream = 0;
+    memcpy (&ex->key, &key, sizeof (key));
+    memcpy (ex->request, query->buffer, query->len);
+    hev_dns_msg_set_id (ex->request, uid);
+
+    /* now and then probe any upstream to keep every estimate fresh */
+    if (self->nupstreams > 1 && !(hev_dns_forwarder_rand (self) % 64))
+        idx = hev_dns_forwarder_rand (self) % self->nupstreams;
+    else
+        idx = hev_dns_forwarder_pick (self, 0, now);
+
+    if (hev_dns_forwarder_send (self, ex, idx) < 0) {
+        hev_free (ex);
+        return -1;
+    }
+
+    /* race the runner-up, the first answer wins */
+    if (self->race) {
+        int alt = hev_dns_forwarder_pick (self, ex->tried, now);
+
+        if (alt >= 0)
+            hev_dns_forwarder_send (self, ex, alt);
+    }
+
+    ex->upstream = idx;
+    ex->deadline = now + self->upstreams[idx].rto;
+    hev_dns_forwarder_heap_add (self, ex);
+    sock = &self->socks[ex->sock];
+
+    query->next = NULL;
+    query->exchange = ex;
+    ex->queries = query;
+
+    ex->next = self->by_uid[uid % EXCHANGE_BUCKETS];
+    self->by_uid[uid % EXCHANGE_BUCKETS] = ex;
+    ex->knext = self->by_key[hash % EXCHANGE_BUCKETS];
+    self->by_key[hash % EXCHANGE_BUCKETS] = ex;
+    sock->inflight++;
+    sock->uses++;
+    self->count++;
+
+    return 0;
+}
+
+void
+hev_dns_forwarder_cancel (HevDNSForwarder *self, HevDNSQuery *query)
+{
+    HevDNSForwarderExchange *ex = query->exchange;
+    HevDNSQuery **pp;
+
+    if (!ex)
+        return;
+
+    for (pp = &ex->queries; *pp != query; pp = &(*pp)->next)
+        ;
+    *pp = query->next;
+    query->next = NULL;
+    query->exchange = NULL;
+
+    /* the last waiter is gone, a late reply will find nothing */
+    if (!ex->queries) {
+        hev_dns_forwarder_unlink (self, ex);
+        hev_free (ex);
+    }
+}
+
+static int
+hev_dns_forwarder_match (HevDNSForwarderExchange *ex, void *buf, size_t len)
+{
+    HevDNSKey key;
+
+    /*
+     * The reply must answer the question that was asked, the flags byte is
+     * left out as not every upstream echoes the DO bit. Only an error reply
+     * with no answers, a FORMERR or SERVFAIL from a strict upstream, may
+     * carry no question at all.
+     */
+    if (!hev_dns_msg_get16 ((unsigned char *)buf + 4) &&
+        hev_dns_msg_rcode (buf) != HEV_DNS_RCODE_NOERROR &&
+        !hev_dns_msg_get16 ((unsigned char *)buf + 6))
+        return 0;
+
+    if (hev_dns_msg_key (buf, len, &key) < 0 || key.len != ex->key.len ||
+        memcmp (key.data, ex->key.data, key.len - 1))
+        return -1;
+
+    return 0;
+}
+
+static void
+hev_dns_forwarder_stream_handle (HevDNSForwarderStream *stream,
+                                 unsigned char *buf, size_t len)
+{
+    HevDNSForwarder *self = stream->forwarder;
+    HevDNSForwarderUpstream *up = &self->upstreams[stream->idx];
+    HevDNSForwarderExchange *ex;
+
+    if (len < HEV_DNS_MSG_HDR_SIZE || !hev_dns_msg_is_response (buf))
+        return;
+
+    ex = hev_dns_forwarder_find_uid (self, hev_dns_msg_id (buf));
+    if (!ex || ex->stream != stream->idx + 1)
+        return;
+
+    if (hev_dns_forwarder_match (ex, buf, len) < 0)
+        return;
+
+    up->answered++;
+    up->fails = 0;
+    up->demoted = 0;
+
+    hev_dns_forwarder_complete (self, ex, buf, len);
+}
+
+static int
+hev_dns_forwarder_stream_yielder (HevTaskYieldType type, void *data)
+{
+    HevDNSForwarderStream *stream = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+        return 0;
+    }
+
+    if (hev_task_sleep (hev_config_get_misc_connect_timeout ()) == 0)
+        return -1;
+
+    return READ_ONCE (stream->run) ? 0 : -1;
+}
+
+static int
+hev_dns_forwarder_stream_io (HevDNSForwarderStream *stream, int fd)
+{
+    int busy = 0;
+    ssize_t res;
+
+    if (stream->woff < stream->wlen) {
+        res = send (fd, stream->wbuf + stream->woff,
+                    stream->wlen - stream->woff, MSG_NOSIGNAL);
+        if (res < 0 && errno != EAGAIN)
+            return -1;
+
+        if (res > 0) {
+            stream->woff += res;
+            if (stream->woff == stream->wlen)
+                stream->woff = stream->wlen = 0;
+            busy = 1;
+        }
+    }
+
+    res = recv (fd, stream->rbuf + stream->rlen,
+                STREAM_BUF_SIZE - stream->rlen, 0);
+    if (res == 0 || (res < 0 && errno != EAGAIN))
+        return -1;
+
+    if (res > 0) {
+        stream->rlen += res;
+        busy = 1;
+    }
+
+    for (;;) {
+        size_t len;
+
+        if (stream->rlen < 2)
+            break;
+
+        len = hev_dns_msg_get16 (stream->rbuf) + 2;
+        if (stream->rlen < len)
+            break;
+
+        hev_dns_forwarder_stream_handle (stream, stream->rbuf + 2, len - 2);
+        stream->rlen -= len;
+        memmove (stream->rbuf, stream->rbuf + len, stream->rlen);
+    }
+
+    return busy;
+}
+
+static void
+hev_dns_forwarder_stream_entry (void *data)
+{
+    HevDNSForwarderStream *stream = data;
+    HevDNSForwarder *self = stream->forwarder;
+    HevDNSForwarderUpstream *up = &self->upstreams[stream->idx];
+    HevConfigServer *srv = hev_config_get_socks5_server ();
+    int fd;
+    int i;
+
+    LOG_D ("%p dns forwarder stream run", stream);
+
+    fd = hev_task_io_socket_socket (AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0)
+        goto exit;
+
+    if (srv->mark)
+        set_sock_mark (fd, srv->mark);
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+
+    if (hev_task_io_socket_connect (fd, (struct sockaddr *)&up->addr,
+                                    sizeof (up->addr),
+                                    hev_dns_forwarder_stream_yielder,
+                                    stream) < 0) {
+        LOG_D ("%p dns forwarder stream connect", stream);
+        goto close;
+    }
+
+    while (READ_ONCE (stream->run)) {
+        int res;
+
+        res = hev_dns_forwarder_stream_io (stream, fd);
+        if (res < 0)
+            break;
+        if (res > 0)
+            continue;
+
+        if (stream->inflight || stream->wlen) {
+            hev_task_yield (HEV_TASK_WAITIO);
+            continue;
+        }
+
+        if (hev_task_sleep (STREAM_IDLE) == 0 && !stream->inflight &&
+            !stream->wlen)
+            break;
+    }
+
+close:
+    hev_task_del_fd (hev_task_self (), fd);
+    close (fd);
+exit:
+    /* whatever is still bound to this connection fails with it */
+    for (i = 0; i < EXCHANGE_BUCKETS; i++) {
+        HevDNSForwarderExchange *ex = self->by_uid[i];
+
+        while (ex) {
+            HevDNSForwarderExchange *next = ex->next;
+
+            if (ex->stream == stream->idx + 1)
+                hev_dns_forwarder_complete (self, ex, NULL, -1);
+            ex = next;
+        }
+    }
+
+    self->streams[stream->idx] = NULL;
+    hev_free (stream->wbuf);
+    hev_free (stream);
+}
+
+static HevDNSForwarderStream *
+hev_dns_forwarder_stream_get (HevDNSForwarder *self, unsigned int idx)
+{
+    HevDNSForwarderStream *stream = self->streams[idx];
+    int stack_size;
+
+    if (stream)
+        return stream;
+
+    if (!READ_ONCE (self->run))
+        return NULL;
+
+    stream = hev_malloc0 (sizeof (HevDNSForwarderStream));
+    if (!stream)
+        return NULL;
+
+    stack_size = hev_config_get_misc_dns_stack_size ();
+    stream->task = hev_task_new (stack_size);
+    if (!stream->task) {
+        hev_free (stream);
+        return NULL;
+    }
+
+    LOG_D ("%p dns forwarder stream new", stream);
+
+    stream->forwarder = self;
+    stream->idx = idx;
+    stream->run = 1;
+    self->streams[idx] = stream;
+    hev_task_run (stream->task, hev_dns_forwarder_stream_entry, stream);
+
+    return stream;
+}
+
+static int
+hev_dns_forwarder_stream_send (HevDNSForwarder *self,
+                               HevDNSForwarderExchange *ex, unsigned int idx)
+{
+    HevDNSForwarderStream *stream;
+    size_t need;
+
+    stream = hev_dns_forwarder_stream_get (self, idx);
+    if (!stream)
+        return -1;
+
+    need = stream->wlen + 2 + ex->len;
+    if (need > stream->wcap) {
+        unsigned char *wbuf;
+        size_t cap = stream->wcap ? stream->wcap : 4096;
+
+        while (cap < need)
+            cap *= 2;
+
+        wbuf = hev_realloc (stream->wbuf, cap);
+        if (!wbuf)
+            return -1;
+
+        stream->wbuf = wbuf;
+        stream->wcap = cap;
+    }
+
+    hev_dns_msg_set16 (stream->wbuf + stream->wlen, ex->len);
+    memcpy (stream->wbuf + stream->wlen + 2, ex->request, ex->len);
+    stream->wlen = need;
+    stream->inflight++;
+    hev_task_wakeup (stream->task);
+
+    /* no more datagram retries, the stream gets one fixed deadline */
+    ex->stream = idx + 1;
+    ex->round = 0;
+    ex->tries = RETRY_MAX;
+    hev_dns_forwarder_arm (self, ex, idx, get_monotonic_ms () + STREAM_TIMEOUT);
+    self->streamed++;
+
+    return 0;
+}
+
+/*
+ * A truncated datagram reply is final for waiters that can only take a
+ * datagram. If anyone has room for more, they stay and the exchange is
+ * moved to the upstream's stream.
+ */
+static int
+hev_dns_forwarder_truncated (HevDNSForwarder *self,
+                             HevDNSForwarderExchange *ex, unsigned int idx,
+                             const void *reply, size_t len)
+{
+    HevDNSQuery **pp;
+    HevDNSQuery *query;
+
+    for (query = ex->queries; query; query = query->next)
+        if (query->stream)
+            break;
+
+    if (!query || hev_dns_forwarder_stream_send (self, ex, idx) < 0)
+        return -1;
+
+    for (pp = &ex->queries; *pp;) {
+        query = *pp;
+        if (query->stream) {
+            pp = &query->next;
+            continue;
+        }
+
+        *pp = query->next;
+        hev_dns_forwarder_answer (query, reply, len);
+    }
+
+    return 0;
+}
+
+static void
+hev_dns_forwarder_handle (HevDNSForwarder *self, unsigned int idx, size_t len,
+                          struct sockaddr_in6 *from)
+{
+    unsigned char *buf = self->buffer;
+    HevDNSForwarderUpstream *up = NULL;
+    HevDNSForwarderExchange *ex;
+    int i;
+
+    if (len < HEV_DNS_MSG_HDR_SIZE || !hev_dns_msg_is_response (buf))
+        return;
+
+    ex = hev_dns_forwarder_find_uid (self, hev_dns_msg_id (buf));
+    if (!ex || ex->sock != idx || ex->stream)
+        return;
+
+    /* only an upstream this exchange was sent to may answer it */
+    for (i = 0; i < self->nupstreams; i++) {
+        HevDNSForwarderUpstream *u = &self->upstreams[i];
+
+        if (!(ex->tried & (1 << i)) || from->sin6_port != u->addr.sin6_port ||
+            memcmp (&from->sin6_addr, &u->addr.sin6_addr, 16))
+            continue;
+
+        up = u;
+        break;
+    }
+    if (!up)
+        return;
+
+    if (hev_dns_forwarder_match (ex, buf, len) < 0)
+        return;
+
+    /* Karn: a retransmitted exchange gives no usable round trip sample */
+    if (!ex->tries)
+        hev_dns_forwarder_sample (up, get_monotonic_ms () - ex->start);
+
+    up->answered++;
+    up->fails = 0;
+    up->demoted = 0;
+
+    if (!hev_dns_msg_is_truncated (buf) ||
+        hev_dns_forwarder_truncated (self, ex, up - self->upstreams, buf,
+                                     len) < 0)
+        hev_dns_forwarder_complete (self, ex, buf, len);
+}
+
+static void
+hev_dns_forwarder_register (HevDNSForwarder *self, HevTask *task)
+{
+    int i;
+
+    self->owner = task;
+    for (i = 0; i < self->nsocks; i++)
+        hev_task_add_fd (task, self->socks[i].fd, POLLIN);
+}
+
+void
+hev_dns_forwarder_attach (HevDNSForwarder *self, HevTask *task)
+{
+    LOG_D ("%p dns forwarder attach", self);
+
+    hev_dns_forwarder_register (self, task);
+    WRITE_ONCE (self->run, 1);
+}
+
+void
+hev_dns_forwarder_detach (HevDNSForwarder *self)
+{
+    int i;
+
+    LOG_D ("%p dns forwarder detach", self);
+
+    WRITE_ONCE (self->run, 0);
+
+    for (i = 0; i < EXCHANGE_BUCKETS; i++)
+        while (self->by_uid[i])
+            hev_dns_forwarder_complete (self, self->by_uid[i], NULL, -1);
+
+    for (i = 0; i < self->nsocks; i++)
+        hev_task_del_fd (self->owner, self->socks[i].fd);
+
+    for (i = 0; i < self->nupstreams; i++) {
+        HevDNSForwarderStream *stream = self->streams[i];
+
+        if (!stream)
+            continue;
+
+        WRITE_ONCE (stream->run, 0);
+        hev_task_wakeup (stream->task);
+    }
+
+    self->owner = NULL;
+}
+
+int
+hev_dns_forwarder_poll (HevDNSForwarder *self)
+{
+    int count = 0;
+    int i;
+
+    hev_dns_forwarder_expire (self, get_monotonic_ms ());
+
+    for (i = 0; i < self->nsocks; i++) {
+        struct sockaddr_in6 from;
+        socklen_t fromlen;
+        ssize_t res;
+
+        fromlen = sizeof (from);
+        res = recvfrom (self->socks[i].fd, self->buffer, RECV_BUF_SIZE, 0,
+                        (struct sockaddr *)&from, &fromlen);
+        if (res < 0)
+            continue;
+
+        hev_dns_forwarder_handle (self, i, res, &from);
+        count++;
+    }
+
+    return count;
+}
+
+static void
+hev_dns_forwarder_task_entry (void *data)
+{
+    HevDNSForwarder *self = data;
+
+    LOG_D ("%p dns forwarder task run", self);
+
+    hev_dns_forwarder_register (self, self->task);
+
+    while (READ_ONCE (self->run)) {
+        int timeout;
+
+        if (hev_dns_forwarder_poll (self))
+            continue;
+
+        timeout = hev_dns_forwarder_timeout (self);
+        if (timeout < 0)
+            hev_task_yield (HEV_TASK_WAITIO);
+        else if (timeout > 0)
+            hev_task_sleep (timeout);
+    }
+
+    hev_dns_forwarder_detach (self);
+}
+
+void
+hev_dns_forwarder_start (HevDNSForwarder *self)
+{
+    LOG_D ("%p dns forwarder start", self);
+
+    WRITE_ONCE (self->run, 1);
+    hev_task_ref (self->task);
+    hev_task_run (self->task, hev_dns_forwarder_task_entry, self);
+}
+
+void
+hev_dns_forwarder_stop (HevDNSForwarder *self)
+{
+    LOG_D ("%p dns forwarder stop", self);
+
+    WRITE_ONCE (self->run, 0);
+    if (self->owner)
+        hev_task_wakeup (self->owner);
+}
+
+static void
+hev_dns_forwarder_refresh_done (HevDNSQuery *query, int len)
+{
+    HevDNSForwarderRefresh *refresh = query->data;
+
+    if (len > 0)
+        hev_dns_cache_insert (refresh->cache, query->buffer, len);
+
+    hev_free (refresh);
+}
+
+int
+hev_dns_forwarder_refresh (HevDNSForwarder *self, HevDNSCache *cache,
+                           const HevDNSKey *key)
+{
+    HevDNSForwarderRefresh *refresh;
+    int len;
+
+    refresh = hev_malloc (sizeof (HevDNSForwarderRefresh) + UDP_BUF_SIZE);
+    if (!refresh)
+        return -1;
+
+    len = hev_dns_msg_query (refresh->buffer, UDP_BUF_SIZE, key);
+    if (len < 0)
+        goto free;
+
+    memset (&refresh->query, 0, sizeof (HevDNSQuery));
+    refresh->query.done = hev_dns_forwarder_refresh_done;
+    refresh->query.data = refresh;
+    refresh->query.buffer = refresh->buffer;
+    refresh->query.len = len;
+    refresh->query.size = UDP_BUF_SIZE;
+    refresh->cache = cache;
+
+    if (hev_dns_forwarder_submit (self, &refresh->query) < 0)
+        goto free;
+
+    return 0;
+
+free:
+    hev_free (refresh);
+    return -1;
+}
+
+typedef struct _HevDNSForwarderWait HevDNSForwarderWait;
+
+struct _HevDNSForwarderWait
+{
+    HevTask *task;
+    int done;
+    int len;
+};
+
+static void
+hev_dns_forwarder_wait_done (HevDNSQuery *query, int len)
+{
+    HevDNSForwarderWait *wait = query->data;
+
+    wait->done = 1;
+    wait->len = len;
+    hev_task_wakeup (wait->task);
+}
+
+int
+hev_dns_forwarder_exchange (HevDNSForwarder *self, void *buf, size_t len,
+                            size_t size, HevTaskIOYielder yielder,
+                            void *yielder_data)
+{
+    HevDNSForwarderWait wait = { hev_task_self (), 0, -1 };
+    HevDNSQuery query;
+
+    memset (&query, 0, sizeof (query));
+    query.done = hev_dns_forwarder_wait_done;
+    query.data = &wait;
+    query.buffer = buf;
+    query.len = len;
+    query.size = size;
+
+    if (hev_dns_forwarder_submit (self, &query) < 0)
+        return -1;
+
+    while (!wait.done) {
+        if (yielder (HEV_TASK_WAITIO, yielder_data) < 0) {
+            hev_dns_forwarder_cancel (self, &query);
+            return -1;
+        }
+    }
+
+    return wait.len;
+}
@@ -0,0 +1,88 @@
+/*
+ ============================================================================
+ Name        : hev-dns-forwarder.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Forwarder
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_FORWARDER_H__
+#define __HEV_DNS_FORWARDER_H__
+
+#include <stddef.h>
+
+#include <hev-task-io.h>
+
+#include "hev-dns-msg.h"
+#include "hev-dns-cache.h"
+
+typedef struct _HevDNSQuery HevDNSQuery;
+typedef struct _HevDNSForwarder HevDNSForwarder;
+typedef void (*HevDNSQueryDone) (HevDNSQuery *query, int len);
+typedef int (*HevDNSQueryResize) (HevDNSQuery *query, size_t size);
+
+/*
+ * A query waiting on an upstream exchange. The buffer holds the request on
+ * submit and receives the reply, with the caller's transaction ID and
+ * question restored, before done is called. A negative len reports a
+ * failure. Identical outstanding queries share one exchange.
+ *
+ * A stream query takes replies of any size, and resize, if set, is asked
+ * to grow the buffer when a reply does not fit. Others are datagram
+ * queries and get at most their EDNS payload size.
+ */
+struct _HevDNSQuery
+{
+    HevDNSQuery *next;
+    HevDNSQueryDone done;
+    void *data;
+
+    void *buffer;
+    size_t len;
+    size_t size;
+    HevDNSQueryResize resize;
+    int stream;
+
+    void *exchange;
+    unsigned int qend;
+    unsigned int udp_size;
+};
+
+HevDNSForwarder *hev_dns_forwarder_new (void);
+void hev_dns_forwarder_destroy (HevDNSForwarder *self);
+
+void hev_dns_forwarder_start (HevDNSForwarder *self);
+void hev_dns_forwarder_stop (HevDNSForwarder *self);
+
+/*
+ * Drive the forwarder from an existing task instead of starting its own:
+ * attach registers the upstream sockets with task, poll handles the
+ * pending replies and due retransmissions without blocking and returns
+ * how many replies it read, detach fails every outstanding query. timeout
+ * gives the milliseconds until the next retransmission is due, or -1.
+ */
+void hev_dns_forwarder_attach (HevDNSForwarder *self, HevTask *task);
+void hev_dns_forwarder_detach (HevDNSForwarder *self);
+int hev_dns_forwarder_poll (HevDNSForwarder *self);
+int hev_dns_forwarder_timeout (HevDNSForwarder *self);
+
+int hev_dns_forwarder_submit (HevDNSForwarder *self, HevDNSQuery *query);
+void hev_dns_forwarder_cancel (HevDNSForwarder *self, HevDNSQuery *query);
+
+/*
+ * Fetch key again in the background and store the answer in cache. The
+ * request coalesces with any identical query in flight.
+ */
+int hev_dns_forwarder_refresh (HevDNSForwarder *self, HevDNSCache *cache,
+                               const HevDNSKey *key);
+
+/*
+ * Submit the request in buf and wait for its reply from the calling task.
+ * Returns the reply length, or -1 on failure, timeout or cancellation.
+ */
+int hev_dns_forwarder_exchange (HevDNSForwarder *self, void *buf, size_t len,
+                                size_t size, HevTaskIOYielder yielder,
+                                void *yielder_data);
+
+#endif /* __HEV_DNS_FORWARDER_H__ */
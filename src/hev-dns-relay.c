@@ -0,0 +1,500 @@
+/*
+ ============================================================================
+ Name        : hev-dns-relay.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Relay
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-compiler.h"
+#include "hev-config-const.h"
+#include "hev-fake-ip.h"
+#include "hev-tsocks-cache.h"
+#include "hev-socks5-preconnect.h"
+
+#include "hev-dns-relay.h"
+
+#define QUERY_TIMEOUT (10000)
+#define QUERY_MAX (16384)
+
+typedef struct _HevDNSRelayQuery HevDNSRelayQuery;
+
+struct _HevDNSRelayQuery
+{
+    HevDNSQuery query;
+    HevDNSRelayQuery *next;
+    int64_t deadline;
+    unsigned int slot;
+    unsigned int len;
+    struct sockaddr_in6 saddr;
+    struct sockaddr_in6 daddr;
+    unsigned char buffer[0];
+};
+
+struct _HevDNSRelay
+{
+    HevTask *task;
+    HevDNSCache *cache;
+    HevDNSForwarder *forwarder;
+    HevDNSRelayQuery *free;
+    HevDNSRelayQuery **heap;
+    HevDNSRelayQuery **replies;
+    unsigned int nfree;
+    unsigned int nheap;
+    unsigned int heap_size;
+    unsigned int nreplies;
+    unsigned int batch;
+    int64_t now;
+    int run;
+
+    unsigned long queries;
+    unsigned long timeouts;
+};
+
+HevDNSRelay *
+hev_dns_relay_new (HevDNSForwarder *forwarder, HevDNSCache *cache)
+{
+    HevDNSRelay *self;
+
+    self = hev_malloc0 (sizeof (HevDNSRelay));
+    if (!self)
+        return NULL;
+
+    self->batch = hev_config_get_misc_udp_copy_buffer_nums ();
+    if (!self->batch)
+        self->batch = 1;
+
+    self->replies = hev_malloc (sizeof (HevDNSRelayQuery *) * self->batch);
+    if (!self->replies)
+        goto free;
+
+    self->heap_size = 256;
+    self->heap = hev_malloc (sizeof (HevDNSRelayQuery *) * self->heap_size);
+    if (!self->heap)
+        goto free_replies;
+
+    self->forwarder = forwarder;
+    self->cache = cache;
+    self->run = 1;
+
+    LOG_D ("%p dns relay new", self);
+
+    return self;
+
+free_replies:
+    hev_free (self->replies);
+free:
+    hev_free (self);
+    return NULL;
+}
+
+void
+hev_dns_relay_destroy (HevDNSRelay *self)
+{
+    LOG_D ("%p dns relay destroy", self);
+    LOG_I ("%p dns relay queries %lu timeouts %lu", self, self->queries,
+           self->timeouts);
+
+    while (self->free) {
+        HevDNSRelayQuery *rq = self->free;
+
+        self->free = rq->next;
+        hev_free (rq);
+    }
+
+    hev_free (self->heap);
+    hev_free (self->replies);
+    hev_free (self);
+}
+
+static HevDNSRelayQuery *
+hev_dns_relay_query_get (HevDNSRelay *self)
+{
+    HevDNSRelayQuery *rq = self->free;
+
+    if (!rq)
+        return hev_malloc (sizeof (HevDNSRelayQuery) + UDP_BUF_SIZE);
+
+    self->free = rq->next;
+    self->nfree--;
+
+    return rq;
+}
+
+static void
+hev_dns_relay_query_put (HevDNSRelay *self, HevDNSRelayQuery *rq)
+{
+    if (self->nfree >= DNS_POOL_SIZE) {
+        hev_free (rq);
+        return;
+    }
+
+    rq->next = self->free;
+    self->free = rq;
+    self->nfree++;
+}
+
+static void
+hev_dns_relay_heap_set (HevDNSRelay *self, unsigned int i,
+                        HevDNSRelayQuery *rq)
+{
+    self->heap[i] = rq;
+    rq->slot = i;
+}
+
+static void
+hev_dns_relay_heap_up (HevDNSRelay *self, unsigned int i)
+{
+    HevDNSRelayQuery *rq = self->heap[i];
+
+    while (i) {
+        unsigned int p = (i - 1) / 2;
+
+        if (self->heap[p]->deadline <= rq->deadline)
+            break;
+
+        hev_dns_relay_heap_set (self, i, self->heap[p]);
+        i = p;
+    }
+
+    hev_dns_relay_heap_set (self, i, rq);
+}
+
+static void
+hev_dns_relay_heap_down (HevDNSRelay *self, unsigned int i)
+{
+    HevDNSRelayQuery *rq = self->heap[i];
+
+    for (;;) {
+        unsigned int c = i * 2 + 1;
+
+        if (c >= self->nheap)
+            break;
+
+        if (c + 1 < self->nheap &&
+            self->heap[c + 1]->deadline < self->heap[c]->deadline)
+            c++;
+
+        if (rq->deadline <= self->heap[c]->deadline)
+            break;
+
+        hev_dns_relay_heap_set (self, i, self->heap[c]);
+        i = c;
+    }
+
+    hev_dns_relay_heap_set (self, i, rq);
+}
+
+static int
+hev_dns_relay_heap_add (HevDNSRelay *self, HevDNSRelayQuery *rq)
+{
+    if (self->nheap == self->heap_size) {
+        HevDNSRelayQuery **heap;
+        unsigned int size;
+
+        if (self->heap_size >= QUERY_MAX)
+            return -1;
+
+        size = self->heap_size * 2;
+        heap = hev_realloc (self->heap, sizeof (HevDNSRelayQuery *) * size);
+        if (!heap)
+            return -1;
+
+        self->heap = heap;
+        self->heap_size = size;
+    }
+
+    self->heap[self->nheap] = rq;
+    hev_dns_relay_heap_up (self, self->nheap++);
+
+    return 0;
+}
+
+static void
+hev_dns_relay_heap_del (HevDNSRelay *self, HevDNSRelayQuery *rq)
+{
+    unsigned int i = rq->slot;
+    HevDNSRelayQuery *last;
+
+    last = self->heap[--self->nheap];
+    if (last == rq)
+        return;
+
+    hev_dns_relay_heap_set (self, i, last);
+    if (i && self->heap[(i - 1) / 2]->deadline > last->deadline)
+        hev_dns_relay_heap_up (self, i);
+    else
+        hev_dns_relay_heap_down (self, i);
+}
+
+static void
+hev_dns_relay_flush (HevDNSRelay *self)
+{
+    unsigned int n = self->nreplies;
+    union
+    {
+        char buf[HEV_TSOCKS_CACHE_CMSG_SIZE];
+        struct cmsghdr align;
+    } u[n];
+    struct mmsghdr msgv[n];
+    struct iovec iov[n];
+    int fds[n];
+    unsigned int i, j;
+
+    if (!n)
+        return;
+
+    for (i = 0; i < n; i++) {
+        HevDNSRelayQuery *rq = self->replies[i];
+        struct sockaddr *dap = (struct sockaddr *)&rq->daddr;
+        struct msghdr *mh = &msgv[i].msg_hdr;
+
+        fds[i] = hev_tsocks_cache_get (dap);
+
+        iov[i].iov_base = rq->buffer;
+        iov[i].iov_len = rq->len;
+        memset (mh, 0, sizeof (*mh));
+        mh->msg_name = &rq->saddr;
+        mh->msg_namelen = sizeof (rq->saddr);
+        mh->msg_iov = &iov[i];
+        mh->msg_iovlen = 1;
+        mh->msg_controllen = hev_tsocks_cache_cmsg (dap, u[i].buf);
+        if (mh->msg_controllen)
+            mh->msg_control = u[i].buf;
+    }
+
+    /* replies leaving through the same socket go out in one call */
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && fds[j] == fds[i]; j++)
+            ;
+
+        if (fds[i] >= 0)
+            sendmmsg (fds[i], &msgv[i], j - i, 0);
+    }
+
+    for (i = 0; i < n; i++) {
+        HevDNSRelayQuery *rq = self->replies[i];
+
+        if (fds[i] >= 0)
+            hev_tsocks_cache_put ((struct sockaddr *)&rq->daddr, fds[i]);
+        hev_socks5_preconnect_answer (rq->buffer, rq->len);
+        hev_dns_relay_query_put (self, rq);
+    }
+
+    self->nreplies = 0;
+}
+
+static void
+hev_dns_relay_reply (HevDNSRelay *self, HevDNSRelayQuery *rq, int len)
+{
+    if (self->nreplies == self->batch)
+        hev_dns_relay_flush (self);
+
+    rq->len = len;
+    self->replies[self->nreplies++] = rq;
+}
+
+static void
+hev_dns_relay_done (HevDNSQuery *query, int len)
+{
+    HevDNSRelayQuery *rq = container_of (query, HevDNSRelayQuery, query);
+    HevDNSRelay *self = query->data;
+
+    hev_dns_relay_heap_del (self, rq);
+
+    if (len <= 0) {
+        hev_dns_relay_query_put (self, rq);
+        return;
+    }
+
+    if (self->cache)
+        hev_dns_cache_insert (self->cache, rq->buffer, len);
+
+    hev_dns_relay_reply (self, rq, len);
+}
+
+static void
+hev_dns_relay_dispatch (HevDNSRelay *self, HevDNSRelayQuery *rq, size_t len)
+{
+    HevDNSQuery *query = &rq->query;
+    int res;
+
+    self->queries++;
+
+    res = hev_fake_ip_answer (rq->buffer, len, UDP_BUF_SIZE);
+    if (res > 0) {
+        hev_dns_relay_reply (self, rq, res);
+        return;
+    }
+
+    if (self->cache) {
+        HevDNSKey refresh;
+
+        res = hev_dns_cache_lookup (self->cache, rq->buffer, len,
+                                    UDP_BUF_SIZE, 0, &refresh);
+        if (res > 0) {
+            if (refresh.len)
+                hev_dns_forwarder_refresh (self->forwarder, self->cache,
+                                           &refresh);
+            hev_dns_relay_reply (self, rq, res);
+            return;
+        }
+    }
+
+    memset (query, 0, sizeof (HevDNSQuery));
+    query->done = hev_dns_relay_done;
+    query->data = self;
+    query->buffer = rq->buffer;
+    query->len = len;
+    query->size = UDP_BUF_SIZE;
+
+    rq->deadline = self->now + QUERY_TIMEOUT;
+    if (hev_dns_relay_heap_add (self, rq) < 0)
+        goto exit;
+
+    if (hev_dns_forwarder_submit (self->forwarder, query) < 0) {
+        hev_dns_relay_heap_del (self, rq);
+        goto exit;
+    }
+
+    return;
+
+exit:
+    hev_dns_relay_query_put (self, rq);
+}
+
+static int
+hev_dns_relay_recv (HevDNSRelay *self, int fd)
+{
+    unsigned int num = self->batch;
+    union
+    {
+        char buf[CMSG_SPACE (sizeof (struct sockaddr_in6))];
+        struct cmsghdr align;
+    } u[num];
+    HevDNSRelayQuery *rqv[num];
+    struct mmsghdr msgv[num];
+    struct iovec iov[num];
+    int i, n, res;
+
+    for (n = 0; n < num; n++) {
+        struct msghdr *mh = &msgv[n].msg_hdr;
+
+        rqv[n] = hev_dns_relay_query_get (self);
+        if (!rqv[n])
+            break;
+
+        iov[n].iov_base = rqv[n]->buffer;
+        iov[n].iov_len = UDP_BUF_SIZE;
+        memset (mh, 0, sizeof (*mh));
+        mh->msg_name = &rqv[n]->saddr;
+        mh->msg_namelen = sizeof (struct sockaddr_in6);
+        mh->msg_iov = &iov[n];
+        mh->msg_iovlen = 1;
+        mh->msg_control = u[n].buf;
+        mh->msg_controllen = sizeof (u[n].buf);
+    }
+
+    if (n == 0) {
+        hev_task_sleep (100);
+        return 1;
+    }
+
+    res = recvmmsg (fd, msgv, n, MSG_DONTWAIT, NULL);
+    if (res < 0)
+        res = 0;
+
+    for (i = 0; i < res; i++) {
+        struct sockaddr *dap = (struct sockaddr *)&rqv[i]->daddr;
+
+        msg_to_sock_addr (&msgv[i].msg_hdr, dap);
+        hev_dns_relay_dispatch (self, rqv[i], msgv[i].msg_len);
+    }
+
+    for (; i < n; i++)
+        hev_dns_relay_query_put (self, rqv[i]);
+
+    return res;
+}
+
+static void
+hev_dns_relay_expire (HevDNSRelay *self)
+{
+    while (self->nheap && self->heap[0]->deadline <= self->now) {
+        HevDNSRelayQuery *rq = self->heap[0];
+
+        hev_dns_relay_heap_del (self, rq);
+        hev_dns_forwarder_cancel (self->forwarder, &rq->query);
+        hev_dns_relay_query_put (self, rq);
+        self->timeouts++;
+    }
+}
+
+void
+hev_dns_relay_run (HevDNSRelay *self, int fd)
+{
+    HevTask *task = hev_task_self ();
+
+    LOG_D ("%p dns relay run", self);
+
+    self->task = task;
+    hev_task_add_fd (task, fd, POLLIN);
+    hev_dns_forwarder_attach (self->forwarder, task);
+
+    while (READ_ONCE (self->run)) {
+        int64_t delay;
+        int busy;
+
+        self->now = get_monotonic_ms ();
+
+        busy = hev_dns_relay_recv (self, fd);
+        busy += hev_dns_forwarder_poll (self->forwarder);
+        hev_dns_relay_flush (self);
+        hev_dns_relay_expire (self);
+
+        if (busy) {
+            hev_task_yield (HEV_TASK_YIELD);
+            continue;
+        }
+
+        delay = hev_dns_forwarder_timeout (self->forwarder);
+        if (self->nheap) {
+            int64_t d = self->heap[0]->deadline - self->now;
+
+            if (delay < 0 || d < delay)
+                delay = d;
+        }
+
+        if (delay < 0)
+            hev_task_yield (HEV_TASK_WAITIO);
+        else if (delay > 0)
+            hev_task_sleep (delay);
+    }
+
+    hev_dns_forwarder_detach (self->forwarder);
+    hev_dns_relay_flush (self);
+
+    hev_task_del_fd (task, fd);
+    self->task = NULL;
+}
+
+void
+hev_dns_relay_stop (HevDNSRelay *self)
+{
+    LOG_D ("%p dns relay stop", self);
+
+    WRITE_ONCE (self->run, 0);
+    if (self->task)
+        hev_task_wakeup (self->task);
+}
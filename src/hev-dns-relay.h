@@ -0,0 +1,30 @@
+/*
+ ============================================================================
+ Name        : hev-dns-relay.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Relay
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_RELAY_H__
+#define __HEV_DNS_RELAY_H__
+
+#include "hev-dns-cache.h"
+#include "hev-dns-forwarder.h"
+
+typedef struct _HevDNSRelay HevDNSRelay;
+
+HevDNSRelay *hev_dns_relay_new (HevDNSForwarder *forwarder,
+                                HevDNSCache *cache);
+void hev_dns_relay_destroy (HevDNSRelay *self);
+
+/*
+ * Serve the listener fd from the calling task until stopped. The task also
+ * drives the forwarder, every query is a plain state record with a
+ * deadline instead of a task of its own.
+ */
+void hev_dns_relay_run (HevDNSRelay *self, int fd);
+void hev_dns_relay_stop (HevDNSRelay *self);
+
+#endif /* __HEV_DNS_RELAY_H__ */
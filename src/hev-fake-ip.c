@@ -0,0 +1,486 @@
+/*
+ ============================================================================
+ Name        : hev-fake-ip.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Fake IP
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-dns-msg.h"
+
+#include "hev-fake-ip.h"
+
+#define TYPE_A (1)
+#define TYPE_AAAA (28)
+#define CLASS_IN (1)
+#define ANSWER_TTL (1)
+
+typedef struct _HevFakeIPEntry HevFakeIPEntry;
+
+/*
+ * The index of an entry is its offset in the pool. Links are indices plus
+ * one, so that zero means none. A full table reuses the least recently
+ * used entry, and with it the address.
+ */
+struct _HevFakeIPEntry
+{
+    char *name;
+    uint32_t hash;
+    uint32_t chain;
+    uint32_t prev;
+    uint32_t next;
+};
+
+static HevFakeIPEntry *entries;
+static uint32_t *buckets;
+static unsigned int capacity;
+static unsigned int bucket_mask;
+static unsigned int used;
+static uint32_t head;
+static uint32_t tail;
+
+static uint32_t net4;
+static uint32_t mask4;
+static struct in6_addr net6;
+static int has6;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+hev_fake_ip_parse (const char *range, int family, void *addr)
+{
+    char buf[64];
+    char *mask;
+    int len;
+
+    strncpy (buf, range, sizeof (buf) - 1);
+    buf[sizeof (buf) - 1] = '\0';
+
+    mask = strchr (buf, '/');
+    if (!mask)
+        return -1;
+    *mask++ = '\0';
+
+    if (inet_pton (family, buf, addr) != 1)
+        return -1;
+
+    len = strtoul (mask, NULL, 10);
+    if (family == AF_INET && (len < 1 || len > 30))
+        return -1;
+    if (family == AF_INET6 && (len < 1 || len > 96))
+        return -1;
+
+    return len;
+}
+
+int
+hev_fake_ip_init (void)
+{
+    const char *range = hev_config_get_dns_fake_ip_range ();
+    const char *range6 = hev_config_get_dns_fake_ip_range6 ();
+    unsigned int size;
+    struct in_addr a4;
+    int i, len;
+
+    LOG_D ("fake ip init");
+
+    if (!range)
+        return 0;
+
+    len = hev_fake_ip_parse (range, AF_INET, &a4);
+    if (len < 0) {
+        LOG_E ("fake ip range %s", range);
+        return -1;
+    }
+
+    mask4 = ~0U << (32 - len);
+    net4 = ntohl (a4.s_addr) & mask4;
+
+    if (range6) {
+        len = hev_fake_ip_parse (range6, AF_INET6, &net6);
+        if (len < 0) {
+            LOG_E ("fake ip range6 %s", range6);
+            return -1;
+        }
+        /* only the prefix is kept, addresses differ in the last 32 bits */
+        for (i = 0; i < 16; i++, len -= 8) {
+            if (len >= 8)
+                continue;
+            net6.s6_addr[i] &= (len > 0) ? 0xff << (8 - len) : 0;
+        }
+        has6 = 1;
+    }
+
+    /* neither the network nor the broadcast address is handed out */
+    capacity = (~mask4) - 1;
+    size = hev_config_get_dns_fake_ip_size ();
+    if (size && size < capacity)
+        capacity = size;
+
+    entries = hev_malloc0 (sizeof (HevFakeIPEntry) * capacity);
+    if (!entries)
+        goto exit;
+
+    for (size = 1; size < capacity; size <<= 1)
+        ;
+    buckets = hev_malloc0 (sizeof (uint32_t) * size);
+    if (!buckets)
+        goto exit;
+    bucket_mask = size - 1;
+
+    LOG_I ("fake ip pool %s names %u", range, capacity);
+
+    return 0;
+
+exit:
+    hev_fake_ip_fini ();
+    return -1;
+}
+
+void
+hev_fake_ip_fini (void)
+{
+    unsigned int i;
+
+    LOG_D ("fake ip fini");
+
+    if (entries) {
+        for (i = 0; i < used; i++)
+            hev_free (entries[i].name);
+        hev_free (entries);
+    }
+    if (buckets)
+        hev_free (buckets);
+
+    entries = NULL;
+    buckets = NULL;
+    capacity = 0;
+    bucket_mask = 0;
+    used = 0;
+    head = 0;
+    tail = 0;
+    has6 = 0;
+}
+
+static uint32_t
+hev_fake_ip_hash (const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static void
+hev_fake_ip_unlink (uint32_t idx)
+{
+    HevFakeIPEntry *e = &entries[idx];
+
+    if (e->prev)
+        entries[e->prev - 1].next = e->next;
+    else
+        head = e->next;
+
+    if (e->next)
+        entries[e->next - 1].prev = e->prev;
+    else
+        tail = e->prev;
+}
+
+static void
+hev_fake_ip_touch (uint32_t idx)
+{
+    HevFakeIPEntry *e = &entries[idx];
+
+    if (head == idx + 1)
+        return;
+
+    hev_fake_ip_unlink (idx);
+    e->prev = 0;
+    e->next = head;
+    if (head)
+        entries[head - 1].prev = idx + 1;
+    head = idx + 1;
+    if (!tail)
+        tail = idx + 1;
+}
+
+static int
+hev_fake_ip_find (const char *name, uint32_t hash)
+{
+    uint32_t link = buckets[hash & bucket_mask];
+
+    for (; link; link = entries[link - 1].chain) {
+        HevFakeIPEntry *e = &entries[link - 1];
+
+        if (e->hash == hash && strcmp (e->name, name) == 0)
+            return link - 1;
+    }
+
+    return -1;
+}
+
+static void
+hev_fake_ip_evict (uint32_t idx)
+{
+    HevFakeIPEntry *e = &entries[idx];
+    uint32_t *link;
+
+    link = &buckets[e->hash & bucket_mask];
+    while (*link != idx + 1)
+        link = &entries[*link - 1].chain;
+    *link = e->chain;
+
+    hev_fake_ip_unlink (idx);
+    hev_free (e->name);
+    e->name = NULL;
+}
+
+static int
+hev_fake_ip_alloc (const char *name)
+{
+    uint32_t hash = hev_fake_ip_hash (name);
+    HevFakeIPEntry *e;
+    char *dup;
+    int idx;
+
+    idx = hev_fake_ip_find (name, hash);
+    if (idx >= 0) {
+        hev_fake_ip_touch (idx);
+        return idx;
+    }
+
+    dup = strdup (name);
+    if (!dup)
+        return -1;
+
+    if (used < capacity) {
+        idx = used++;
+    } else {
+        idx = tail - 1;
+        LOG_D ("fake ip reuse %s for %s", entries[idx].name, name);
+        hev_fake_ip_evict (idx);
+    }
+
+    e = &entries[idx];
+    e->name = dup;
+    e->hash = hash;
+    e->chain = buckets[hash & bucket_mask];
+    buckets[hash & bucket_mask] = idx + 1;
+
+    e->prev = 0;
+    e->next = head;
+    if (head)
+        entries[head - 1].prev = idx + 1;
+    head = idx + 1;
+    if (!tail)
+        tail = idx + 1;
+
+    return idx;
+}
+
+static void
+hev_fake_ip_addr (uint32_t idx, int v6, struct sockaddr_in6 *addr)
+{
+    uint32_t host = htonl (v6 ? idx + 1 : net4 + idx + 1);
+
+    if (v6) {
+        memcpy (&addr->sin6_addr, &net6, 12);
+    } else {
+        memset (&addr->sin6_addr, 0, 10);
+        addr->sin6_addr.s6_addr[10] = 0xff;
+        addr->sin6_addr.s6_addr[11] = 0xff;
+    }
+
+    memcpy (&addr->sin6_addr.s6_addr[12], &host, 4);
+}
+
+static int
+hev_fake_ip_index (const struct sockaddr_in6 *addr)
+{
+    static const unsigned char mapped[12] = { 0, 0, 0, 0, 0, 0,
+                                              0, 0, 0, 0, 0xff, 0xff };
+    const unsigned char *a = addr->sin6_addr.s6_addr;
+    uint32_t low = hev_dns_msg_get32 (a + 12);
+
+    if (memcmp (a, mapped, 12) == 0) {
+        if ((low & mask4) != net4)
+            return -1;
+        low -= net4;
+    } else if (!has6 || memcmp (a, &net6, 12) != 0) {
+        return -1;
+    }
+
+    /* inside the pool, but maybe past what the table can hold */
+    return (low && low <= capacity) ? (int)(low - 1) : (int)capacity;
+}
+
+static int
+hev_fake_ip_qname (const unsigned char *msg, size_t len, char *name)
+{
+    size_t off = HEV_DNS_MSG_HDR_SIZE;
+    size_t nlen = 0;
+
+    for (;;) {
+        unsigned int l;
+
+        if (off >= len)
+            return -1;
+
+        l = msg[off++];
+        if (l == 0)
+            break;
+        if ((l & 0xc0) || off + l > len || nlen + l + 1 > 254)
+            return -1;
+
+        if (nlen)
+            name[nlen++] = '.';
+        for (; l; l--) {
+            unsigned char c = msg[off++];
+
+            /* such a label cannot be spelled as a plain name upstream */
+            if (c == '.' || c == '\0')
+                return -1;
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            name[nlen++] = c;
+        }
+    }
+
+    name[nlen] = '\0';
+    return nlen ? off : -1;
+}
+
+int
+hev_fake_ip_answer (void *msg, size_t len, size_t size)
+{
+    unsigned char *buf = msg;
+    char name[256];
+    unsigned int type;
+    unsigned int rdlen;
+    unsigned char *rr;
+    int off, idx = 0;
+
+    if (!entries || len < HEV_DNS_MSG_HDR_SIZE)
+        return 0;
+
+    /* only a plain query with one question */
+    if ((buf[2] & 0xf8) || hev_dns_msg_get16 (buf + 4) != 1)
+        return 0;
+
+    off = hev_fake_ip_qname (buf, len, name);
+    if (off < 0 || off + 4 > len)
+        return 0;
+
+    type = hev_dns_msg_get16 (buf + off);
+    if (hev_dns_msg_get16 (buf + off + 2) != CLASS_IN)
+        return 0;
+
+    if (type == TYPE_A)
+        rdlen = 4;
+    else if (type == TYPE_AAAA)
+        rdlen = has6 ? 16 : 0;
+    else
+        return 0;
+
+    off += 4;
+    if (off + (rdlen ? 12 + rdlen : 0) > size)
+        return 0;
+
+    if (rdlen) {
+        pthread_mutex_lock (&lock);
+        idx = hev_fake_ip_alloc (name);
+        pthread_mutex_unlock (&lock);
+        if (idx < 0)
+            return 0;
+    }
+
+    /* the question stays, an OPT record and anything after it go */
+    buf[2] = 0x80 | (buf[2] & 0x01);
+    buf[3] = 0x80;
+    hev_dns_msg_set16 (buf + 6, rdlen ? 1 : 0);
+    hev_dns_msg_set16 (buf + 8, 0);
+    hev_dns_msg_set16 (buf + 10, 0);
+
+    if (!rdlen)
+        return off;
+
+    rr = buf + off;
+    hev_dns_msg_set16 (rr, 0xc000 | HEV_DNS_MSG_HDR_SIZE);
+    hev_dns_msg_set16 (rr + 2, type);
+    hev_dns_msg_set16 (rr + 4, CLASS_IN);
+    hev_dns_msg_set32 (rr + 6, ANSWER_TTL);
+    hev_dns_msg_set16 (rr + 10, rdlen);
+
+    if (rdlen == 4) {
+        hev_dns_msg_set32 (rr + 12, net4 + idx + 1);
+    } else {
+        memcpy (rr + 12, &net6, 12);
+        hev_dns_msg_set32 (rr + 24, idx + 1);
+    }
+
+    return off + 12 + rdlen;
+}
+
+int
+hev_fake_ip_lookup (const struct sockaddr_in6 *addr, char *name, size_t size)
+{
+    int idx;
+    int res = 0;
+
+    if (!entries)
+        return -1;
+
+    idx = hev_fake_ip_index (addr);
+    if (idx < 0)
+        return -1;
+
+    pthread_mutex_lock (&lock);
+    if (idx < used && entries[idx].name) {
+        res = snprintf (name, size, "%s", entries[idx].name);
+        hev_fake_ip_touch (idx);
+    }
+    pthread_mutex_unlock (&lock);
+
+    return res;
+}
+
+int
+hev_fake_ip_resolve (const char *name, const struct sockaddr_in6 *like,
+                     struct sockaddr_in6 *addr)
+{
+    int v6;
+    int idx;
+
+    if (!entries)
+        return -1;
+
+    v6 = has6 && !IN6_IS_ADDR_V4MAPPED (&like->sin6_addr);
+
+    pthread_mutex_lock (&lock);
+    idx = hev_fake_ip_find (name, hev_fake_ip_hash (name));
+    pthread_mutex_unlock (&lock);
+
+    if (idx < 0)
+        return -1;
+
+    hev_fake_ip_addr (idx, v6, addr);
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ ============================================================================
+ Name        : hev-fake-ip.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Fake IP
+ ============================================================================
+ */
+
+#ifndef __HEV_FAKE_IP_H__
+#define __HEV_FAKE_IP_H__
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+int hev_fake_ip_init (void);
+void hev_fake_ip_fini (void);
+
+/*
+ * Answer an A or AAAA query in place with an address from the pool.
+ * Returns the reply length, or 0 when the query is left to the upstream.
+ */
+int hev_fake_ip_answer (void *msg, size_t len, size_t size);
+
+/*
+ * Name behind a pool address. Returns the name length, 0 for a pool
+ * address no name holds any more, or -1 for an address outside the pool.
+ */
+int hev_fake_ip_lookup (const struct sockaddr_in6 *addr, char *name,
+                        size_t size);
+
+/* Pool address of a name in the family of like, without allocating. */
+int hev_fake_ip_resolve (const char *name, const struct sockaddr_in6 *like,
+                         struct sockaddr_in6 *addr);
+
+#endif /* __HEV_FAKE_IP_H__ */
@@ -0,0 +1,176 @@
+/*
+ ============================================================================
+ Name        : hev-packet-pool.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Packet Buffer Pool
+ ============================================================================
+ */
+
+#include <stddef.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-config-const.h"
+
+#include "hev-packet-pool.h"
+
+#define SLAB_NUM (64)
+
+typedef struct _HevPacket HevPacket;
+typedef struct _HevPacketSlab HevPacketSlab;
+
+struct _HevPacket
+{
+    HevPacketPool *pool;
+    HevPacket *next;
+    unsigned char headroom[HEV_PACKET_POOL_HEADROOM];
+    unsigned char data[0];
+};
+
+struct _HevPacketSlab
+{
+    HevPacketSlab *next;
+    unsigned char buffer[0];
+};
+
+struct _HevPacketPool
+{
+    HevPacket *free;
+    HevPacketSlab *slabs;
+
+    unsigned int max;
+    unsigned int total;
+    unsigned int used;
+    unsigned int high;
+    unsigned int exhausted;
+};
+
+static inline size_t
+hev_packet_size (void)
+{
+    size_t size = sizeof (HevPacket) + UDP_BUF_SIZE;
+
+    return (size + 15) & ~(size_t)15;
+}
+
+static int
+hev_packet_pool_grow (HevPacketPool *self)
+{
+    size_t size = hev_packet_size ();
+    HevPacketSlab *slab;
+    unsigned int i, n;
+
+    n = self->max - self->total;
+    if (n > SLAB_NUM)
+        n = SLAB_NUM;
+    if (!n)
+        return -1;
+
+    slab = hev_malloc (sizeof (HevPacketSlab) + size * n);
+    if (!slab)
+        return -1;
+
+    slab->next = self->slabs;
+    self->slabs = slab;
+
+    for (i = 0; i < n; i++) {
+        HevPacket *packet = (HevPacket *)(slab->buffer + size * i);
+
+        packet->pool = self;
+        packet->next = self->free;
+        self->free = packet;
+    }
+
+    self->total += n;
+
+    return 0;
+}
+
+HevPacketPool *
+hev_packet_pool_new (unsigned int max)
+{
+    HevPacketPool *self;
+
+    self = hev_malloc0 (sizeof (HevPacketPool));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p packet pool new", self);
+
+    self->max = max;
+
+    return self;
+}
+
+void
+hev_packet_pool_destroy (HevPacketPool *self)
+{
+    HevPacketSlab *slab = self->slabs;
+
+    LOG_D ("%p packet pool destroy", self);
+    LOG_I ("%p packet pool buffers %u high-water %u exhausted %u", self,
+           self->total, self->high, self->exhausted);
+
+    while (slab) {
+        HevPacketSlab *next = slab->next;
+
+        hev_free (slab);
+        slab = next;
+    }
+
+    hev_free (self);
+}
+
+void *
+hev_packet_pool_alloc (HevPacketPool *self)
+{
+    HevPacket *packet = self->free;
+
+    if (!packet && hev_packet_pool_grow (self) == 0)
+        packet = self->free;
+
+    if (packet) {
+        self->free = packet->next;
+        self->used++;
+        if (self->used > self->high)
+            self->high = self->used;
+        return packet->data;
+    }
+
+    self->exhausted++;
+
+    packet = hev_malloc (sizeof (HevPacket) + UDP_BUF_SIZE);
+    if (!packet)
+        return NULL;
+
+    packet->pool = NULL;
+
+    return packet->data;
+}
+
+void
+hev_packet_pool_free (void *data)
+{
+    HevPacket *packet;
+    HevPacketPool *pool;
+
+    packet = data - offsetof (HevPacket, data);
+    pool = packet->pool;
+
+    if (!pool) {
+        hev_free (packet);
+        return;
+    }
+
+    packet->next = pool->free;
+    pool->free = packet;
+    pool->used--;
+}
+
+void *
+hev_packet_pool_headroom (void *data)
+{
+    return data - HEV_PACKET_POOL_HEADROOM;
+}
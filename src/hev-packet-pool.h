@@ -0,0 +1,25 @@
+/*
+ ============================================================================
+ Name        : hev-packet-pool.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Packet Buffer Pool
+ ============================================================================
+ */
+
+#ifndef __HEV_PACKET_POOL_H__
+#define __HEV_PACKET_POOL_H__
+
+#define HEV_PACKET_POOL_HEADROOM (320)
+
+typedef struct _HevPacketPool HevPacketPool;
+
+HevPacketPool *hev_packet_pool_new (unsigned int max);
+void hev_packet_pool_destroy (HevPacketPool *self);
+
+void *hev_packet_pool_alloc (HevPacketPool *self);
+void hev_packet_pool_free (void *data);
+
+void *hev_packet_pool_headroom (void *data);
+
+#endif /* __HEV_PACKET_POOL_H__ */
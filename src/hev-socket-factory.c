@@ -9,6 +9,8 @@
 
 #include <unistd.h>
 #include <netinet/in.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
@@ -34,9 +36,62 @@ hev_socket_factory_tcp (int fd)
     return 0;
 }
 
+static int
+hev_socket_factory_steer (int fd, unsigned int workers)
+{
+    /*
+     * Pick the reuseport group member from a hash of the client source
+     * address and port, so every datagram of a flow reaches one worker.
+     * The UDP header has been pulled, so headers are read via SKF_NET_OFF.
+     * IPv6 extension headers are not walked; such flows still hash on the
+     * address, with whatever sits at the port offset.
+     */
+    struct sock_filter code[] = {
+        /* 0: A = protocol */
+        BPF_STMT (BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 6, 0),
+        /* 2: IPv4, A = saddr ^ sport */
+        BPF_STMT (BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF),
+        BPF_STMT (BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF),
+        BPF_STMT (BPF_MISC | BPF_TAX, 0),
+        BPF_STMT (BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_STMT (BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT (BPF_JMP | BPF_JA, 13),
+        /* 8: IPv6, A = saddr[0] ^ ... ^ saddr[3] ^ sport */
+        BPF_STMT (BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 8),
+        BPF_STMT (BPF_MISC | BPF_TAX, 0),
+        BPF_STMT (BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_STMT (BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT (BPF_MISC | BPF_TAX, 0),
+        BPF_STMT (BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 16),
+        BPF_STMT (BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT (BPF_MISC | BPF_TAX, 0),
+        BPF_STMT (BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+        BPF_STMT (BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT (BPF_MISC | BPF_TAX, 0),
+        BPF_STMT (BPF_LD | BPF_H | BPF_ABS, SKF_NET_OFF + 40),
+        BPF_STMT (BPF_ALU | BPF_XOR | BPF_X, 0),
+        /* 21: mix and reduce to a member index */
+        BPF_STMT (BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+        BPF_STMT (BPF_MISC | BPF_TAX, 0),
+        BPF_STMT (BPF_ALU | BPF_RSH | BPF_K, 16),
+        BPF_STMT (BPF_ALU | BPF_XOR | BPF_X, 0),
+        BPF_STMT (BPF_ALU | BPF_MOD | BPF_K, workers),
+        BPF_STMT (BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = {
+        .len = sizeof (code) / sizeof (code[0]),
+        .filter = code,
+    };
+
+    return setsockopt (fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                       sizeof (prog));
+}
+
 int
 hev_socket_factory_udp (int fd)
 {
+    unsigned int workers;
     int one = 1;
     int res;
 
@@ -57,6 +112,13 @@ hev_socket_factory_udp (int fd)
     if (res < 0)
         LOG_W ("socket factory socket rcvbuf");
 
+    workers = hev_config_get_workers ();
+    if (workers > 1) {
+        res = hev_socket_factory_steer (fd, workers);
+        if (res < 0)
+            LOG_W ("socket factory reuseport steering");
+    }
+
     return 0;
 }
 
@@ -0,0 +1,383 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-balancer.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Server Balancer
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-logger.h"
+
+#include "hev-socks5-balancer.h"
+
+#define EWMA_SHIFT (3)
+
+typedef struct _HevSocks5BalancerServer HevSocks5BalancerServer;
+
+struct _HevSocks5BalancerServer
+{
+    atomic_uint active;
+    atomic_uint latency;
+    atomic_ulong sessions;
+    atomic_ulong failures;
+
+    /* probe verdict, and the breaker driven by session failures */
+    atomic_int down;
+    atomic_uint streak;
+    atomic_llong reopen;
+    unsigned int rise;
+    unsigned int fall;
+};
+
+static HevSocks5BalancerServer *servers;
+static HevConfigServer *configs;
+static unsigned int count;
+static unsigned int weights;
+static int balance;
+static atomic_uint seq;
+
+int
+hev_socks5_balancer_init (void)
+{
+    unsigned int i;
+
+    LOG_D ("socks5 balancer init");
+
+    configs = hev_config_get_socks5_servers (&count);
+    balance = hev_config_get_socks5_balance ();
+
+    servers = hev_malloc0 (sizeof (HevSocks5BalancerServer) * count);
+    if (!servers)
+        return -1;
+
+    weights = 0;
+    for (i = 0; i < count; i++)
+        weights += configs[i].weight;
+
+    return 0;
+}
+
+void
+hev_socks5_balancer_fini (void)
+{
+    unsigned int i;
+
+    LOG_D ("socks5 balancer fini");
+
+    if (!servers)
+        return;
+
+    for (i = 0; i < count; i++) {
+        HevSocks5BalancerServer *s = &servers[i];
+
+        LOG_I ("socks5 balancer server %s:%u sessions %lu failures %lu "
+               "latency %u %s",
+               configs[i].addr, configs[i].port, atomic_load (&s->sessions),
+               atomic_load (&s->failures),
+               atomic_load (&s->latency) >> EWMA_SHIFT,
+               hev_socks5_balancer_available (i) ? "up" : "down");
+    }
+
+    hev_free (servers);
+    servers = NULL;
+}
+
+static unsigned int
+hev_socks5_balancer_random (void)
+{
+    unsigned int x;
+
+    x = atomic_fetch_add_explicit (&seq, 0x9e3779b9, memory_order_relaxed);
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+
+    return x;
+}
+
+static unsigned int
+hev_socks5_balancer_weight (unsigned int idx)
+{
+    /* a zero weight drains a server, unless every weight is zero */
+    return weights ? configs[idx].weight : 1;
+}
+
+static unsigned int
+hev_socks5_balancer_active (unsigned int idx)
+{
+    return atomic_load_explicit (&servers[idx].active, memory_order_relaxed);
+}
+
+static unsigned int
+hev_socks5_balancer_latency (unsigned int idx)
+{
+    return atomic_load_explicit (&servers[idx].latency, memory_order_relaxed);
+}
+
+int
+hev_socks5_balancer_available (int server)
+{
+    HevSocks5BalancerServer *s = &servers[server];
+    unsigned int limit = configs[0].breaker_failures;
+
+    if (atomic_load_explicit (&s->down, memory_order_relaxed))
+        return 0;
+
+    if (!limit ||
+        atomic_load_explicit (&s->streak, memory_order_relaxed) < limit)
+        return 1;
+
+    /* once the cooldown is over the breaker lets sessions probe again */
+    return get_monotonic_ms () >=
+           atomic_load_explicit (&s->reopen, memory_order_relaxed);
+}
+
+static unsigned int
+hev_socks5_balancer_candidates (void)
+{
+    unsigned int mask = 0;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        if (hev_socks5_balancer_weight (i) && hev_socks5_balancer_available (i))
+            mask |= 1U << i;
+    }
+
+    if (mask || !configs[0].fail_open)
+        return mask;
+
+    for (i = 0; i < count; i++) {
+        if (hev_socks5_balancer_weight (i))
+            mask |= 1U << i;
+    }
+
+    return mask;
+}
+
+static int
+hev_socks5_balancer_least_conn (unsigned int mask)
+{
+    unsigned int start = hev_socks5_balancer_random ();
+    unsigned int ba = 0, bw = 0, bl = 0;
+    int best = -1;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        unsigned int idx = (start + i) % count;
+        unsigned int w = hev_socks5_balancer_weight (idx);
+        unsigned int a, l;
+        uint64_t x, y;
+
+        if (!(mask & (1U << idx)))
+            continue;
+
+        a = hev_socks5_balancer_active (idx);
+        l = hev_socks5_balancer_latency (idx);
+        x = (uint64_t)a * bw;
+        y = (uint64_t)ba * w;
+        if (best < 0 || x < y || (x == y && l < bl)) {
+            best = idx;
+            ba = a;
+            bw = w;
+            bl = l;
+        }
+    }
+
+    return best;
+}
+
+static unsigned int
+hev_socks5_balancer_choice (unsigned int mask, unsigned int total)
+{
+    unsigned int r = hev_socks5_balancer_random () % total;
+    unsigned int i, last = 0;
+
+    for (i = 0; i < count; i++) {
+        unsigned int w;
+
+        if (!(mask & (1U << i)))
+            continue;
+
+        w = hev_socks5_balancer_weight (i);
+        if (r < w)
+            return i;
+        r -= w;
+        last = i;
+    }
+
+    return last;
+}
+
+static uint64_t
+hev_socks5_balancer_cost (unsigned int idx)
+{
+    uint64_t l = hev_socks5_balancer_latency (idx);
+    uint64_t a = hev_socks5_balancer_active (idx);
+
+    /* an unmeasured server costs nothing, so it gets its first sample */
+    return l * (a + 1);
+}
+
+static int
+hev_socks5_balancer_p2c (unsigned int mask)
+{
+    unsigned int total = 0;
+    unsigned int a, b;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        if (mask & (1U << i))
+            total += hev_socks5_balancer_weight (i);
+    }
+
+    a = hev_socks5_balancer_choice (mask, total);
+
+    /* the second is drawn from the rest, one draw whatever the weights */
+    mask &= ~(1U << a);
+    total -= hev_socks5_balancer_weight (a);
+    if (!mask || !total)
+        return a;
+
+    b = hev_socks5_balancer_choice (mask, total);
+
+    if (hev_socks5_balancer_cost (a) * hev_socks5_balancer_weight (b) <=
+        hev_socks5_balancer_cost (b) * hev_socks5_balancer_weight (a))
+        return a;
+
+    return b;
+}
+
+int
+hev_socks5_balancer_pick (void)
+{
+    unsigned int mask = hev_socks5_balancer_candidates ();
+
+    if (!mask)
+        return -1;
+
+    if (balance == HEV_CONFIG_BALANCE_P2C)
+        return hev_socks5_balancer_p2c (mask);
+
+    return hev_socks5_balancer_least_conn (mask);
+}
+
+void
+hev_socks5_balancer_acquire (int server)
+{
+    HevSocks5BalancerServer *s = &servers[server];
+
+    atomic_fetch_add_explicit (&s->active, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit (&s->sessions, 1, memory_order_relaxed);
+}
+
+void
+hev_socks5_balancer_release (int server)
+{
+    HevSocks5BalancerServer *s = &servers[server];
+
+    atomic_fetch_sub_explicit (&s->active, 1, memory_order_relaxed);
+}
+
+HevConfigServer *
+hev_socks5_balancer_get_server (int server)
+{
+    return &configs[server];
+}
+
+void
+hev_socks5_balancer_sample (int server, unsigned int latency)
+{
+    HevSocks5BalancerServer *s = &servers[server];
+    int sample = latency << EWMA_SHIFT;
+    int old;
+
+    /* racing updates may lose a sample, which an average can afford */
+    old = atomic_load_explicit (&s->latency, memory_order_relaxed);
+    if (old)
+        sample = old + (sample - old) / (1 << EWMA_SHIFT);
+    if (!sample)
+        sample = 1;
+    atomic_store_explicit (&s->latency, sample, memory_order_relaxed);
+}
+
+void
+hev_socks5_balancer_success (int server)
+{
+    HevSocks5BalancerServer *s = &servers[server];
+
+    if (atomic_exchange_explicit (&s->streak, 0, memory_order_relaxed) >=
+        configs[0].breaker_failures && configs[0].breaker_failures)
+        LOG_I ("socks5 balancer server %s:%u breaker closed",
+               configs[server].addr, configs[server].port);
+}
+
+void
+hev_socks5_balancer_failure (int server)
+{
+    HevSocks5BalancerServer *s = &servers[server];
+    unsigned int limit = configs[0].breaker_failures;
+    unsigned int streak;
+
+    atomic_fetch_add_explicit (&s->failures, 1, memory_order_relaxed);
+    hev_socks5_balancer_sample (server, hev_config_get_misc_connect_timeout ());
+
+    streak = atomic_fetch_add_explicit (&s->streak, 1, memory_order_relaxed);
+    if (!limit || streak + 1 < limit)
+        return;
+
+    /* a failure while half-open keeps the breaker open for another round */
+    atomic_store_explicit (&s->reopen,
+                           get_monotonic_ms () + configs[0].breaker_cooldown,
+                           memory_order_relaxed);
+    if (streak + 1 == limit)
+        LOG_I ("socks5 balancer server %s:%u breaker open",
+               configs[server].addr, configs[server].port);
+}
+
+void
+hev_socks5_balancer_probe (int server, int ok)
+{
+    HevSocks5BalancerServer *s = &servers[server];
+    int down = atomic_load_explicit (&s->down, memory_order_relaxed);
+
+    if (ok) {
+        s->fall = 0;
+        if (!down || ++s->rise < configs[0].health_rise)
+            return;
+    } else {
+        s->rise = 0;
+        if (down || ++s->fall < configs[0].health_fall)
+            return;
+    }
+
+    LOG_I ("socks5 balancer server %s:%u %s", configs[server].addr,
+           configs[server].port, down ? "up" : "down");
+    atomic_store_explicit (&s->down, !down, memory_order_relaxed);
+}
+
+int
+hev_socks5_balancer_get_stats (int server, HevSocks5BalancerStats *stats)
+{
+    HevSocks5BalancerServer *s;
+
+    if (server < 0 || server >= count)
+        return -1;
+
+    s = &servers[server];
+    stats->sessions = atomic_load (&s->sessions);
+    stats->failures = atomic_load (&s->failures);
+    stats->active = atomic_load (&s->active);
+    stats->latency = atomic_load (&s->latency) >> EWMA_SHIFT;
+    stats->available = hev_socks5_balancer_available (server);
+
+    return 0;
+}
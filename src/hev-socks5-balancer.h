@@ -0,0 +1,51 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-balancer.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Server Balancer
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_BALANCER_H__
+#define __HEV_SOCKS5_BALANCER_H__
+
+#include "hev-config.h"
+
+typedef struct _HevSocks5BalancerStats HevSocks5BalancerStats;
+
+struct _HevSocks5BalancerStats
+{
+    unsigned long sessions;
+    unsigned long failures;
+    unsigned int active;
+    unsigned int latency;
+    int available;
+};
+
+int hev_socks5_balancer_init (void);
+void hev_socks5_balancer_fini (void);
+
+/*
+ * Pick the server for a new session, or -1 when none is available and the
+ * policy is fail-closed. A session is counted as active on its server
+ * from acquire to release. Shared by all workers.
+ */
+int hev_socks5_balancer_pick (void);
+void hev_socks5_balancer_acquire (int server);
+void hev_socks5_balancer_release (int server);
+
+HevConfigServer *hev_socks5_balancer_get_server (int server);
+int hev_socks5_balancer_available (int server);
+
+/* Handshake latency in ms, a failure counts as a connect timeout. */
+void hev_socks5_balancer_sample (int server, unsigned int latency);
+void hev_socks5_balancer_success (int server);
+void hev_socks5_balancer_failure (int server);
+
+/* Result of a health probe, called from the prober task only. */
+void hev_socks5_balancer_probe (int server, int ok);
+
+int hev_socks5_balancer_get_stats (int server, HevSocks5BalancerStats *stats);
+
+#endif /* __HEV_SOCKS5_BALANCER_H__ */
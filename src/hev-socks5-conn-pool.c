@@ -0,0 +1,288 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-conn-pool.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Connection Pool
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-list.h"
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-compiler.h"
+#include "hev-socks5-balancer.h"
+
+#include "hev-socks5-conn-pool.h"
+
+typedef struct _HevSocks5Conn HevSocks5Conn;
+
+struct _HevSocks5Conn
+{
+    HevListNode node;
+    int64_t stamp;
+    int server;
+    int fd;
+};
+
+struct _HevSocks5ConnPool
+{
+    HevTask *task;
+    HevList conns;
+    unsigned int count;
+    int run;
+};
+
+static int
+task_io_yielder (HevTaskYieldType type, void *data)
+{
+    HevSocks5ConnPool *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+        return 0;
+    }
+
+    if (hev_task_sleep (hev_config_get_misc_connect_timeout ()) == 0)
+        return -1;
+
+    return READ_ONCE (self->run) ? 0 : -1;
+}
+
+static int
+hev_socks5_conn_pool_connect (HevSocks5ConnPool *self, HevConfigServer *srv)
+{
+    struct sockaddr_in6 addr;
+    char port[8];
+    int res;
+    int fd;
+
+    snprintf (port, sizeof (port), "%u", srv->port);
+    res = resolve_to_sockaddr (srv->addr, port, SOCK_STREAM, &addr);
+    if (res < 0) {
+        LOG_D ("%p socks5 conn pool resolve", self);
+        return -1;
+    }
+
+    fd = hev_task_io_socket_socket (AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_D ("%p socks5 conn pool socket", self);
+        return -1;
+    }
+
+    if (srv->mark) {
+        res = set_sock_mark (fd, srv->mark);
+        if (res < 0)
+            goto close;
+    }
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+    res = hev_task_io_socket_connect (fd, (struct sockaddr *)&addr,
+                                      sizeof (addr), task_io_yielder, self);
+    hev_task_del_fd (hev_task_self (), fd);
+    if (res < 0) {
+        LOG_D ("%p socks5 conn pool connect", self);
+        goto close;
+    }
+
+    return fd;
+
+close:
+    close (fd);
+    return -1;
+}
+
+static int
+hev_socks5_conn_pool_alive (int fd)
+{
+    char buf;
+    int res;
+
+    res = recv (fd, &buf, sizeof (buf), MSG_PEEK | MSG_DONTWAIT);
+    if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 1;
+
+    return 0;
+}
+
+static void
+hev_socks5_conn_pool_expire (HevSocks5ConnPool *self, unsigned int idle)
+{
+    int64_t now = get_monotonic_ms ();
+    HevListNode *node;
+
+    node = hev_list_first (&self->conns);
+    while (node) {
+        HevSocks5Conn *conn;
+
+        conn = container_of (node, HevSocks5Conn, node);
+        node = hev_list_node_next (node);
+
+        if ((now - conn->stamp) < idle &&
+            hev_socks5_conn_pool_alive (conn->fd))
+            continue;
+
+        hev_list_del (&self->conns, &conn->node);
+        close (conn->fd);
+        hev_free (conn);
+        self->count--;
+    }
+}
+
+static void
+hev_socks5_conn_pool_task_entry (void *data)
+{
+    HevSocks5ConnPool *self = data;
+    HevConfigServer *srv;
+    unsigned int interval;
+    HevListNode *node;
+
+    LOG_D ("%p socks5 conn pool task run", self);
+
+    srv = hev_config_get_socks5_server ();
+    interval = srv->pool_rate ? 1000 / srv->pool_rate : 1000;
+    if (!interval)
+        interval = 1;
+
+    while (READ_ONCE (self->run)) {
+        HevSocks5Conn *conn;
+        int server;
+        int fd;
+
+        hev_socks5_conn_pool_expire (self, srv->pool_idle);
+
+        if (self->count >= srv->pool_size) {
+            hev_task_sleep (srv->pool_idle / 2 + 1);
+            continue;
+        }
+
+        /* refill towards the server the next session would be sent to */
+        server = hev_socks5_balancer_pick ();
+        fd = -1;
+        if (server >= 0)
+            fd = hev_socks5_conn_pool_connect (
+                self, hev_socks5_balancer_get_server (server));
+        if (fd >= 0) {
+            conn = hev_malloc (sizeof (HevSocks5Conn));
+            if (conn) {
+                conn->fd = fd;
+                conn->server = server;
+                conn->stamp = get_monotonic_ms ();
+                hev_list_add_tail (&self->conns, &conn->node);
+                self->count++;
+            } else {
+                close (fd);
+            }
+        }
+
+        hev_task_sleep (interval);
+    }
+
+    node = hev_list_first (&self->conns);
+    while (node) {
+        HevSocks5Conn *conn;
+
+        conn = container_of (node, HevSocks5Conn, node);
+        node = hev_list_node_next (node);
+        close (conn->fd);
+        hev_free (conn);
+    }
+
+    self->count = 0;
+    memset (&self->conns, 0, sizeof (self->conns));
+}
+
+HevSocks5ConnPool *
+hev_socks5_conn_pool_new (void)
+{
+    HevSocks5ConnPool *self;
+
+    self = hev_malloc0 (sizeof (HevSocks5ConnPool));
+    if (!self)
+        return NULL;
+
+    self->task = hev_task_new (-1);
+    if (!self->task) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p socks5 conn pool new", self);
+
+    return self;
+}
+
+void
+hev_socks5_conn_pool_destroy (HevSocks5ConnPool *self)
+{
+    LOG_D ("%p socks5 conn pool destroy", self);
+
+    hev_task_unref (self->task);
+    hev_free (self);
+}
+
+void
+hev_socks5_conn_pool_start (HevSocks5ConnPool *self)
+{
+    LOG_D ("%p socks5 conn pool start", self);
+
+    WRITE_ONCE (self->run, 1);
+    hev_task_ref (self->task);
+    hev_task_run (self->task, hev_socks5_conn_pool_task_entry, self);
+}
+
+void
+hev_socks5_conn_pool_stop (HevSocks5ConnPool *self)
+{
+    LOG_D ("%p socks5 conn pool stop", self);
+
+    WRITE_ONCE (self->run, 0);
+    hev_task_wakeup (self->task);
+}
+
+int
+hev_socks5_conn_pool_get (HevSocks5ConnPool *self, int *server)
+{
+    HevConfigServer *srv = hev_config_get_socks5_server ();
+    int64_t now = get_monotonic_ms ();
+    HevListNode *node;
+    int fd = -1;
+
+    while ((node = hev_list_first (&self->conns))) {
+        HevSocks5Conn *conn;
+
+        conn = container_of (node, HevSocks5Conn, node);
+        hev_list_del (&self->conns, node);
+        self->count--;
+
+        fd = conn->fd;
+        if ((now - conn->stamp) < srv->pool_idle &&
+            hev_socks5_balancer_available (conn->server) &&
+            hev_socks5_conn_pool_alive (fd)) {
+            *server = conn->server;
+            hev_free (conn);
+            break;
+        }
+
+        close (fd);
+        hev_free (conn);
+        fd = -1;
+    }
+
+    if (READ_ONCE (self->run))
+        hev_task_wakeup (self->task);
+
+    return fd;
+}
@@ -0,0 +1,24 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-conn-pool.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Connection Pool
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_CONN_POOL_H__
+#define __HEV_SOCKS5_CONN_POOL_H__
+
+typedef struct _HevSocks5ConnPool HevSocks5ConnPool;
+
+HevSocks5ConnPool *hev_socks5_conn_pool_new (void);
+void hev_socks5_conn_pool_destroy (HevSocks5ConnPool *self);
+
+void hev_socks5_conn_pool_start (HevSocks5ConnPool *self);
+void hev_socks5_conn_pool_stop (HevSocks5ConnPool *self);
+
+/* Take a pre-connected socket and the index of the server it leads to. */
+int hev_socks5_conn_pool_get (HevSocks5ConnPool *self, int *server);
+
+#endif /* __HEV_SOCKS5_CONN_POOL_H__ */
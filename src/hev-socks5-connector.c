@@ -0,0 +1,307 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-connector.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Connector
+ ============================================================================
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-dns.h>
+#include <hev-task-io-socket.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-socks5-balancer.h"
+
+#include "hev-socks5-connector.h"
+
+#define ATTEMPT_MAX (16)
+
+typedef struct _HevSocks5Connector HevSocks5Connector;
+typedef struct _HevSocks5ConnectorAttempt HevSocks5ConnectorAttempt;
+
+struct _HevSocks5ConnectorAttempt
+{
+    struct sockaddr_in6 addr;
+    int server;
+    int fd;
+};
+
+struct _HevSocks5Connector
+{
+    HevSocks5 *socks5;
+    unsigned int count;
+    unsigned int next;
+    unsigned int pending;
+    unsigned int cursor;
+    int primary;
+    int winner;
+    int failed;
+
+    HevSocks5ConnectorAttempt attempts[ATTEMPT_MAX];
+};
+
+static void
+hev_socks5_connector_push (HevSocks5Connector *self, struct addrinfo *ai,
+                           int server)
+{
+    HevSocks5ConnectorAttempt *attempt;
+
+    if (self->count == ATTEMPT_MAX)
+        return;
+
+    attempt = &self->attempts[self->count++];
+    attempt->server = server;
+    attempt->fd = -1;
+
+    if (ai->ai_family == AF_INET) {
+        struct sockaddr_in *adp = (struct sockaddr_in *)ai->ai_addr;
+
+        memset (&attempt->addr, 0, sizeof (attempt->addr));
+        attempt->addr.sin6_family = AF_INET6;
+        attempt->addr.sin6_port = adp->sin_port;
+        attempt->addr.sin6_addr.s6_addr[10] = 0xff;
+        attempt->addr.sin6_addr.s6_addr[11] = 0xff;
+        memcpy (&attempt->addr.sin6_addr.s6_addr[12], &adp->sin_addr, 4);
+    } else {
+        memcpy (&attempt->addr, ai->ai_addr, sizeof (attempt->addr));
+    }
+}
+
+static void
+hev_socks5_connector_resolve (HevSocks5Connector *self, int server)
+{
+    HevConfigServer *srv = hev_socks5_balancer_get_server (server);
+    struct addrinfo *list[2][ATTEMPT_MAX];
+    struct addrinfo hints = { 0 };
+    struct addrinfo *result;
+    struct addrinfo *ai;
+    unsigned int num[2] = { 0 };
+    unsigned int i;
+    char port[8];
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    snprintf (port, sizeof (port), "%u", srv->port);
+    if (hev_task_dns_getaddrinfo (srv->addr, port, &hints, &result) < 0) {
+        LOG_D ("%p socks5 connector resolve %s", self->socks5, srv->addr);
+        return;
+    }
+
+    for (ai = result; ai; ai = ai->ai_next) {
+        int f = ai->ai_family != result->ai_family;
+
+        if (ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+            continue;
+        if (num[f] < ATTEMPT_MAX)
+            list[f][num[f]++] = ai;
+    }
+
+    /* alternate the families, led by the one the resolver sorted first */
+    for (i = 0; i < num[0] || i < num[1]; i++) {
+        if (i < num[0])
+            hev_socks5_connector_push (self, list[0][i], server);
+        if (i < num[1])
+            hev_socks5_connector_push (self, list[1][i], server);
+    }
+
+    freeaddrinfo (result);
+}
+
+static int
+hev_socks5_connector_more (HevSocks5Connector *self)
+{
+    unsigned int count;
+
+    hev_config_get_socks5_servers (&count);
+
+    /* other servers are only resolved once the addresses run out */
+    while (self->next == self->count && self->cursor < count) {
+        int server = self->cursor++;
+
+        if (server == self->primary ||
+            !hev_socks5_balancer_get_server (server)->weight ||
+            !hev_socks5_balancer_available (server))
+            continue;
+
+        hev_socks5_connector_resolve (self, server);
+    }
+
+    return self->next < self->count;
+}
+
+static void
+hev_socks5_connector_start (HevSocks5Connector *self)
+{
+    while (hev_socks5_connector_more (self)) {
+        HevSocks5ConnectorAttempt *attempt = &self->attempts[self->next++];
+        HevConfigServer *srv = hev_socks5_balancer_get_server (attempt->server);
+        int res;
+        int fd;
+
+        fd = hev_task_io_socket_socket (AF_INET6, SOCK_STREAM, 0);
+        if (fd < 0)
+            continue;
+
+        if (srv->mark && set_sock_mark (fd, srv->mark) < 0) {
+            close (fd);
+            continue;
+        }
+
+        hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+        res = connect (fd, (struct sockaddr *)&attempt->addr,
+                       sizeof (attempt->addr));
+        if (res == 0) {
+            attempt->fd = fd;
+            self->winner = attempt - self->attempts;
+            return;
+        }
+
+        if (errno == EINPROGRESS) {
+            attempt->fd = fd;
+            self->pending++;
+            return;
+        }
+
+        /* an unreachable address is no reason to wait, try the next one */
+        hev_task_del_fd (hev_task_self (), fd);
+        close (fd);
+    }
+}
+
+static void
+hev_socks5_connector_check (HevSocks5Connector *self)
+{
+    struct pollfd pfds[ATTEMPT_MAX];
+    unsigned int idxs[ATTEMPT_MAX];
+    unsigned int i, n = 0;
+
+    for (i = 0; i < self->next; i++) {
+        if (self->attempts[i].fd < 0)
+            continue;
+
+        pfds[n].fd = self->attempts[i].fd;
+        pfds[n].events = POLLOUT;
+        pfds[n].revents = 0;
+        idxs[n++] = i;
+    }
+
+    if (poll (pfds, n, 0) <= 0)
+        return;
+
+    for (i = 0; i < n; i++) {
+        HevSocks5ConnectorAttempt *attempt = &self->attempts[idxs[i]];
+        socklen_t len = sizeof (int);
+        int err = 0;
+
+        if (!pfds[i].revents)
+            continue;
+
+        getsockopt (attempt->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (!err && (pfds[i].revents & POLLOUT)) {
+            self->winner = idxs[i];
+            return;
+        }
+
+        hev_task_del_fd (hev_task_self (), attempt->fd);
+        close (attempt->fd);
+        attempt->fd = -1;
+        self->pending--;
+        self->failed = 1;
+    }
+}
+
+static void
+hev_socks5_connector_cancel (HevSocks5Connector *self)
+{
+    unsigned int i;
+
+    for (i = 0; i < self->next; i++) {
+        HevSocks5ConnectorAttempt *attempt = &self->attempts[i];
+
+        if (attempt->fd < 0)
+            continue;
+
+        hev_task_del_fd (hev_task_self (), attempt->fd);
+        if ((int)i != self->winner)
+            close (attempt->fd);
+    }
+}
+
+int
+hev_socks5_connector_connect (HevSocks5 *socks5, int *server)
+{
+    HevSocks5Connector self = { 0 };
+    HevConfigServer *srv;
+    int64_t deadline;
+    int64_t start = 0;
+    int fd = -1;
+
+    LOG_D ("%p socks5 connector connect", socks5);
+
+    self.socks5 = socks5;
+    self.primary = *server;
+    self.winner = -1;
+
+    srv = hev_socks5_balancer_get_server (*server);
+    hev_socks5_connector_resolve (&self, *server);
+    deadline = get_monotonic_ms () + hev_config_get_misc_connect_timeout ();
+
+    for (;;) {
+        int64_t now = get_monotonic_ms ();
+        int64_t wake = deadline;
+
+        if (!self.pending || self.failed || now >= start) {
+            hev_socks5_connector_start (&self);
+            start = now + srv->connect_delay;
+            self.failed = 0;
+        }
+
+        if (self.winner < 0)
+            hev_socks5_connector_check (&self);
+
+        if (self.winner >= 0)
+            break;
+
+        if (self.failed)
+            continue;
+
+        if (!self.pending && !hev_socks5_connector_more (&self))
+            break;
+
+        if (now >= deadline)
+            break;
+
+        if (start < wake && hev_socks5_connector_more (&self))
+            wake = start;
+
+        hev_task_sleep (wake - now);
+        if (!hev_socks5_get_timeout (socks5))
+            break;
+    }
+
+    hev_socks5_connector_cancel (&self);
+
+    if (self.winner >= 0) {
+        HevSocks5ConnectorAttempt *attempt = &self.attempts[self.winner];
+
+        LOG_D ("%p socks5 connector attempt %d of %u won", socks5,
+               self.winner + 1, self.next);
+
+        *server = attempt->server;
+        fd = attempt->fd;
+    }
+
+    return fd;
+}
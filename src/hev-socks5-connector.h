@@ -0,0 +1,24 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-connector.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Connector
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_CONNECTOR_H__
+#define __HEV_SOCKS5_CONNECTOR_H__
+
+#include <hev-socks5.h>
+
+/*
+ * Connect to the addresses of the server, then to the other available
+ * servers, starting the next attempt when the last one has not finished
+ * within the attempt delay (RFC 8305). The first connected socket wins and
+ * the others are closed. On success the server is updated to the one the
+ * socket belongs to, and the socket is returned.
+ */
+int hev_socks5_connector_connect (HevSocks5 *socks5, int *server);
+
+#endif /* __HEV_SOCKS5_CONNECTOR_H__ */
@@ -0,0 +1,595 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-preconnect.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Preconnect
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-list.h"
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-dns-msg.h"
+#include "hev-compiler.h"
+#include "hev-bypass-table.h"
+#include "hev-socks5-balancer.h"
+#include "hev-socks5-session-tcp.h"
+
+#include "hev-socks5-preconnect.h"
+
+#define PORT_MAX (8)
+#define ADDR_MAX (2)
+
+#define TYPE_A (1)
+#define TYPE_AAAA (28)
+#define CLASS_IN (1)
+
+typedef struct _HevSocks5Preconnect HevSocks5Preconnect;
+typedef struct _HevSocks5PreconnectConn HevSocks5PreconnectConn;
+typedef struct _HevSocks5PreconnectAnswer HevSocks5PreconnectAnswer;
+
+/*
+ * A connection is listed, and counts against the limit, from the answer
+ * that starts it until it is taken or given up. A session may claim it
+ * while the handshake is still running and wait for the result. The task
+ * that started it and the claim each hold a reference, the last one to
+ * let go frees the memory.
+ */
+struct _HevSocks5PreconnectConn
+{
+    HevListNode node;
+    HevListNode tnode;
+    HevSocks5Preconnect *owner;
+    HevSocks5Preconnect *waiter_owner;
+    HevSocks5SessionTCP *tcp;
+    HevTask *task;
+    HevTask *waiter;
+    struct sockaddr_in6 addr;
+    int listed;
+    int claimed;
+    int done;
+    int refs;
+    int server;
+    int fd;
+};
+
+struct _HevSocks5Preconnect
+{
+    HevSocks5Preconnect *next;
+    HevList conns;
+    int stop;
+};
+
+struct _HevSocks5PreconnectAnswer
+{
+    struct sockaddr_in6 addrs[ADDR_MAX];
+    unsigned int count;
+};
+
+static pthread_key_t key;
+static pthread_mutex_t mutex;
+static HevSocks5Preconnect *preconnects;
+static HevList conns;
+static unsigned int active;
+
+static unsigned short ports[PORT_MAX];
+static unsigned int nports;
+
+static unsigned long speculated;
+static atomic_ulong hits;
+static atomic_ulong wasted;
+static unsigned long failed;
+static unsigned long dropped;
+
+int
+hev_socks5_preconnect_init (void)
+{
+    const char *list = hev_config_get_dns_preconnect_ports ();
+    int res;
+
+    LOG_D ("socks5 preconnect init");
+
+    nports = 0;
+    while (list && *list && nports < PORT_MAX) {
+        char *end;
+        unsigned long port;
+
+        port = strtoul (list, &end, 10);
+        if (end == list) {
+            list++;
+            continue;
+        }
+        if (port && port < 65536)
+            ports[nports++] = port;
+        list = end;
+    }
+
+    if (!nports || !hev_config_get_dns_preconnect_max ())
+        return 0;
+
+    res = pthread_key_create (&key, NULL);
+    if (res != 0) {
+        LOG_E ("socks5 preconnect key create");
+        nports = 0;
+        return -1;
+    }
+
+    res = pthread_mutex_init (&mutex, NULL);
+    if (res != 0) {
+        LOG_E ("socks5 preconnect mutex init");
+        pthread_key_delete (key);
+        nports = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+hev_socks5_preconnect_fini (void)
+{
+    HevSocks5Preconnect *self = preconnects;
+
+    LOG_D ("socks5 preconnect fini");
+
+    if (!nports)
+        return;
+
+    LOG_I ("socks5 preconnect speculated %lu hits %lu wasted %lu failed %lu "
+           "dropped %lu",
+           speculated, atomic_load_explicit (&hits, memory_order_relaxed),
+           atomic_load_explicit (&wasted, memory_order_relaxed), failed,
+           dropped);
+
+    while (self) {
+        HevSocks5Preconnect *next = self->next;
+
+        hev_free (self);
+        self = next;
+    }
+
+    preconnects = NULL;
+    nports = 0;
+    pthread_mutex_destroy (&mutex);
+    pthread_key_delete (key);
+}
+
+static HevSocks5Preconnect *
+hev_socks5_preconnect_self (void)
+{
+    HevSocks5Preconnect *self;
+
+    self = pthread_getspecific (key);
+    if (self)
+        return self;
+
+    self = hev_malloc0 (sizeof (HevSocks5Preconnect));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p socks5 preconnect new", self);
+
+    pthread_mutex_lock (&mutex);
+    self->next = preconnects;
+    preconnects = self;
+    pthread_mutex_unlock (&mutex);
+
+    pthread_setspecific (key, self);
+
+    return self;
+}
+
+static int
+hev_socks5_preconnect_equal (const struct sockaddr_in6 *a,
+                             const struct sockaddr_in6 *b)
+{
+    return a->sin6_port == b->sin6_port &&
+           0 == memcmp (&a->sin6_addr, &b->sin6_addr, sizeof (a->sin6_addr));
+}
+
+static void
+hev_socks5_preconnect_unlist (HevSocks5PreconnectConn *conn)
+{
+    hev_list_del (&conns, &conn->node);
+    conn->listed = 0;
+    active--;
+}
+
+static void
+hev_socks5_preconnect_task_entry (void *data)
+{
+    HevSocks5PreconnectConn *conn = data;
+    HevSocks5Preconnect *self = conn->owner;
+    HevSocks5 *socks5 = HEV_SOCKS5 (conn->tcp);
+    HevSocks5Client *client = HEV_SOCKS5_CLIENT (conn->tcp);
+    HevConfigServer *srv;
+    int64_t deadline;
+    int res;
+
+    LOG_D ("%p socks5 preconnect task run", conn);
+
+    srv = hev_socks5_balancer_get_server (conn->server);
+    hev_socks5_set_timeout (socks5, hev_config_get_misc_connect_timeout ());
+
+    res = hev_socks5_client_connect (client, srv->addr, srv->port);
+    if (res < 0) {
+        LOG_D ("%p socks5 preconnect connect", conn);
+        /* only an unreachable server counts, not a useless speculation */
+        if (!self->stop)
+            hev_socks5_balancer_failure (conn->server);
+    } else {
+        if (srv->user && srv->pass)
+            hev_socks5_client_set_auth (client, srv->user, srv->pass);
+        res = hev_socks5_client_handshake (client, srv->pipeline);
+        if (res < 0)
+            LOG_D ("%p socks5 preconnect handshake", conn);
+    }
+
+    if (res >= 0) {
+        hev_socks5_balancer_success (conn->server);
+        hev_task_del_fd (hev_task_self (), socks5->fd);
+    }
+
+    pthread_mutex_lock (&mutex);
+    if (res >= 0) {
+        conn->fd = socks5->fd;
+        socks5->fd = -1;
+    }
+    conn->done = 1;
+    /* a waiter on another worker polls, its task is not ours to wake */
+    if (conn->waiter && conn->waiter_owner == self)
+        hev_task_wakeup (conn->waiter);
+    pthread_mutex_unlock (&mutex);
+
+    hev_object_unref (HEV_OBJECT (conn->tcp));
+    conn->tcp = NULL;
+
+    /* wait to be taken, a taken connection is no longer listed */
+    deadline = get_monotonic_ms () + hev_config_get_dns_preconnect_idle ();
+    while (res >= 0 && !self->stop && READ_ONCE (conn->listed)) {
+        int64_t now = get_monotonic_ms ();
+
+        if (now >= deadline)
+            break;
+        hev_task_sleep (deadline - now);
+    }
+
+    hev_list_del (&self->conns, &conn->tnode);
+
+    pthread_mutex_lock (&mutex);
+    if (conn->listed) {
+        hev_socks5_preconnect_unlist (conn);
+        if (conn->fd >= 0)
+            atomic_fetch_add_explicit (&wasted, 1, memory_order_relaxed);
+        else
+            failed++;
+    }
+    if (!conn->claimed && conn->fd >= 0) {
+        close (conn->fd);
+        conn->fd = -1;
+    }
+    res = --conn->refs;
+    pthread_mutex_unlock (&mutex);
+
+    if (!res)
+        hev_free (conn);
+}
+
+static void
+hev_socks5_preconnect_spawn (HevSocks5Preconnect *self,
+                             const struct sockaddr_in6 *addr)
+{
+    HevSocks5PreconnectConn *conn;
+    HevListNode *node;
+    int stack_size;
+    int server;
+
+    if (hev_bypass_table_match (addr))
+        return;
+
+    server = hev_socks5_balancer_pick ();
+    if (server < 0)
+        return;
+
+    conn = hev_malloc0 (sizeof (HevSocks5PreconnectConn));
+    if (!conn)
+        return;
+
+    memcpy (&conn->addr, addr, sizeof (struct sockaddr_in6));
+    conn->owner = self;
+    conn->server = server;
+    conn->refs = 1;
+    conn->fd = -1;
+
+    pthread_mutex_lock (&mutex);
+    node = hev_list_first (&conns);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5PreconnectConn *c;
+
+        c = container_of (node, HevSocks5PreconnectConn, node);
+        if (hev_socks5_preconnect_equal (&c->addr, addr))
+            break;
+    }
+    if (!node && active >= hev_config_get_dns_preconnect_max ())
+        dropped++;
+    if (node || active >= hev_config_get_dns_preconnect_max ()) {
+        pthread_mutex_unlock (&mutex);
+        hev_free (conn);
+        return;
+    }
+    hev_list_add_tail (&conns, &conn->node);
+    conn->listed = 1;
+    active++;
+    speculated++;
+    pthread_mutex_unlock (&mutex);
+
+    conn->tcp = hev_socks5_session_tcp_new (&conn->addr, -1);
+    if (!conn->tcp)
+        goto exit;
+
+    stack_size = hev_config_get_misc_tcp_stack_size ();
+    conn->task = hev_task_new (stack_size);
+    if (!conn->task) {
+        hev_object_unref (HEV_OBJECT (conn->tcp));
+        goto exit;
+    }
+
+    LOG_D ("%p socks5 preconnect spawn", conn);
+
+    hev_list_add_tail (&self->conns, &conn->tnode);
+    hev_task_run (conn->task, hev_socks5_preconnect_task_entry, conn);
+    return;
+
+exit:
+    pthread_mutex_lock (&mutex);
+    hev_socks5_preconnect_unlist (conn);
+    failed++;
+    pthread_mutex_unlock (&mutex);
+    hev_free (conn);
+}
+
+static int
+hev_socks5_preconnect_rr (unsigned char *rr, int section, void *user)
+{
+    HevSocks5PreconnectAnswer *answer = user;
+    struct sockaddr_in6 *addr;
+    unsigned int type;
+    unsigned int len;
+
+    if (section != HEV_DNS_SECTION_ANSWER)
+        return 1;
+
+    type = hev_dns_msg_get16 (rr);
+    len = hev_dns_msg_get16 (rr + 8);
+    if (hev_dns_msg_get16 (rr + 2) != CLASS_IN)
+        return 0;
+    if (!(type == TYPE_A && len == 4) && !(type == TYPE_AAAA && len == 16))
+        return 0;
+
+    addr = &answer->addrs[answer->count++];
+    memset (addr, 0, sizeof (struct sockaddr_in6));
+    addr->sin6_family = AF_INET6;
+    if (len == 4) {
+        addr->sin6_addr.s6_addr[10] = 0xff;
+        addr->sin6_addr.s6_addr[11] = 0xff;
+        memcpy (&addr->sin6_addr.s6_addr[12], rr + 10, 4);
+    } else {
+        memcpy (&addr->sin6_addr, rr + 10, 16);
+    }
+
+    /* clients connect to the first addresses, the rest is a waste */
+    return answer->count == ADDR_MAX;
+}
+
+void
+hev_socks5_preconnect_answer (void *msg, size_t len)
+{
+    HevSocks5PreconnectAnswer answer;
+    HevSocks5Preconnect *self;
+    unsigned int i, j;
+
+    if (!nports || len < HEV_DNS_MSG_HDR_SIZE)
+        return;
+
+    if (!hev_dns_msg_is_response (msg) ||
+        hev_dns_msg_rcode (msg) != HEV_DNS_RCODE_NOERROR)
+        return;
+
+    self = hev_socks5_preconnect_self ();
+    if (!self || self->stop)
+        return;
+
+    answer.count = 0;
+    hev_dns_msg_foreach_rr (msg, len, hev_socks5_preconnect_rr, &answer);
+
+    for (i = 0; i < answer.count; i++) {
+        for (j = 0; j < nports; j++) {
+            answer.addrs[i].sin6_port = htons (ports[j]);
+            hev_socks5_preconnect_spawn (self, &answer.addrs[i]);
+        }
+    }
+}
+
+static int
+hev_socks5_preconnect_alive (int fd)
+{
+    char buf;
+    int res;
+
+    /* a server may speak first, the splicer relays what is waiting */
+    res = recv (fd, &buf, sizeof (buf), MSG_PEEK | MSG_DONTWAIT);
+    if (res > 0 || (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+        return 1;
+
+    return 0;
+}
+
+/*
+ * Hand out a taken socket only while it is still alive. Called without
+ * the mutex held, as it peeks and may close.
+ */
+static int
+hev_socks5_preconnect_check (int fd)
+{
+    if (hev_socks5_preconnect_alive (fd)) {
+        atomic_fetch_add_explicit (&hits, 1, memory_order_relaxed);
+        return fd;
+    }
+
+    atomic_fetch_add_explicit (&wasted, 1, memory_order_relaxed);
+    close (fd);
+
+    return -1;
+}
+
+int
+hev_socks5_preconnect_take (const struct sockaddr_in6 *addr, int *server,
+                            void **claim)
+{
+    HevListNode *node;
+    int fd = -1;
+
+    *claim = NULL;
+    if (!nports)
+        return -1;
+
+    pthread_mutex_lock (&mutex);
+    node = hev_list_first (&conns);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5PreconnectConn *conn;
+
+        conn = container_of (node, HevSocks5PreconnectConn, node);
+        if ((conn->done && conn->fd < 0) ||
+            !hev_socks5_preconnect_equal (&conn->addr, addr))
+            continue;
+
+        hev_socks5_preconnect_unlist (conn);
+        *server = conn->server;
+        if (!conn->done) {
+            conn->claimed = 1;
+            conn->refs++;
+            *claim = conn;
+            break;
+        }
+
+        fd = conn->fd;
+        conn->fd = -1;
+        break;
+    }
+    pthread_mutex_unlock (&mutex);
+
+    if (fd >= 0)
+        fd = hev_socks5_preconnect_check (fd);
+
+    return fd;
+}
+
+int
+hev_socks5_preconnect_wait (void *claim, HevSocks5 *socks5)
+{
+    HevSocks5PreconnectConn *conn = claim;
+    HevSocks5Preconnect *self = pthread_getspecific (key);
+    int64_t deadline;
+
+    LOG_D ("%p socks5 preconnect wait", conn);
+
+    deadline = get_monotonic_ms () + hev_config_get_misc_connect_timeout ();
+
+    for (;;) {
+        int64_t now;
+        int done;
+
+        pthread_mutex_lock (&mutex);
+        conn->waiter = hev_task_self ();
+        conn->waiter_owner = self;
+        done = conn->done;
+        pthread_mutex_unlock (&mutex);
+
+        now = get_monotonic_ms ();
+        if (done || now >= deadline || !hev_socks5_get_timeout (socks5))
+            break;
+
+        /* only the worker that started it can wake us when it is done */
+        if (conn->owner == self)
+            hev_task_sleep (deadline - now);
+        else
+            hev_task_sleep ((deadline - now < 10) ? deadline - now : 10);
+    }
+
+    return hev_socks5_preconnect_release (claim);
+}
+
+int
+hev_socks5_preconnect_release (void *claim)
+{
+    HevSocks5PreconnectConn *conn = claim;
+    int fd = -1;
+    int refs;
+
+    pthread_mutex_lock (&mutex);
+    if (conn->done && conn->fd >= 0) {
+        fd = conn->fd;
+        conn->fd = -1;
+    }
+
+    if (fd < 0 && conn->done) {
+        failed++;
+    } else if (fd < 0) {
+        /* given up early, the task that started it closes the socket */
+        atomic_fetch_add_explicit (&wasted, 1, memory_order_relaxed);
+    }
+
+    conn->claimed = 0;
+    conn->waiter = NULL;
+    refs = --conn->refs;
+    pthread_mutex_unlock (&mutex);
+
+    if (!refs)
+        hev_free (conn);
+
+    if (fd >= 0)
+        fd = hev_socks5_preconnect_check (fd);
+
+    return fd;
+}
+
+void
+hev_socks5_preconnect_stop (void)
+{
+    HevSocks5Preconnect *self;
+    HevListNode *node;
+
+    if (!nports)
+        return;
+
+    self = pthread_getspecific (key);
+    if (!self)
+        return;
+
+    LOG_D ("%p socks5 preconnect stop", self);
+
+    self->stop = 1;
+
+    node = hev_list_first (&self->conns);
+    for (; node; node = hev_list_node_next (node)) {
+        HevSocks5PreconnectConn *conn;
+
+        conn = container_of (node, HevSocks5PreconnectConn, tnode);
+        if (conn->tcp)
+            hev_socks5_set_timeout (HEV_SOCKS5 (conn->tcp), 0);
+        hev_task_wakeup (conn->task);
+    }
+}
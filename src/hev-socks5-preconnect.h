@@ -0,0 +1,49 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-preconnect.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Preconnect
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_PRECONNECT_H__
+#define __HEV_SOCKS5_PRECONNECT_H__
+
+#include <stddef.h>
+#include <netinet/in.h>
+
+#include <hev-socks5.h>
+
+int hev_socks5_preconnect_init (void);
+void hev_socks5_preconnect_fini (void);
+
+/*
+ * Start connecting to the addresses in a DNS answer on the configured
+ * ports, from tasks of the calling worker. Each connection is handshaken
+ * with the server for its destination, then waits to be taken.
+ */
+void hev_socks5_preconnect_answer (void *msg, size_t len);
+
+/*
+ * Take a handshaken socket to the destination and the index of the server
+ * it leads to, from any worker. Returns -1 if there is none. If one is
+ * still handshaking, claim is set instead and the server is given too.
+ */
+int hev_socks5_preconnect_take (const struct sockaddr_in6 *addr, int *server,
+                                void **claim);
+
+/*
+ * Wait from the session's task until a claimed connection is done, the
+ * connect timeout passes or the session is terminated, then release it.
+ * Returns the handshaken socket, or -1.
+ */
+int hev_socks5_preconnect_wait (void *claim, HevSocks5 *socks5);
+
+/* Give up a claim. Returns the socket if it is ready, or -1. */
+int hev_socks5_preconnect_release (void *claim);
+
+/* Cancel the speculative connections of the calling worker. */
+void hev_socks5_preconnect_stop (void);
+
+#endif /* __HEV_SOCKS5_PRECONNECT_H__ */
@@ -0,0 +1,221 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-prober.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Server Prober
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-compiler.h"
+#include "hev-socks5-balancer.h"
+
+#include "hev-socks5-prober.h"
+
+typedef struct _HevSocks5ProberTarget HevSocks5ProberTarget;
+
+struct _HevSocks5ProberTarget
+{
+    HevSocks5Prober *prober;
+    HevTask *task;
+    int server;
+};
+
+struct _HevSocks5Prober
+{
+    HevSocks5ProberTarget *targets;
+    unsigned int count;
+    int timeout;
+    int run;
+};
+
+static int
+task_io_yielder (HevTaskYieldType type, void *data)
+{
+    HevSocks5Prober *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+        return 0;
+    }
+
+    if (hev_task_sleep (self->timeout) == 0)
+        return -1;
+
+    return READ_ONCE (self->run) ? 0 : -1;
+}
+
+static int
+hev_socks5_prober_check (HevSocks5Prober *self, HevConfigServer *srv)
+{
+    struct sockaddr_in6 addr;
+    unsigned char buf[3];
+    char port[8];
+    ssize_t len;
+    int res;
+    int fd;
+
+    snprintf (port, sizeof (port), "%u", srv->port);
+    res = resolve_to_sockaddr (srv->addr, port, SOCK_STREAM, &addr);
+    if (res < 0)
+        return -1;
+
+    fd = hev_task_io_socket_socket (AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    res = -1;
+    if (srv->mark && set_sock_mark (fd, srv->mark) < 0)
+        goto close;
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+    if (hev_task_io_socket_connect (fd, (struct sockaddr *)&addr,
+                                    sizeof (addr), task_io_yielder, self) < 0)
+        goto exit;
+
+    /* offer only the method a session would use, then hang up */
+    buf[0] = 5;
+    buf[1] = 1;
+    buf[2] = (srv->user && srv->pass) ? 2 : 0;
+    len = hev_task_io_socket_send (fd, buf, 3, MSG_WAITALL, task_io_yielder,
+                                   self);
+    if (len != 3)
+        goto exit;
+
+    len = hev_task_io_socket_recv (fd, buf, 2, MSG_WAITALL, task_io_yielder,
+                                   self);
+    if (len != 2 || buf[0] != 5 || buf[1] != buf[2])
+        goto exit;
+
+    res = 0;
+exit:
+    hev_task_del_fd (hev_task_self (), fd);
+close:
+    close (fd);
+    return res;
+}
+
+static void
+hev_socks5_prober_task_entry (void *data)
+{
+    HevSocks5ProberTarget *target = data;
+    HevSocks5Prober *self = target->prober;
+    HevConfigServer *srv;
+
+    srv = hev_socks5_balancer_get_server (target->server);
+
+    LOG_D ("%p socks5 prober task run %s:%u", self, srv->addr, srv->port);
+
+    while (READ_ONCE (self->run)) {
+        int res;
+
+        res = hev_socks5_prober_check (self, srv);
+        if (!READ_ONCE (self->run))
+            break;
+
+        hev_socks5_balancer_probe (target->server, res == 0);
+        hev_task_sleep (srv->health_interval);
+    }
+}
+
+HevSocks5Prober *
+hev_socks5_prober_new (void)
+{
+    HevSocks5Prober *self;
+    HevConfigServer *srv;
+    unsigned int i;
+
+    self = hev_malloc0 (sizeof (HevSocks5Prober));
+    if (!self)
+        return NULL;
+
+    srv = hev_config_get_socks5_servers (&self->count);
+    self->targets = hev_malloc0 (sizeof (HevSocks5ProberTarget) * self->count);
+    if (!self->targets)
+        goto exit;
+
+    for (i = 0; i < self->count; i++) {
+        HevSocks5ProberTarget *target = &self->targets[i];
+
+        target->task = hev_task_new (-1);
+        if (!target->task)
+            goto exit;
+
+        target->prober = self;
+        target->server = i;
+    }
+
+    /* a probe never outlives the interval it belongs to */
+    self->timeout = hev_config_get_misc_connect_timeout ();
+    if ((unsigned int)self->timeout > srv->health_interval)
+        self->timeout = srv->health_interval;
+
+    LOG_D ("%p socks5 prober new", self);
+
+    return self;
+
+exit:
+    hev_socks5_prober_destroy (self);
+    return NULL;
+}
+
+void
+hev_socks5_prober_destroy (HevSocks5Prober *self)
+{
+    LOG_D ("%p socks5 prober destroy", self);
+
+    if (self->targets) {
+        unsigned int i;
+
+        for (i = 0; i < self->count; i++) {
+            if (self->targets[i].task)
+                hev_task_unref (self->targets[i].task);
+        }
+
+        hev_free (self->targets);
+    }
+
+    hev_free (self);
+}
+
+void
+hev_socks5_prober_start (HevSocks5Prober *self)
+{
+    unsigned int i;
+
+    LOG_D ("%p socks5 prober start", self);
+
+    WRITE_ONCE (self->run, 1);
+
+    for (i = 0; i < self->count; i++) {
+        HevSocks5ProberTarget *target = &self->targets[i];
+
+        hev_task_ref (target->task);
+        hev_task_run (target->task, hev_socks5_prober_task_entry, target);
+    }
+}
+
+void
+hev_socks5_prober_stop (HevSocks5Prober *self)
+{
+    unsigned int i;
+
+    LOG_D ("%p socks5 prober stop", self);
+
+    WRITE_ONCE (self->run, 0);
+
+    for (i = 0; i < self->count; i++)
+        hev_task_wakeup (self->targets[i].task);
+}
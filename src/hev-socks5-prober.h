@@ -0,0 +1,21 @@
+/*
+ ============================================================================
+ Name        : hev-socks5-prober.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Socks5 Server Prober
+ ============================================================================
+ */
+
+#ifndef __HEV_SOCKS5_PROBER_H__
+#define __HEV_SOCKS5_PROBER_H__
+
+typedef struct _HevSocks5Prober HevSocks5Prober;
+
+HevSocks5Prober *hev_socks5_prober_new (void);
+void hev_socks5_prober_destroy (HevSocks5Prober *self);
+
+void hev_socks5_prober_start (HevSocks5Prober *self);
+void hev_socks5_prober_stop (HevSocks5Prober *self);
+
+#endif /* __HEV_SOCKS5_PROBER_H__ */
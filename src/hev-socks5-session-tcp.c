@@ -17,6 +17,9 @@
 
 #include "hev-config.h"
 #include "hev-logger.h"
+#include "hev-fake-ip.h"
+#include "hev-tcp-splicer.h"
+#include "hev-socks5-preconnect.h"
 
 #include "hev-socks5-session-tcp.h"
 
@@ -41,6 +44,14 @@ hev_socks5_session_tcp_new (struct sockaddr_in6 *addr, int fd)
     return self;
 }
 
+static int
+hev_socks5_session_tcp_yielder (HevTaskYieldType type, void *data)
+{
+    HevSocks5SessionTCP *self = data;
+
+    return hev_socks5_session_task_io_yielder (type, data, &self->timer);
+}
+
 static void
 hev_socks5_session_tcp_splice (HevSocks5Session *base)
 {
@@ -48,9 +59,61 @@ hev_socks5_session_tcp_splice (HevSocks5Session *base)
 
     LOG_D ("%p socks5 session tcp splice", self);
 
+    /* the splicer reports progress to the yielder, the core one does not */
+    if (hev_config_get_misc_tcp_kernel_splice () ||
+        hev_timing_wheel_active (&self->timer)) {
+        HevTask *task = hev_task_self ();
+
+        self->parked = hev_tcp_splicer_splice (
+            self->fd, HEV_SOCKS5 (self)->fd,
+            hev_config_get_misc_tcp_park_idle (),
+            hev_socks5_session_tcp_yielder, self);
+
+        /* the sockets outlive this task while the session is parked */
+        if (self->parked) {
+            LOG_D ("%p socks5 session tcp parked", self);
+            hev_task_del_fd (task, self->fd);
+            hev_task_del_fd (task, HEV_SOCKS5 (self)->fd);
+        }
+        return;
+    }
+
     hev_socks5_tcp_splice (HEV_SOCKS5_TCP (self), self->fd);
 }
 
+void
+hev_socks5_session_tcp_resume (HevSocks5SessionTCP *self)
+{
+    LOG_D ("%p socks5 session tcp resume", self);
+
+    self->parked = 0;
+    hev_socks5_session_tcp_splice (HEV_SOCKS5_SESSION (self));
+}
+
+static int
+hev_socks5_session_tcp_get_server (HevSocks5Session *base)
+{
+    HevSocks5SessionTCP *self = HEV_SOCKS5_SESSION_TCP (base);
+
+    return self->server;
+}
+
+static int
+hev_socks5_session_tcp_is_established (HevSocks5Session *base)
+{
+    HevSocks5SessionTCP *self = HEV_SOCKS5_SESSION_TCP (base);
+
+    return self->established;
+}
+
+static void
+hev_socks5_session_tcp_set_server (HevSocks5Session *base, int server)
+{
+    HevSocks5SessionTCP *self = HEV_SOCKS5_SESSION_TCP (base);
+
+    self->server = server;
+}
+
 static void
 hev_socks5_session_tcp_terminate (HevSocks5Session *base)
 {
@@ -59,7 +122,8 @@ hev_socks5_session_tcp_terminate (HevSocks5Session *base)
     LOG_D ("%p socks5 session tcp terminate", self);
 
     hev_socks5_set_timeout (HEV_SOCKS5 (self), 0);
-    hev_task_wakeup (self->task);
+    if (self->task)
+        hev_task_wakeup (self->task);
 }
 
 static void
@@ -75,9 +139,20 @@ hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
                                   struct sockaddr_in6 *addr, int fd)
 {
     HevSocks5Addr saddr;
+    char name[256];
     int res;
 
-    hev_socks5_addr_from_sockaddr6 (&saddr, addr);
+    /* a pool address stands for the name it was handed out for */
+    res = hev_fake_ip_lookup (addr, name, sizeof (name));
+    if (res > 0) {
+        hev_socks5_addr_from_name (&saddr, name, addr->sin6_port);
+    } else if (res == 0) {
+        LOG_D ("%p socks5 session tcp stale fake ip", self);
+        return -1;
+    } else {
+        hev_socks5_addr_from_sockaddr6 (&saddr, addr);
+    }
+
     res = hev_socks5_client_tcp_construct (&self->base, &saddr);
     if (res < 0)
         return -1;
@@ -100,6 +175,12 @@ hev_socks5_session_tcp_destruct (HevObject *base)
 
     if (self->fd >= 0)
         close (self->fd);
+    if (self->preconnect) {
+        int fd = hev_socks5_preconnect_release (self->preconnect);
+
+        if (fd >= 0)
+            close (fd);
+    }
 
     HEV_SOCKS5_CLIENT_TCP_TYPE->destruct (base);
 }
@@ -141,6 +222,9 @@ hev_socks5_session_tcp_class (void)
         siptr = &kptr->session;
         memcpy (siptr, HEV_SOCKS5_SESSION_TYPE, sizeof (HevSocks5SessionIface));
         siptr->splicer = hev_socks5_session_tcp_splice;
+        siptr->get_server = hev_socks5_session_tcp_get_server;
+        siptr->set_server = hev_socks5_session_tcp_set_server;
+        siptr->is_established = hev_socks5_session_tcp_is_established;
 
         tiptr = &kptr->session.base;
         tiptr->set_task = hev_socks5_session_tcp_set_task;
@@ -13,6 +13,7 @@
 #include <netinet/in.h>
 
 #include "hev-list.h"
+#include "hev-timing-wheel.h"
 
 #include "hev-socks5-client-tcp.h"
 
@@ -31,7 +32,13 @@ struct _HevSocks5SessionTCP
 
     HevTask *task;
     HevListNode node;
+    HevTimingWheelEntry timer;
+    int server;
+    int established;
+    void *preconnect;
+    int parked;
     int fd;
+    int64_t parked_at;
 };
 
 struct _HevSocks5SessionTCPClass
@@ -49,4 +56,10 @@ int hev_socks5_session_tcp_construct (HevSocks5SessionTCP *self,
 HevSocks5SessionTCP *hev_socks5_session_tcp_new (struct sockaddr_in6 *addr,
                                                  int fd);
 
+/*
+ * Splice a parked session again, from a new task. A session is parked when
+ * its splice returned on idleness, its sockets are no longer on any task.
+ */
+void hev_socks5_session_tcp_resume (HevSocks5SessionTCP *self);
+
 #endif /* __HEV_SOCKS5_SESSION_TCP_H__ */
@@ -21,9 +21,12 @@
 #include <hev-socks5-client-udp.h>
 
 #include "hev-logger.h"
+#include "hev-fake-ip.h"
 #include "hev-config.h"
 #include "hev-compiler.h"
 #include "hev-config-const.h"
+#include "hev-packet-pool.h"
+#include "hev-socks5-balancer.h"
 #include "hev-tsocks-cache.h"
 
 #include "hev-socks5-session-udp.h"
@@ -38,9 +41,13 @@ struct _HevSocks5UDPFrame
     size_t len;
 };
 
+_Static_assert (sizeof (HevSocks5UDPFrame) <= HEV_PACKET_POOL_HEADROOM,
+                "UDP frame must fit in the packet headroom");
+
 static int
 task_io_yielder (HevTaskYieldType type, void *data)
 {
+    HevSocks5SessionUDP *udp = data;
     HevSocks5 *self = data;
 
     if (self->type == HEV_SOCKS5_TYPE_UDP_IN_UDP) {
@@ -54,7 +61,7 @@ task_io_yielder (HevTaskYieldType type, void *data)
         }
     }
 
-    return hev_socks5_task_io_yielder (type, data);
+    return hev_socks5_session_task_io_yielder (type, data, &udp->timer);
 }
 
 static int
@@ -91,14 +98,47 @@ hev_socks5_session_udp_fwd_f (HevSocks5SessionUDP *self, unsigned int num)
         frame = container_of (node, HevSocks5UDPFrame, node);
 
         hev_list_del (&self->frame_list, node);
-        hev_free (frame->data);
-        hev_free (frame);
+        hev_packet_pool_free (frame->data);
         self->frames--;
     }
 
     return 1;
 }
 
+static int
+hev_socks5_session_udp_reply_addr (HevSocks5SessionUDP *self,
+                                   const HevSocks5Addr *addr,
+                                   struct sockaddr_in6 *saddr)
+{
+    int f;
+
+    if (addr->atype == HEV_SOCKS5_ADDR_TYPE_NAME) {
+        char name[256];
+
+        memcpy (name, addr->domain.addr, addr->domain.len);
+        name[addr->domain.len] = '\0';
+
+        memset (saddr, 0, sizeof (struct sockaddr_in6));
+        saddr->sin6_family = AF_INET6;
+        memcpy (&saddr->sin6_port, addr->domain.addr + addr->domain.len, 2);
+        return hev_fake_ip_resolve (name, &self->fake, saddr);
+    }
+
+    if (hev_socks5_addr_into_sockaddr6 (addr, saddr, &f) < 0)
+        return -1;
+
+    /*
+     * Servers answer a name with the address it resolved to, which the
+     * client never sent to. While every destination was a pool address,
+     * a reply from the port of the last one is taken to come from it.
+     */
+    if (self->fake.sin6_family && !self->unmapped &&
+        saddr->sin6_port == self->fake.sin6_port)
+        memcpy (saddr, &self->fake, sizeof (struct sockaddr_in6));
+
+    return 0;
+}
+
 static int
 hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
 {
@@ -121,10 +161,13 @@ hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
     }
 
     while (s < res) {
+        struct cmsghdr cmsg[HEV_TSOCKS_CACHE_CMSG_SIZE /
+                            sizeof (struct cmsghdr)];
         struct sockaddr_in6 saddr;
         struct mmsghdr dmv[res];
         struct iovec iov[res];
-        int fd, f, n, r;
+        size_t clen;
+        int fd, n, r;
 
         for (i = s, n = 0; i < res; i++) {
             if (!smv[i].addr || smv[i].len == 0)
@@ -139,7 +182,6 @@ hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
 
             dmv[n].msg_hdr.msg_name = &self->addr;
             dmv[n].msg_hdr.msg_namelen = sizeof (self->addr);
-            dmv[n].msg_hdr.msg_controllen = 0;
             dmv[n].msg_hdr.msg_iov = &iov[n];
             dmv[n].msg_hdr.msg_iovlen = 1;
             iov[n].iov_base = smv[i].buf;
@@ -153,7 +195,7 @@ hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
             continue;
         }
 
-        r = hev_socks5_addr_into_sockaddr6 (smv[s].addr, &saddr, &f);
+        r = hev_socks5_session_udp_reply_addr (self, smv[s].addr, &saddr);
         if (r < 0) {
             LOG_D ("%p socks5 session udp fwd b addr", self);
             return -1;
@@ -165,8 +207,14 @@ hev_socks5_session_udp_fwd_b (HevSocks5SessionUDP *self, unsigned int num)
             return -1;
         }
 
+        clen = hev_tsocks_cache_cmsg ((struct sockaddr *)&saddr, cmsg);
+        for (i = 0; i < n; i++) {
+            dmv[i].msg_hdr.msg_control = clen ? cmsg : NULL;
+            dmv[i].msg_hdr.msg_controllen = clen;
+        }
+
         r = hev_task_io_socket_sendmmsg (fd, dmv, n, MSG_WAITALL, NULL, NULL);
-        hev_tsocks_cache_put (fd);
+        hev_tsocks_cache_put ((struct sockaddr *)&saddr, fd);
         if (r <= 0) {
             LOG_D ("%p socks5 session udp fwd b send", self);
             return -1;
@@ -203,19 +251,30 @@ int
 hev_socks5_session_udp_send (HevSocks5SessionUDP *self, void *data, size_t len,
                              struct sockaddr *addr)
 {
+    struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)addr;
     HevSocks5UDPFrame *frame;
+    char name[256];
+    int res;
 
     if (self->frames > UDP_POOL_SIZE)
         return -1;
 
-    frame = hev_malloc (sizeof (HevSocks5UDPFrame));
-    if (!frame)
+    res = hev_fake_ip_lookup (addr6, name, sizeof (name));
+    if (res == 0)
         return -1;
 
+    frame = hev_packet_pool_headroom (data);
     frame->len = len;
     frame->data = data;
     memset (&frame->node, 0, sizeof (frame->node));
-    hev_socks5_addr_from_sockaddr6 (&frame->addr, (struct sockaddr_in6 *)addr);
+
+    if (res > 0) {
+        hev_socks5_addr_from_name (&frame->addr, name, addr6->sin6_port);
+        memcpy (&self->fake, addr6, sizeof (struct sockaddr_in6));
+    } else {
+        hev_socks5_addr_from_sockaddr6 (&frame->addr, addr6);
+        self->unmapped = 1;
+    }
 
     self->frames++;
     hev_list_add_tail (&self->frame_list, &frame->node);
@@ -247,9 +306,11 @@ static int
 hev_socks5_session_udp_set_upstream_addr (HevSocks5Client *base,
                                           HevSocks5Addr *addr)
 {
-    HevConfigServer *srv = hev_config_get_socks5_server ();
+    HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
     HevSocks5ClientClass *ckptr;
+    HevConfigServer *srv;
 
+    srv = hev_socks5_balancer_get_server (self->server);
     if (srv->udp_in_udp && srv->udp_addr[0]) {
         uint16_t port = hev_socks5_addr_get_port (addr);
         hev_socks5_addr_from_name (addr, srv->udp_addr, port);
@@ -295,6 +356,22 @@ hev_socks5_session_udp_splice (HevSocks5Session *base)
     }
 }
 
+static int
+hev_socks5_session_udp_get_server (HevSocks5Session *base)
+{
+    HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
+
+    return self->server;
+}
+
+static void
+hev_socks5_session_udp_set_server (HevSocks5Session *base, int server)
+{
+    HevSocks5SessionUDP *self = HEV_SOCKS5_SESSION_UDP (base);
+
+    self->server = server;
+}
+
 static void
 hev_socks5_session_udp_terminate (HevSocks5Session *base)
 {
@@ -354,8 +431,7 @@ hev_socks5_session_udp_destruct (HevObject *base)
 
         frame = container_of (node, HevSocks5UDPFrame, node);
         node = hev_list_node_next (node);
-        hev_free (frame->data);
-        hev_free (frame);
+        hev_packet_pool_free (frame->data);
     }
 
     HEV_SOCKS5_CLIENT_UDP_TYPE->destruct (base);
@@ -402,6 +478,8 @@ hev_socks5_session_udp_class (void)
         siptr = &kptr->session;
         memcpy (siptr, HEV_SOCKS5_SESSION_TYPE, sizeof (HevSocks5SessionIface));
         siptr->splicer = hev_socks5_session_udp_splice;
+        siptr->get_server = hev_socks5_session_udp_get_server;
+        siptr->set_server = hev_socks5_session_udp_set_server;
 
         tiptr = &kptr->session.base;
         tiptr->set_task = hev_socks5_session_udp_set_task;
@@ -13,7 +13,7 @@
 #include <netinet/in.h>
 
 #include "hev-list.h"
-#include "hev-rbtree.h"
+#include "hev-timing-wheel.h"
 
 #include "hev-socks5-client-udp.h"
 
@@ -32,9 +32,12 @@ struct _HevSocks5SessionUDP
 
     HevTask *task;
     HevList frame_list;
-    HevRBTreeNode node;
+    HevTimingWheelEntry timer;
+    int server;
     struct sockaddr_in6 addr;
+    struct sockaddr_in6 fake;
     int frames;
+    int unmapped;
 };
 
 struct _HevSocks5SessionUDPClass
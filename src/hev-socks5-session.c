@@ -9,28 +9,85 @@
 
 #include <string.h>
 
+#include <hev-socks5-misc.h>
+
 #include "hev-utils.h"
 #include "hev-logger.h"
 #include "hev-config.h"
 #include "hev-socks5-client.h"
+#include "hev-socks5-balancer.h"
+#include "hev-socks5-connector.h"
 
 #include "hev-socks5-session.h"
 
+static int
+hev_socks5_session_connect (HevTProxySession *base, int *server)
+{
+    HevConfigServer *srv = hev_socks5_balancer_get_server (*server);
+    int fd;
+
+    /* fastopen connects without a handshake, there is nothing to race */
+    if (!srv->connect_delay || srv->fastopen)
+        return hev_socks5_client_connect (HEV_SOCKS5_CLIENT (base), srv->addr,
+                                          srv->port);
+
+    fd = hev_socks5_connector_connect (HEV_SOCKS5 (base), server);
+    if (fd < 0)
+        return -1;
+
+    HEV_SOCKS5 (base)->fd = fd;
+    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
+
+    return 0;
+}
+
 static void
 hev_socks5_session_run (HevTProxySession *base)
 {
     HevSocks5SessionIface *iface;
     HevConfigServer *srv;
+    int64_t stamp = 0;
+    int server;
+    int winner;
     int res;
 
     LOG_D ("%p socks5 session run", base);
 
-    srv = hev_config_get_socks5_server ();
+    iface = HEV_OBJECT_GET_IFACE (base, HEV_SOCKS5_SESSION_TYPE);
+    server = iface->get_server (HEV_SOCKS5_SESSION (base));
+    srv = hev_socks5_balancer_get_server (server);
+
+    if (HEV_SOCKS5 (base)->fd < 0) {
+        stamp = get_monotonic_ms ();
+        winner = server;
+        res = hev_socks5_session_connect (base, &winner);
+        if (res < 0) {
+            LOG_I ("%p socks5 session connect", base);
+            hev_socks5_balancer_failure (server);
+            return;
+        }
+
+        /* the session now belongs to the server that answered first */
+        if (winner != server) {
+            LOG_D ("%p socks5 session server %d -> %d", base, server, winner);
+            hev_socks5_balancer_release (server);
+            hev_socks5_balancer_acquire (winner);
+            iface->set_server (HEV_SOCKS5_SESSION (base), winner);
+            server = winner;
+            srv = hev_socks5_balancer_get_server (server);
+        }
+    } else {
+        /* adopted a pre-connected socket from the connection pool */
+        LOG_D ("%p socks5 session pooled", base);
+        hev_task_add_fd (hev_task_self (), HEV_SOCKS5 (base)->fd,
+                         POLLIN | POLLOUT);
+    }
 
-    res = hev_socks5_client_connect (HEV_SOCKS5_CLIENT (base), srv->addr,
-                                     srv->port);
-    if (res < 0) {
-        LOG_I ("%p socks5 session connect", base);
+    /* a speculative connection was handshaken for this destination */
+    if (iface->is_established &&
+        iface->is_established (HEV_SOCKS5_SESSION (base))) {
+        LOG_D ("%p socks5 session preconnected", base);
+        iface->splicer (HEV_SOCKS5_SESSION (base));
         return;
     }
 
@@ -43,13 +100,34 @@ hev_socks5_session_run (HevTProxySession *base)
     res = hev_socks5_client_handshake (HEV_SOCKS5_CLIENT (base), srv->pipeline);
     if (res < 0) {
         LOG_I ("%p socks5 session handshake", base);
+        hev_socks5_balancer_failure (server);
         return;
     }
 
-    iface = HEV_OBJECT_GET_IFACE (base, HEV_SOCKS5_SESSION_TYPE);
+    hev_socks5_balancer_success (server);
+
+    /* a pooled socket skipped the connect, its handshake alone is no sample */
+    if (stamp)
+        hev_socks5_balancer_sample (server, get_monotonic_ms () - stamp);
+
     iface->splicer (HEV_SOCKS5_SESSION (base));
 }
 
+int
+hev_socks5_session_task_io_yielder (HevTaskYieldType type, void *data,
+                                    HevTimingWheelEntry *timer)
+{
+    if (!hev_timing_wheel_active (timer))
+        return hev_socks5_task_io_yielder (type, data);
+
+    if (type == HEV_TASK_YIELD)
+        hev_timing_wheel_touch (timer);
+
+    hev_task_yield (type);
+
+    return hev_socks5_get_timeout (HEV_SOCKS5 (data)) ? 0 : -1;
+}
+
 int
 hev_socks5_session_bind (HevSocks5 *self, int fd, const struct sockaddr *dest)
 {
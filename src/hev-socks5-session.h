@@ -10,6 +10,7 @@
 #ifndef __HEV_SOCKS5_SESSION_H__
 #define __HEV_SOCKS5_SESSION_H__
 
+#include "hev-timing-wheel.h"
 #include "hev-tproxy-session.h"
 
 #define HEV_SOCKS5_SESSION(p) ((HevSocks5Session *)p)
@@ -24,10 +25,20 @@ struct _HevSocks5SessionIface
     HevTProxySessionIface base;
 
     void (*splicer) (HevSocks5Session *self);
+    int (*get_server) (HevSocks5Session *self);
+    void (*set_server) (HevSocks5Session *self, int server);
+    int (*is_established) (HevSocks5Session *self);
 };
 
 void *hev_socks5_session_iface (void);
 
+/*
+ * Splice loop yielder. While the session is tracked by a timing wheel,
+ * progress touches its entry and waiting for I/O arms no timer.
+ */
+int hev_socks5_session_task_io_yielder (HevTaskYieldType type, void *data,
+                                        HevTimingWheelEntry *timer);
+
 int hev_socks5_session_bind (HevSocks5 *self, int fd,
                              const struct sockaddr *dest);
 
@@ -18,7 +18,11 @@
 #include "hev-config.h"
 #include "hev-logger.h"
 #include "hev-tsocks-cache.h"
+#include "hev-fake-ip.h"
+#include "hev-bypass-table.h"
+#include "hev-socks5-preconnect.h"
 #include "hev-socks5-worker.h"
+#include "hev-socks5-balancer.h"
 
 #include "hev-socks5-tproxy.h"
 
@@ -103,6 +107,44 @@ hev_socks5_tproxy_init (void)
         return -1;
     }
 
+    res = hev_socks5_balancer_init ();
+    if (res < 0) {
+        LOG_E ("socks5 tproxy balancer");
+        hev_tsocks_cache_fini ();
+        hev_task_system_fini ();
+        return -1;
+    }
+
+    res = hev_bypass_table_init ();
+    if (res < 0) {
+        LOG_E ("socks5 tproxy bypass table");
+        hev_socks5_balancer_fini ();
+        hev_tsocks_cache_fini ();
+        hev_task_system_fini ();
+        return -1;
+    }
+
+    res = hev_fake_ip_init ();
+    if (res < 0) {
+        LOG_E ("socks5 tproxy fake ip");
+        hev_bypass_table_fini ();
+        hev_socks5_balancer_fini ();
+        hev_tsocks_cache_fini ();
+        hev_task_system_fini ();
+        return -1;
+    }
+
+    res = hev_socks5_preconnect_init ();
+    if (res < 0) {
+        LOG_E ("socks5 tproxy preconnect");
+        hev_fake_ip_fini ();
+        hev_bypass_table_fini ();
+        hev_socks5_balancer_fini ();
+        hev_tsocks_cache_fini ();
+        hev_task_system_fini ();
+        return -1;
+    }
+
     workers = hev_config_get_workers ();
     worker_list = hev_malloc0 (sizeof (HevSocks5WorkerData) * workers);
     if (!worker_list) {
@@ -115,7 +157,7 @@ hev_socks5_tproxy_init (void)
     for (i = 0; i < workers; i++) {
         HevSocks5Worker *worker;
 
-        worker = hev_socks5_worker_new (i == 0);
+        worker = hev_socks5_worker_new (i);
         if (!worker) {
             LOG_E ("socks5 proxy worker %d", i);
             goto exit;
@@ -175,6 +217,10 @@ retry:
         worker_list = NULL;
     }
 
+    hev_socks5_preconnect_fini ();
+    hev_fake_ip_fini ();
+    hev_bypass_table_fini ();
+    hev_socks5_balancer_fini ();
     hev_tsocks_cache_fini ();
     hev_task_system_fini ();
 }
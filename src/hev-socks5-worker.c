@@ -15,6 +15,7 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
@@ -24,16 +25,35 @@
 
 #include "hev-utils.h"
 #include "hev-config.h"
+#include "hev-addr-table.h"
+#include "hev-bypass-table.h"
+#include "hev-dns-cache.h"
+#include "hev-dns-forwarder.h"
+#include "hev-dns-relay.h"
+#include "hev-fake-ip.h"
 #include "hev-logger.h"
 #include "hev-compiler.h"
 #include "hev-config-const.h"
+#include "hev-packet-pool.h"
 #include "hev-socket-factory.h"
+#include "hev-socks5-balancer.h"
+#include "hev-socks5-prober.h"
+#include "hev-socks5-preconnect.h"
+#include "hev-timing-wheel.h"
+#include "hev-socks5-conn-pool.h"
 #include "hev-socks5-session-tcp.h"
 #include "hev-socks5-session-udp.h"
 #include "hev-tproxy-session-dns.h"
+#include "hev-tproxy-session-dns-tcp.h"
+#include "hev-tproxy-session-direct-tcp.h"
+#include "hev-tproxy-session-direct-udp.h"
 
 #include "hev-socks5-worker.h"
 
+#define UDP_FLOW_OWNERS (16384)
+#define STACK_PAINT ((uintptr_t)0x5aa5c33c5aa5c33cULL)
+#define STACK_RED (1024)
+
 enum
 {
     SYNC_SEND = 1 << 0,
@@ -42,10 +62,20 @@ enum
     SYNC_SENT = 1 << 3,
 };
 
+enum
+{
+    TASK_TCP,
+    TASK_UDP,
+    TASK_DNS,
+    TASK_TYPES,
+};
+
 struct _HevSocks5Worker
 {
     int event_fds[2];
+    int park_fd;
 
+    int id;
     int run;
     int is_main;
     atomic_int tsync;
@@ -53,16 +83,53 @@ struct _HevSocks5Worker
     HevTask *task_tcp;
     HevTask *task_udp;
     HevTask *task_dns;
+    HevTask *task_dns_tcp;
+    HevTask *task_timer;
     HevTask *task_event;
+    HevTask *task_park;
+
+    HevSocks5ConnPool *conn_pool;
+    HevSocks5Prober *prober;
+    HevPacketPool *packet_pool;
+    HevDNSCache *dns_cache;
+    HevDNSForwarder *dns_forwarder;
+    HevDNSRelay *dns_relay;
+    HevTimingWheel *timing_wheel;
 
     HevList tcp_set;
+    HevList tcp_park_set;
+    HevList direct_tcp_set;
     HevList dns_set;
-    HevRBTree udp_set;
+    HevList dns_tcp_set;
+    unsigned int dns_tcp_sessions;
+    HevList dns_pool;
+    unsigned int dns_pooled;
+    HevTask **task_pool;
+    unsigned int task_pooled[TASK_TYPES];
+    unsigned int task_pool_size;
+    int task_stack_sizes[TASK_TYPES];
+    size_t task_stack_marks[TASK_TYPES];
+    int task_stack_watermark;
+    HevAddrTable *udp_set;
+    HevAddrTable *direct_udp_set;
+
+    unsigned long udp_dups;
+    unsigned long task_allocs;
+    unsigned long task_reuses;
+    unsigned long tcp_parks;
+    unsigned long tcp_resumes;
 };
 
 static pthread_key_t key;
 static pthread_once_t key_once = PTHREAD_ONCE_INIT;
 
+/*
+ * Owner of each UDP client flow, shared by all workers. A slot holds the
+ * high bits of the flow hash as a tag and the owning worker id plus one
+ * in the low byte. Collisions only cost accuracy, never correctness.
+ */
+static atomic_uint udp_flow_owners[UDP_FLOW_OWNERS];
+
 static void
 pthread_key_creator (void)
 {
@@ -85,16 +152,289 @@ hev_socks5_worker_self (void)
     return pthread_getspecific (key);
 }
 
+static HevTask *
+hev_socks5_worker_task_get (HevSocks5Worker *self, int type)
+{
+    HevTask **pool = &self->task_pool[type * self->task_pool_size];
+    HevTask *task;
+
+    if (self->task_pooled[type]) {
+        self->task_reuses++;
+        return pool[--self->task_pooled[type]];
+    }
+
+    task = hev_task_new (self->task_stack_sizes[type]);
+    if (task)
+        self->task_allocs++;
+
+    return task;
+}
+
+/*
+ * Bytes below a session entry frame that watermarks paint and scan. The
+ * task library does not tell where a stack really starts, so only half
+ * of the size the task was created with is used, which stays inside the
+ * stack whatever the library adds on top or rounds to. Zero when the
+ * size is the library default or too small to measure.
+ */
+static int
+hev_socks5_worker_task_window (HevSocks5Worker *self, int type)
+{
+    int size = self->task_stack_sizes[type];
+
+    if (!self->task_stack_watermark || size < STACK_RED * 8)
+        return 0;
+
+    return size / 2;
+}
+
+/*
+ * First call of a session task entry when watermarks are on. The window
+ * below the caller is filled with a pattern, leaving room for this frame.
+ * Returns where the stack is measured from, or zero.
+ */
+static __attribute__ ((noinline)) uintptr_t
+hev_socks5_worker_task_paint (HevSocks5Worker *self, int type)
+{
+    uintptr_t top, *p, *end;
+    int window;
+
+    window = hev_socks5_worker_task_window (self, type);
+    if (!window)
+        return 0;
+
+    top = (uintptr_t)__builtin_frame_address (0);
+    end = (uintptr_t *)(top - STACK_RED);
+    p = (uintptr_t *)ALIGN_UP (top - window, sizeof (uintptr_t));
+    for (; p < end; p++)
+        *(volatile uintptr_t *)p = STACK_PAINT;
+
+    return top;
+}
+
+/*
+ * Last call of a session task entry. A stopped task keeps its stack, so a
+ * reference held past the exit saves the next session mapping a new one.
+ */
+static void
+hev_socks5_worker_task_put (HevSocks5Worker *self, int type, uintptr_t top)
+{
+    HevTask **pool = &self->task_pool[type * self->task_pool_size];
+
+    if (top) {
+        uintptr_t low = top - hev_socks5_worker_task_window (self, type);
+        uintptr_t *p;
+        size_t used;
+
+        /* the deepest word the session wrote is the first unpainted one */
+        p = (uintptr_t *)ALIGN_UP (low, sizeof (uintptr_t));
+        while ((uintptr_t)p < top && *(volatile uintptr_t *)p == STACK_PAINT)
+            p++;
+
+        used = top - (uintptr_t)p;
+        if (used > self->task_stack_marks[type])
+            self->task_stack_marks[type] = used;
+    }
+
+    if (self->task_pooled[type] >= self->task_pool_size)
+        return;
+
+    pool[self->task_pooled[type]++] = hev_task_ref (hev_task_self ());
+}
+
+static int
+hev_socks5_worker_pick_server (HevSocks5Worker *self, HevSocks5 *socks5,
+                               int *server)
+{
+    if (self->conn_pool)
+        socks5->fd = hev_socks5_conn_pool_get (self->conn_pool, server);
+
+    if (socks5->fd < 0)
+        *server = hev_socks5_balancer_pick ();
+
+    return *server;
+}
+
+/*
+ * An idle session gives its task back and waits on the park epoll with
+ * both sockets. It is no longer on the timing wheel, the park task expires
+ * it once the read-write timeout passes.
+ */
+static int
+hev_socks5_tcp_session_park (HevSocks5Worker *self, HevSocks5SessionTCP *tcp)
+{
+    struct epoll_event ev = { 0 };
+    int fd = HEV_SOCKS5 (tcp)->fd;
+
+    if (!self->task_park || !READ_ONCE (self->run))
+        return -1;
+
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = tcp;
+    if (epoll_ctl (self->park_fd, EPOLL_CTL_ADD, tcp->fd, &ev) < 0)
+        return -1;
+    if (epoll_ctl (self->park_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        epoll_ctl (self->park_fd, EPOLL_CTL_DEL, tcp->fd, NULL);
+        return -1;
+    }
+
+    /* the park task only keeps a deadline while it has sessions */
+    if (!hev_list_first (&self->tcp_park_set))
+        hev_task_wakeup (self->task_park);
+
+    hev_timing_wheel_del (self->timing_wheel, &tcp->timer);
+    hev_tproxy_session_set_task (HEV_TPROXY_SESSION (tcp), NULL);
+    hev_list_del (&self->tcp_set, &tcp->node);
+    hev_list_add_tail (&self->tcp_park_set, &tcp->node);
+    tcp->parked_at = get_monotonic_ms ();
+    self->tcp_parks++;
+
+    return 0;
+}
+
+static void
+hev_socks5_tcp_session_unpark (HevSocks5Worker *self, HevSocks5SessionTCP *tcp)
+{
+    epoll_ctl (self->park_fd, EPOLL_CTL_DEL, tcp->fd, NULL);
+    epoll_ctl (self->park_fd, EPOLL_CTL_DEL, HEV_SOCKS5 (tcp)->fd, NULL);
+    hev_list_del (&self->tcp_park_set, &tcp->node);
+    hev_list_add_tail (&self->tcp_set, &tcp->node);
+    tcp->parked = 0;
+}
+
+static void
+hev_socks5_tcp_session_end (HevSocks5Worker *self, HevSocks5SessionTCP *tcp)
+{
+    if (tcp->parked && hev_socks5_tcp_session_park (self, tcp) == 0)
+        return;
+
+    hev_timing_wheel_del (self->timing_wheel, &tcp->timer);
+    hev_socks5_balancer_release (tcp->server);
+    hev_list_del (&self->tcp_set, &tcp->node);
+    hev_object_unref (HEV_OBJECT (tcp));
+}
+
 static void
 hev_socks5_tcp_session_task_entry (void *data)
 {
     HevSocks5Worker *self = hev_socks5_worker_self ();
     HevSocks5SessionTCP *tcp = data;
+    uintptr_t top;
+
+    top = hev_socks5_worker_task_paint (self, TASK_TCP);
+
+    /* join a speculative connection still in its handshake */
+    if (tcp->preconnect) {
+        int fd = hev_socks5_preconnect_wait (tcp->preconnect, HEV_SOCKS5 (tcp));
+
+        tcp->preconnect = NULL;
+        HEV_SOCKS5 (tcp)->fd = fd;
+        tcp->established = fd >= 0;
+    }
 
     hev_tproxy_session_run (HEV_TPROXY_SESSION (tcp));
 
-    hev_list_del (&self->tcp_set, &tcp->node);
+    hev_socks5_tcp_session_end (self, tcp);
+    hev_socks5_worker_task_put (self, TASK_TCP, top);
+}
+
+static void
+hev_socks5_tcp_session_resume_task_entry (void *data)
+{
+    HevSocks5Worker *self = hev_socks5_worker_self ();
+    HevSocks5SessionTCP *tcp = data;
+    uintptr_t top;
+
+    top = hev_socks5_worker_task_paint (self, TASK_TCP);
+
+    hev_socks5_session_tcp_resume (tcp);
+
+    hev_socks5_tcp_session_end (self, tcp);
+    hev_socks5_worker_task_put (self, TASK_TCP, top);
+}
+
+static void
+hev_socks5_tcp_session_resume (HevSocks5Worker *self, HevSocks5SessionTCP *tcp)
+{
+    HevTask *task;
+
+    hev_socks5_tcp_session_unpark (self, tcp);
+
+    task = hev_socks5_worker_task_get (self, TASK_TCP);
+    if (!task) {
+        hev_socks5_tcp_session_end (self, tcp);
+        return;
+    }
+
+    hev_tproxy_session_set_task (HEV_TPROXY_SESSION (tcp), task);
+    hev_timing_wheel_add (self->timing_wheel, &tcp->timer, tcp,
+                          hev_config_get_misc_tcp_read_write_timeout ());
+    self->tcp_resumes++;
+    hev_task_run (task, hev_socks5_tcp_session_resume_task_entry, tcp);
+}
+
+static void
+hev_socks5_tcp_session_expire (HevSocks5Worker *self, int64_t before)
+{
+    HevListNode *node;
+
+    /* sessions park in time order, the oldest come first */
+    while ((node = hev_list_first (&self->tcp_park_set))) {
+        HevSocks5SessionTCP *tcp;
+
+        tcp = container_of (node, HevSocks5SessionTCP, node);
+        if (tcp->parked_at > before)
+            break;
+
+        LOG_D ("%p socks5 tcp session parked expire", tcp);
+        hev_socks5_tcp_session_unpark (self, tcp);
+        hev_socks5_tcp_session_end (self, tcp);
+    }
+}
+
+static void
+hev_socks5_direct_tcp_session_task_entry (void *data)
+{
+    HevSocks5Worker *self = hev_socks5_worker_self ();
+    HevTProxySessionDirectTCP *tcp = data;
+    uintptr_t top;
+
+    top = hev_socks5_worker_task_paint (self, TASK_TCP);
+
+    hev_tproxy_session_run (HEV_TPROXY_SESSION (tcp));
+
+    hev_timing_wheel_del (self->timing_wheel, &tcp->timer);
+    hev_list_del (&self->direct_tcp_set, &tcp->node);
     hev_object_unref (HEV_OBJECT (tcp));
+    hev_socks5_worker_task_put (self, TASK_TCP, top);
+}
+
+static void
+hev_socks5_direct_tcp_session_new (HevSocks5Worker *self,
+                                   struct sockaddr_in6 *addr, int fd)
+{
+    HevTProxySessionDirectTCP *tcp;
+    HevTask *task;
+
+    LOG_D ("socks5 direct tcp session new");
+
+    tcp = hev_tproxy_session_direct_tcp_new (addr, fd);
+    if (!tcp) {
+        close (fd);
+        return;
+    }
+
+    task = hev_socks5_worker_task_get (self, TASK_TCP);
+    if (!task) {
+        hev_object_unref (HEV_OBJECT (tcp));
+        return;
+    }
+
+    hev_tproxy_session_set_task (HEV_TPROXY_SESSION (tcp), task);
+    hev_timing_wheel_add (self->timing_wheel, &tcp->timer, tcp,
+                          hev_config_get_misc_tcp_read_write_timeout ());
+    hev_list_add_tail (&self->direct_tcp_set, &tcp->node);
+    hev_task_run (task, hev_socks5_direct_tcp_session_task_entry, tcp);
 }
 
 static void
@@ -103,7 +443,6 @@ hev_socks5_tcp_session_new (HevSocks5Worker *self, int fd)
     HevSocks5SessionTCP *tcp;
     struct sockaddr_in6 addr;
     socklen_t addrlen;
-    int stack_size;
     HevTask *task;
     int res;
 
@@ -117,20 +456,43 @@ hev_socks5_tcp_session_new (HevSocks5Worker *self, int fd)
         return;
     }
 
+    if (hev_bypass_table_match (&addr)) {
+        hev_socks5_direct_tcp_session_new (self, &addr, fd);
+        return;
+    }
+
     tcp = hev_socks5_session_tcp_new (&addr, fd);
     if (!tcp) {
         close (fd);
         return;
     }
 
-    stack_size = hev_config_get_misc_task_stack_size ();
-    task = hev_task_new (stack_size);
+    /* a connection started for a DNS answer is at or near the handshake */
+    HEV_SOCKS5 (tcp)->fd =
+        hev_socks5_preconnect_take (&addr, &tcp->server, &tcp->preconnect);
+    if (HEV_SOCKS5 (tcp)->fd >= 0 || tcp->preconnect) {
+        tcp->established = HEV_SOCKS5 (tcp)->fd >= 0;
+        res = tcp->server;
+    } else {
+        res = hev_socks5_worker_pick_server (self, HEV_SOCKS5 (tcp),
+                                             &tcp->server);
+    }
+    if (res < 0) {
+        LOG_D ("socks5 tcp no server");
+        hev_object_unref (HEV_OBJECT (tcp));
+        return;
+    }
+
+    task = hev_socks5_worker_task_get (self, TASK_TCP);
     if (!task) {
         hev_object_unref (HEV_OBJECT (tcp));
         return;
     }
 
     hev_tproxy_session_set_task (HEV_TPROXY_SESSION (tcp), task);
+    hev_socks5_balancer_acquire (tcp->server);
+    hev_timing_wheel_add (self->timing_wheel, &tcp->timer, tcp,
+                          hev_config_get_misc_tcp_read_write_timeout ());
     hev_list_add_tail (&self->tcp_set, &tcp->node);
     hev_task_run (task, hev_socks5_tcp_session_task_entry, tcp);
 }
@@ -181,43 +543,19 @@ hev_socks5_tcp_task_entry (void *data)
         hev_tproxy_session_terminate (HEV_TPROXY_SESSION (tcp));
     }
 
+    node = hev_list_first (&self->direct_tcp_set);
+    for (; node; node = hev_list_node_next (node)) {
+        HevTProxySessionDirectTCP *tcp;
+
+        tcp = container_of (node, HevTProxySessionDirectTCP, node);
+        hev_tproxy_session_terminate (HEV_TPROXY_SESSION (tcp));
+    }
+
     close (fd);
 exit:
     self->task_tcp = NULL;
 }
 
-static int
-hev_socks5_udp_recvmsg (HevSocks5Worker *self, int fd, struct sockaddr *saddr,
-                        struct sockaddr *daddr, void *buf, size_t len)
-{
-    union
-    {
-        char buf[CMSG_SPACE (sizeof (struct sockaddr_in6))];
-        struct cmsghdr align;
-    } u;
-    struct msghdr mh;
-    struct iovec iov;
-    int res;
-
-    mh.msg_iov = &iov;
-    mh.msg_iovlen = 1;
-    mh.msg_name = saddr;
-    mh.msg_namelen = sizeof (struct sockaddr_in6);
-    mh.msg_control = u.buf;
-    mh.msg_controllen = sizeof (u.buf);
-
-    iov.iov_base = buf;
-    iov.iov_len = len;
-
-    res = hev_task_io_socket_recvmsg (fd, &mh, 0, task_io_yielder, self);
-    if (res <= 0)
-        return res;
-
-    msg_to_sock_addr (&mh, daddr);
-
-    return res;
-}
-
 static int
 _hev_socks5_udp_recvmmsg (HevSocks5Worker *self, int fd,
                           struct sockaddr_in6 *saddr,
@@ -253,56 +591,68 @@ _hev_socks5_udp_recvmmsg (HevSocks5Worker *self, int fd,
     return res;
 }
 
-static HevSocks5SessionUDP *
-hev_socks5_udp_session_find (HevSocks5Worker *self, struct sockaddr *addr)
+static unsigned int
+hev_socks5_udp_flow_hash (struct sockaddr_in6 *addr)
 {
-    HevRBTreeNode *node = self->udp_set.root;
+    const uint32_t *a = (const uint32_t *)&addr->sin6_addr;
+    uint64_t h = addr->sin6_port;
+    int i;
 
-    while (node) {
-        HevSocks5SessionUDP *this;
-        int res;
+    for (i = 0; i < 4; i++)
+        h = (h ^ a[i]) * 0x9e3779b97f4a7c15ULL;
 
-        this = container_of (node, HevSocks5SessionUDP, node);
-        res = memcmp (&this->addr, addr, sizeof (struct sockaddr_in6));
+    return h >> 32;
+}
 
-        if (res < 0)
-            node = node->left;
-        else if (res > 0)
-            node = node->right;
-        else
-            return this;
-    }
+static void
+hev_socks5_udp_flow_claim (HevSocks5Worker *self, HevSocks5SessionUDP *udp)
+{
+    unsigned int hash, prev, own;
 
-    return NULL;
+    if (hev_config_get_workers () < 2)
+        return;
+
+    hash = hev_socks5_udp_flow_hash (&udp->addr);
+    own = (hash & ~0xffU) | ((self->id + 1) & 0xff);
+    prev = atomic_exchange (&udp_flow_owners[hash % UDP_FLOW_OWNERS], own);
+
+    if ((prev & ~0xffU) == (own & ~0xffU) && prev != own) {
+        self->udp_dups++;
+        LOG_D ("%p socks5 worker udp flow duplicated by worker %u", self,
+               (prev & 0xff) - 1);
+    }
 }
 
 static void
-hev_socks5_udp_session_add (HevSocks5Worker *self, HevSocks5SessionUDP *udp)
+hev_socks5_udp_flow_release (HevSocks5Worker *self, HevSocks5SessionUDP *udp)
 {
-    HevRBTreeNode **new = &self->udp_set.root, *parent = NULL;
+    unsigned int hash, own;
 
-    while (*new) {
-        HevSocks5SessionUDP *this;
-        int res;
+    if (hev_config_get_workers () < 2)
+        return;
 
-        this = container_of (*new, HevSocks5SessionUDP, node);
-        res = memcmp (&this->addr, &udp->addr, sizeof (struct sockaddr_in6));
+    hash = hev_socks5_udp_flow_hash (&udp->addr);
+    own = (hash & ~0xffU) | ((self->id + 1) & 0xff);
+    atomic_compare_exchange_strong (&udp_flow_owners[hash % UDP_FLOW_OWNERS],
+                                    &own, 0);
+}
 
-        parent = *new;
-        if (res < 0)
-            new = &((*new)->left);
-        else if (res > 0)
-            new = &((*new)->right);
-    }
+static HevSocks5SessionUDP *
+hev_socks5_udp_session_find (HevSocks5Worker *self, struct sockaddr *addr)
+{
+    return hev_addr_table_find (self->udp_set, (struct sockaddr_in6 *)addr);
+}
 
-    hev_rbtree_node_link (&udp->node, parent, new);
-    hev_rbtree_insert_color (&self->udp_set, &udp->node);
+static int
+hev_socks5_udp_session_add (HevSocks5Worker *self, HevSocks5SessionUDP *udp)
+{
+    return hev_addr_table_insert (self->udp_set, &udp->addr, udp);
 }
 
 static void
 hev_socks5_udp_session_del (HevSocks5Worker *self, HevSocks5SessionUDP *udp)
 {
-    hev_rbtree_erase (&self->udp_set, &udp->node);
+    hev_addr_table_remove (self->udp_set, &udp->addr);
 }
 
 static void
@@ -310,19 +660,26 @@ hev_socks5_udp_session_task_entry (void *data)
 {
     HevSocks5Worker *self = hev_socks5_worker_self ();
     HevSocks5SessionUDP *udp = data;
+    uintptr_t top;
+
+    top = hev_socks5_worker_task_paint (self, TASK_UDP);
 
     hev_tproxy_session_run (HEV_TPROXY_SESSION (udp));
 
+    hev_timing_wheel_del (self->timing_wheel, &udp->timer);
+    hev_socks5_balancer_release (udp->server);
+    hev_socks5_udp_flow_release (self, udp);
     hev_socks5_udp_session_del (self, udp);
     hev_object_unref (HEV_OBJECT (udp));
+    hev_socks5_worker_task_put (self, TASK_UDP, top);
 }
 
 static HevSocks5SessionUDP *
 hev_socks5_udp_session_new (HevSocks5Worker *self, struct sockaddr *addr)
 {
     HevSocks5SessionUDP *udp;
-    int stack_size;
     HevTask *task;
+    int res;
 
     LOG_D ("socks5 udp session new");
 
@@ -330,20 +687,102 @@ hev_socks5_udp_session_new (HevSocks5Worker *self, struct sockaddr *addr)
     if (!udp)
         return NULL;
 
-    stack_size = hev_config_get_misc_task_stack_size ();
-    task = hev_task_new (stack_size);
+    res = hev_socks5_worker_pick_server (self, HEV_SOCKS5 (udp), &udp->server);
+    if (res < 0) {
+        LOG_D ("socks5 udp no server");
+        hev_object_unref (HEV_OBJECT (udp));
+        return NULL;
+    }
+
+    task = hev_socks5_worker_task_get (self, TASK_UDP);
     if (!task) {
         hev_object_unref (HEV_OBJECT (udp));
         return NULL;
     }
 
+    if (hev_socks5_udp_session_add (self, udp) < 0) {
+        hev_task_unref (task);
+        hev_object_unref (HEV_OBJECT (udp));
+        return NULL;
+    }
+
+    hev_socks5_udp_flow_claim (self, udp);
     hev_tproxy_session_set_task (HEV_TPROXY_SESSION (udp), task);
-    hev_socks5_udp_session_add (self, udp);
+    hev_socks5_balancer_acquire (udp->server);
+    hev_timing_wheel_add (self->timing_wheel, &udp->timer, udp,
+                          hev_config_get_misc_udp_read_write_timeout ());
     hev_task_run (task, hev_socks5_udp_session_task_entry, udp);
 
     return udp;
 }
 
+static void
+hev_socks5_direct_udp_session_task_entry (void *data)
+{
+    HevSocks5Worker *self = hev_socks5_worker_self ();
+    HevTProxySessionDirectUDP *udp = data;
+    uintptr_t top;
+
+    top = hev_socks5_worker_task_paint (self, TASK_UDP);
+
+    hev_tproxy_session_run (HEV_TPROXY_SESSION (udp));
+
+    hev_timing_wheel_del (self->timing_wheel, &udp->timer);
+    hev_addr_table_remove (self->direct_udp_set, &udp->addr);
+    hev_object_unref (HEV_OBJECT (udp));
+    hev_socks5_worker_task_put (self, TASK_UDP, top);
+}
+
+static HevTProxySessionDirectUDP *
+hev_socks5_direct_udp_session_new (HevSocks5Worker *self,
+                                   struct sockaddr *addr)
+{
+    HevTProxySessionDirectUDP *udp;
+    HevTask *task;
+
+    LOG_D ("socks5 direct udp session new");
+
+    udp = hev_tproxy_session_direct_udp_new (addr);
+    if (!udp)
+        return NULL;
+
+    task = hev_socks5_worker_task_get (self, TASK_UDP);
+    if (!task) {
+        hev_object_unref (HEV_OBJECT (udp));
+        return NULL;
+    }
+
+    if (hev_addr_table_insert (self->direct_udp_set, &udp->addr, udp) < 0) {
+        hev_task_unref (task);
+        hev_object_unref (HEV_OBJECT (udp));
+        return NULL;
+    }
+
+    hev_tproxy_session_set_task (HEV_TPROXY_SESSION (udp), task);
+    hev_timing_wheel_add (self->timing_wheel, &udp->timer, udp,
+                          hev_config_get_misc_udp_read_write_timeout ());
+    hev_task_run (task, hev_socks5_direct_udp_session_task_entry, udp);
+
+    return udp;
+}
+
+static int
+hev_socks5_direct_udp_dispatch (HevSocks5Worker *self, struct sockaddr *saddr,
+                                struct sockaddr *daddr, void *data, size_t len)
+{
+    HevTProxySessionDirectUDP *udp;
+
+    udp = hev_addr_table_find (self->direct_udp_set,
+                               (struct sockaddr_in6 *)saddr);
+    if (!udp) {
+        udp = hev_socks5_direct_udp_session_new (self, saddr);
+        if (!udp)
+            return -1;
+    }
+
+    return hev_tproxy_session_direct_udp_send (udp, data, len, daddr);
+}
+
 static int
 hev_socks5_udp_dispatch (HevSocks5Worker *self, struct sockaddr *saddr,
                          struct sockaddr *daddr, void *data, size_t len)
@@ -351,6 +790,9 @@ hev_socks5_udp_dispatch (HevSocks5Worker *self, struct sockaddr *saddr,
     HevSocks5SessionUDP *udp;
     int res;
 
+    if (hev_bypass_table_match ((struct sockaddr_in6 *)daddr))
+        return hev_socks5_direct_udp_dispatch (self, saddr, daddr, data, len);
+
     udp = hev_socks5_udp_session_find (self, saddr);
     if (!udp) {
         udp = hev_socks5_udp_session_new (self, saddr);
@@ -363,11 +805,16 @@ hev_socks5_udp_dispatch (HevSocks5Worker *self, struct sockaddr *saddr,
     return res;
 }
 
+static void
+hev_socks5_udp_session_terminate (void *data, void *user)
+{
+    hev_tproxy_session_terminate (HEV_TPROXY_SESSION (data));
+}
+
 static void
 hev_socks5_udp_task_entry (void *data)
 {
     HevSocks5Worker *self = data;
-    HevRBTreeNode *node;
     const char *addr;
     const char *port;
     int fd, num;
@@ -401,10 +848,10 @@ hev_socks5_udp_task_entry (void *data)
             int res;
 
             for (i = 0; i < num; i++) {
-                if (!iov[i].iov_base) {
-                    iov[i].iov_base = hev_malloc (UDP_BUF_SIZE);
-                    iov[i].iov_len = UDP_BUF_SIZE;
-                }
+                if (!iov[i].iov_base)
+                    iov[i].iov_base =
+                        hev_packet_pool_alloc (self->packet_pool);
+                iov[i].iov_len = UDP_BUF_SIZE;
             }
 
             res = _hev_socks5_udp_recvmmsg (self, fd, saddr, daddr, iov, num);
@@ -429,44 +876,118 @@ hev_socks5_udp_task_entry (void *data)
 
         for (i = 0; i < num; i++) {
             if (iov[i].iov_base)
-                hev_free (iov[i].iov_base);
+                hev_packet_pool_free (iov[i].iov_base);
         }
     }
 
-    node = hev_rbtree_first (&self->udp_set);
-    for (; node; node = hev_rbtree_node_next (node)) {
-        HevSocks5SessionUDP *udp;
-
-        udp = container_of (node, HevSocks5SessionUDP, node);
-        hev_tproxy_session_terminate (HEV_TPROXY_SESSION (udp));
-    }
+    hev_addr_table_foreach (self->udp_set, hev_socks5_udp_session_terminate,
+                            NULL);
+    hev_addr_table_foreach (self->direct_udp_set,
+                            hev_socks5_udp_session_terminate, NULL);
 
     close (fd);
 exit:
     self->task_udp = NULL;
 }
 
+static HevTProxySessionDNS *
+hev_socks5_dns_session_get (HevSocks5Worker *self)
+{
+    HevListNode *node = hev_list_first (&self->dns_pool);
+
+    if (!node)
+        return hev_tproxy_session_dns_new ();
+
+    hev_list_del (&self->dns_pool, node);
+    self->dns_pooled--;
+
+    return container_of (node, HevTProxySessionDNS, node);
+}
+
+static void
+hev_socks5_dns_session_put (HevSocks5Worker *self, HevTProxySessionDNS *dns)
+{
+    if (self->dns_pooled >= DNS_POOL_SIZE) {
+        hev_object_unref (HEV_OBJECT (dns));
+        return;
+    }
+
+    hev_tproxy_session_dns_reset (dns);
+    hev_list_add_tail (&self->dns_pool, &dns->node);
+    self->dns_pooled++;
+}
+
 static void
 hev_socks5_dns_session_task_entry (void *data)
 {
     HevSocks5Worker *self = hev_socks5_worker_self ();
     HevTProxySessionDNS *dns = data;
+    uintptr_t top;
+
+    top = hev_socks5_worker_task_paint (self, TASK_DNS);
 
     hev_tproxy_session_run (HEV_TPROXY_SESSION (dns));
 
+    hev_timing_wheel_del (self->timing_wheel, &dns->timer);
     hev_list_del (&self->dns_set, &dns->node);
-    hev_object_unref (HEV_OBJECT (dns));
+    hev_socks5_dns_session_put (self, dns);
+    hev_socks5_worker_task_put (self, TASK_DNS, top);
+}
+
+static void
+hev_socks5_dns_session_dispatch (HevSocks5Worker *self,
+                                 HevTProxySessionDNS *dns, size_t len)
+{
+    void *buffer = hev_tproxy_session_dns_get_buffer (dns);
+    HevTask *task;
+    int res;
+
+    res = hev_fake_ip_answer (buffer, len, UDP_BUF_SIZE);
+    if (res > 0) {
+        hev_tproxy_session_dns_reply (dns, res);
+        hev_socks5_dns_session_put (self, dns);
+        return;
+    }
+
+    if (self->dns_cache) {
+        HevDNSKey refresh;
+
+        res = hev_dns_cache_lookup (self->dns_cache, buffer, len,
+                                    UDP_BUF_SIZE, 0, &refresh);
+        if (res > 0) {
+            if (refresh.len)
+                hev_dns_forwarder_refresh (self->dns_forwarder,
+                                           self->dns_cache, &refresh);
+            hev_tproxy_session_dns_reply (dns, res);
+            hev_socks5_dns_session_put (self, dns);
+            return;
+        }
+        hev_tproxy_session_dns_set_cache (dns, self->dns_cache);
+    }
+
+    task = hev_socks5_worker_task_get (self, TASK_DNS);
+    if (!task) {
+        hev_socks5_dns_session_put (self, dns);
+        return;
+    }
+
+    hev_tproxy_session_dns_set_forwarder (dns, self->dns_forwarder);
+    hev_tproxy_session_dns_set_size (dns, len);
+    hev_tproxy_session_set_task (HEV_TPROXY_SESSION (dns), task);
+    hev_timing_wheel_add (self->timing_wheel, &dns->timer, dns, dns->timeout);
+    hev_list_add_tail (&self->dns_set, &dns->node);
+    hev_task_run (task, hev_socks5_dns_session_task_entry, dns);
 }
 
 static void
 hev_socks5_dns_task_entry (void *data)
 {
     HevSocks5Worker *self = data;
+    unsigned long hist[8] = { 0 };
     HevListNode *node;
     const char *addr;
     const char *port;
-    int stack_size;
-    int fd;
+    int fd, num;
 
     LOG_D ("socks5 dns task run");
 
@@ -481,39 +1002,79 @@ hev_socks5_dns_task_entry (void *data)
         goto exit;
     }
 
+    if (self->dns_relay) {
+        hev_dns_relay_run (self->dns_relay, fd);
+        close (fd);
+        goto exit;
+    }
+
+    num = hev_config_get_misc_udp_copy_buffer_nums ();
     hev_task_add_fd (hev_task_self (), fd, POLLIN);
-    stack_size = hev_config_get_misc_task_stack_size ();
 
-    for (;;) {
-        HevTProxySessionDNS *dns;
-        struct sockaddr *sap;
-        struct sockaddr *dap;
-        HevTask *task;
-        void *buffer;
-        int res;
-
-        dns = hev_tproxy_session_dns_new ();
-        sap = hev_tproxy_session_dns_get_saddr (dns);
-        dap = hev_tproxy_session_dns_get_daddr (dns);
-        buffer = hev_tproxy_session_dns_get_buffer (dns);
-
-        res = hev_socks5_udp_recvmsg (self, fd, sap, dap, buffer, UDP_BUF_SIZE);
-        if (res == -1 || res == 0) {
-            LOG_W ("socks5 dns recvmsg");
-            hev_object_unref (HEV_OBJECT (dns));
-            continue;
-        } else if (res <= 0) {
-            hev_object_unref (HEV_OBJECT (dns));
-            break;
+    {
+        HevTProxySessionDNS *dnsv[num];
+        struct iovec iov[num];
+        int i;
+
+        for (i = 0; i < num; i++)
+            dnsv[i] = NULL;
+
+        for (;;) {
+            struct sockaddr_in6 saddr[num];
+            struct sockaddr_in6 daddr[num];
+            int res, n;
+
+            for (n = 0; n < num; n++) {
+                if (!dnsv[n])
+                    dnsv[n] = hev_socks5_dns_session_get (self);
+                if (!dnsv[n])
+                    break;
+                iov[n].iov_base = hev_tproxy_session_dns_get_buffer (dnsv[n]);
+                iov[n].iov_len = UDP_BUF_SIZE;
+            }
+
+            if (n == 0) {
+                if (!READ_ONCE (self->run))
+                    break;
+                hev_task_sleep (100);
+                continue;
+            }
+
+            res = _hev_socks5_udp_recvmmsg (self, fd, saddr, daddr, iov, n);
+            if (res == -1 || res == 0) {
+                LOG_W ("socks5 dns recvmmsg");
+                continue;
+            } else if (res < 0) {
+                break;
+            }
+
+            for (i = 0; (1 << i) < res && i < 7; i++)
+                ;
+            hist[i]++;
+
+            for (i = 0; i < res; i++) {
+                HevTProxySessionDNS *dns = dnsv[i];
+
+                dnsv[i] = NULL;
+                memcpy (hev_tproxy_session_dns_get_saddr (dns), &saddr[i],
+                        sizeof (struct sockaddr_in6));
+                memcpy (hev_tproxy_session_dns_get_daddr (dns), &daddr[i],
+                        sizeof (struct sockaddr_in6));
+                hev_socks5_dns_session_dispatch (self, dns, iov[i].iov_len);
+            }
         }
 
-        task = hev_task_new (stack_size);
-        hev_task_run (task, hev_socks5_dns_session_task_entry, dns);
-        hev_list_add_tail (&self->dns_set, &dns->node);
-        hev_tproxy_session_dns_set_size (dns, res);
-        hev_tproxy_session_set_task (HEV_TPROXY_SESSION (dns), task);
+        for (i = 0; i < num; i++) {
+            if (dnsv[i])
+                hev_socks5_dns_session_put (self, dnsv[i]);
+        }
     }
 
+    LOG_I ("%p socks5 worker dns batches 1:%lu 2:%lu 4:%lu 8:%lu 16:%lu "
+           "32:%lu 64:%lu more:%lu",
+           self, hist[0], hist[1], hist[2], hist[3], hist[4], hist[5],
+           hist[6], hist[7]);
+
     node = hev_list_first (&self->dns_set);
     for (; node; node = hev_list_node_next (node)) {
         HevTProxySessionDNS *dns;
@@ -527,6 +1088,183 @@ exit:
     self->task_dns = NULL;
 }
 
+static void
+hev_socks5_dns_tcp_session_task_entry (void *data)
+{
+    HevSocks5Worker *self = hev_socks5_worker_self ();
+    HevTProxySessionDNSTCP *dns = data;
+    uintptr_t top;
+
+    top = hev_socks5_worker_task_paint (self, TASK_DNS);
+
+    hev_tproxy_session_run (HEV_TPROXY_SESSION (dns));
+
+    hev_timing_wheel_del (self->timing_wheel, &dns->timer);
+    hev_list_del (&self->dns_tcp_set, &dns->node);
+    hev_object_unref (HEV_OBJECT (dns));
+    self->dns_tcp_sessions--;
+    hev_socks5_worker_task_put (self, TASK_DNS, top);
+}
+
+static void
+hev_socks5_dns_tcp_session_new (HevSocks5Worker *self, int fd)
+{
+    HevTProxySessionDNSTCP *dns;
+    HevTask *task;
+
+    LOG_D ("socks5 dns tcp session new");
+
+    /* each connection holds buffers, a client may not open them freely */
+    if (self->dns_tcp_sessions >= DNS_TCP_SESSION_MAX) {
+        LOG_D ("socks5 dns tcp sessions over %d", DNS_TCP_SESSION_MAX);
+        close (fd);
+        return;
+    }
+
+    dns = hev_tproxy_session_dns_tcp_new (fd);
+    if (!dns) {
+        close (fd);
+        return;
+    }
+
+    task = hev_socks5_worker_task_get (self, TASK_DNS);
+    if (!task) {
+        hev_object_unref (HEV_OBJECT (dns));
+        return;
+    }
+
+    hev_tproxy_session_dns_tcp_set_cache (dns, self->dns_cache);
+    hev_tproxy_session_dns_tcp_set_forwarder (dns, self->dns_forwarder);
+    hev_tproxy_session_set_task (HEV_TPROXY_SESSION (dns), task);
+    hev_timing_wheel_add (self->timing_wheel, &dns->timer, dns, dns->timeout);
+    hev_list_add_tail (&self->dns_tcp_set, &dns->node);
+    self->dns_tcp_sessions++;
+    hev_task_run (task, hev_socks5_dns_tcp_session_task_entry, dns);
+}
+
+static void
+hev_socks5_dns_tcp_task_entry (void *data)
+{
+    HevSocks5Worker *self = data;
+    HevListNode *node;
+    const char *addr;
+    const char *port;
+    int fd;
+
+    LOG_D ("socks5 dns tcp task run");
+
+    addr = hev_config_get_dns_address ();
+    port = hev_config_get_dns_port ();
+    if (!addr || !self->dns_forwarder)
+        goto exit;
+
+    fd = hev_socket_factory_get (addr, port, SOCK_STREAM, !self->is_main);
+    if (fd < 0) {
+        LOG_E ("socks5 dns tcp socket");
+        goto exit;
+    }
+
+    hev_task_add_fd (hev_task_self (), fd, POLLIN);
+
+    for (;;) {
+        int nfd;
+
+        nfd = hev_task_io_socket_accept (fd, NULL, NULL, task_io_yielder, self);
+        if (nfd == -1) {
+            LOG_W ("socks5 dns tcp accept");
+            continue;
+        } else if (nfd < 0) {
+            break;
+        }
+
+        hev_socks5_dns_tcp_session_new (self, nfd);
+    }
+
+    node = hev_list_first (&self->dns_tcp_set);
+    for (; node; node = hev_list_node_next (node)) {
+        HevTProxySessionDNSTCP *dns;
+
+        dns = container_of (node, HevTProxySessionDNSTCP, node);
+        hev_tproxy_session_terminate (HEV_TPROXY_SESSION (dns));
+    }
+
+    close (fd);
+exit:
+    self->task_dns_tcp = NULL;
+}
+
+static void
+hev_socks5_park_task_entry (void *data)
+{
+    HevSocks5Worker *self = data;
+    struct epoll_event evs[64];
+    int64_t keep;
+    int expire;
+
+    LOG_D ("socks5 park task run");
+
+    /* a parked session was quiet for the idle time already */
+    expire = hev_config_get_misc_tcp_read_write_timeout () > 0;
+    keep = hev_config_get_misc_tcp_read_write_timeout ();
+    keep -= hev_config_get_misc_tcp_park_idle ();
+    if (keep < 0)
+        keep = 0;
+
+    hev_task_add_fd (hev_task_self (), self->park_fd, POLLIN);
+
+    while (READ_ONCE (self->run)) {
+        HevSocks5SessionTCP *tcp;
+        HevListNode *node;
+        int64_t now;
+        int i, n;
+
+        n = epoll_wait (self->park_fd, evs, 64, 0);
+        for (i = 0; i < n; i++) {
+            tcp = evs[i].data.ptr;
+
+            /* both sockets of a session may be ready at once */
+            if (tcp->parked)
+                hev_socks5_tcp_session_resume (self, tcp);
+        }
+
+        if (n > 0) {
+            hev_task_yield (HEV_TASK_YIELD);
+            continue;
+        }
+
+        now = get_monotonic_ms ();
+        if (expire)
+            hev_socks5_tcp_session_expire (self, now - keep);
+
+        /* wait for a parked socket, or until the oldest session expires */
+        node = hev_list_first (&self->tcp_park_set);
+        if (!expire || !node) {
+            hev_task_yield (HEV_TASK_WAITIO);
+            continue;
+        }
+
+        tcp = container_of (node, HevSocks5SessionTCP, node);
+        hev_task_sleep (tcp->parked_at + keep - now);
+    }
+
+    hev_socks5_tcp_session_expire (self, INT64_MAX);
+    hev_task_del_fd (hev_task_self (), self->park_fd);
+
+    self->task_park = NULL;
+}
+
+static void
+hev_socks5_timer_task_entry (void *data)
+{
+    HevSocks5Worker *self = data;
+
+    LOG_D ("socks5 timer task run");
+
+    hev_timing_wheel_run (self->timing_wheel);
+
+    self->task_timer = NULL;
+}
+
 static void
 hev_socks5_event_task_entry (void *data)
 {
@@ -558,12 +1296,27 @@ hev_socks5_event_task_entry (void *data)
         hev_task_wakeup (self->task_udp);
     if (self->task_dns)
         hev_task_wakeup (self->task_dns);
+    if (self->task_dns_tcp)
+        hev_task_wakeup (self->task_dns_tcp);
+    if (self->task_park)
+        hev_task_wakeup (self->task_park);
+    if (self->timing_wheel)
+        hev_timing_wheel_stop (self->timing_wheel);
+    if (self->conn_pool)
+        hev_socks5_conn_pool_stop (self->conn_pool);
+    if (self->prober)
+        hev_socks5_prober_stop (self->prober);
+    hev_socks5_preconnect_stop ();
+    if (self->dns_forwarder)
+        hev_dns_forwarder_stop (self->dns_forwarder);
+    if (self->dns_relay)
+        hev_dns_relay_stop (self->dns_relay);
 
     hev_task_del_fd (task, self->event_fds[0]);
 }
 
 HevSocks5Worker *
-hev_socks5_worker_new (int is_main)
+hev_socks5_worker_new (int id)
 {
     HevSocks5Worker *self;
     int nonblock = 1;
@@ -577,6 +1330,7 @@ hev_socks5_worker_new (int is_main)
 
     self->event_fds[0] = -1;
     self->event_fds[1] = -1;
+    self->park_fd = -1;
 
     res = pipe (self->event_fds);
     if (res < 0) {
@@ -614,7 +1368,119 @@ hev_socks5_worker_new (int is_main)
         goto exit;
     }
 
-    self->is_main = is_main;
+    self->task_dns_tcp = hev_task_new (-1);
+    if (!self->task_dns_tcp) {
+        LOG_E ("socks5 worker task dns tcp");
+        goto exit;
+    }
+
+    self->task_timer = hev_task_new (-1);
+    if (!self->task_timer) {
+        LOG_E ("socks5 worker task timer");
+        goto exit;
+    }
+
+    if (hev_config_get_misc_tcp_park_idle () > 0) {
+        self->park_fd = epoll_create1 (EPOLL_CLOEXEC);
+        if (self->park_fd < 0) {
+            LOG_E ("socks5 worker park epoll");
+            goto exit;
+        }
+
+        self->task_park = hev_task_new (-1);
+        if (!self->task_park) {
+            LOG_E ("socks5 worker task park");
+            goto exit;
+        }
+    }
+
+    self->timing_wheel = hev_timing_wheel_new ();
+    if (!self->timing_wheel) {
+        LOG_E ("socks5 worker timing wheel");
+        goto exit;
+    }
+
+    self->udp_set = hev_addr_table_new (64);
+    if (!self->udp_set) {
+        LOG_E ("socks5 worker udp set");
+        goto exit;
+    }
+
+    self->direct_udp_set = hev_addr_table_new (64);
+    if (!self->direct_udp_set) {
+        LOG_E ("socks5 worker direct udp set");
+        goto exit;
+    }
+
+    self->task_stack_sizes[TASK_TCP] = hev_config_get_misc_tcp_stack_size ();
+    self->task_stack_sizes[TASK_UDP] = hev_config_get_misc_udp_stack_size ();
+    self->task_stack_sizes[TASK_DNS] = hev_config_get_misc_dns_stack_size ();
+    self->task_stack_watermark = hev_config_get_misc_task_stack_watermark ();
+
+    /* tasks only go back to a pool of their own stack size */
+    self->task_pool_size = hev_config_get_misc_task_pool_size ();
+    if (self->task_pool_size) {
+        self->task_pool = hev_malloc (sizeof (HevTask *) *
+                                      self->task_pool_size * TASK_TYPES);
+        if (!self->task_pool) {
+            LOG_E ("socks5 worker task pool");
+            goto exit;
+        }
+    }
+
+    res = hev_config_get_misc_udp_packet_pool_size ();
+    self->packet_pool = hev_packet_pool_new (res);
+    if (!self->packet_pool) {
+        LOG_E ("socks5 worker packet pool");
+        goto exit;
+    }
+
+    if (hev_config_get_dns_address ()) {
+        self->dns_forwarder = hev_dns_forwarder_new ();
+        if (!self->dns_forwarder) {
+            LOG_E ("socks5 worker dns forwarder");
+            goto exit;
+        }
+    }
+
+    res = hev_config_get_dns_cache_size ();
+    if (res > 0) {
+        self->dns_cache = hev_dns_cache_new (res);
+        if (!self->dns_cache) {
+            LOG_E ("socks5 worker dns cache");
+            goto exit;
+        }
+    }
+
+    if (self->dns_forwarder &&
+        hev_config_get_dns_mode () == HEV_CONFIG_DNS_MODE_EVENT) {
+        self->dns_relay = hev_dns_relay_new (self->dns_forwarder,
+                                             self->dns_cache);
+        if (!self->dns_relay) {
+            LOG_E ("socks5 worker dns relay");
+            goto exit;
+        }
+    }
+
+    if (hev_config_get_socks5_server ()->pool_size) {
+        self->conn_pool = hev_socks5_conn_pool_new ();
+        if (!self->conn_pool) {
+            LOG_E ("socks5 worker conn pool");
+            goto exit;
+        }
+    }
+
+    /* one prober per process, run by the main worker */
+    if (id == 0 && hev_config_get_socks5_server ()->health_interval) {
+        self->prober = hev_socks5_prober_new ();
+        if (!self->prober) {
+            LOG_E ("socks5 worker prober");
+            goto exit;
+        }
+    }
+
+    self->id = id;
+    self->is_main = id == 0;
     pthread_once (&key_once, pthread_key_creator);
     atomic_fetch_or (&self->tsync, SYNC_SEND);
 
@@ -644,11 +1510,77 @@ retry:
         hev_task_unref (self->task_udp);
     if (self->task_dns)
         hev_task_unref (self->task_dns);
+    if (self->task_dns_tcp)
+        hev_task_unref (self->task_dns_tcp);
+    if (self->task_timer)
+        hev_task_unref (self->task_timer);
+    if (self->task_park)
+        hev_task_unref (self->task_park);
+    if (self->timing_wheel)
+        hev_timing_wheel_destroy (self->timing_wheel);
+    if (self->conn_pool)
+        hev_socks5_conn_pool_destroy (self->conn_pool);
+    if (self->prober)
+        hev_socks5_prober_destroy (self->prober);
+    if (self->udp_set)
+        hev_addr_table_destroy (self->udp_set);
+    if (self->direct_udp_set)
+        hev_addr_table_destroy (self->direct_udp_set);
+    if (self->udp_dups)
+        LOG_I ("%p socks5 worker udp duplicate flows %lu", self,
+               self->udp_dups);
+    if (self->tcp_parks)
+        LOG_I ("%p socks5 worker tcp parked %lu resumed %lu", self,
+               self->tcp_parks, self->tcp_resumes);
+    if (self->task_stack_watermark)
+        LOG_I ("%p socks5 worker stack high-water tcp %zu/%d udp %zu/%d "
+               "dns %zu/%d",
+               self, self->task_stack_marks[TASK_TCP],
+               hev_socks5_worker_task_window (self, TASK_TCP),
+               self->task_stack_marks[TASK_UDP],
+               hev_socks5_worker_task_window (self, TASK_UDP),
+               self->task_stack_marks[TASK_DNS],
+               hev_socks5_worker_task_window (self, TASK_DNS));
+    if (self->task_pool) {
+        int i;
+
+        LOG_I ("%p socks5 worker tasks allocated %lu reused %lu", self,
+               self->task_allocs, self->task_reuses);
+        for (i = 0; i < TASK_TYPES; i++) {
+            HevTask **pool = &self->task_pool[i * self->task_pool_size];
+
+            while (self->task_pooled[i])
+                hev_task_unref (pool[--self->task_pooled[i]]);
+        }
+        hev_free (self->task_pool);
+    }
+    if (self->packet_pool)
+        hev_packet_pool_destroy (self->packet_pool);
+    if (self->dns_relay)
+        hev_dns_relay_destroy (self->dns_relay);
+    if (self->dns_cache)
+        hev_dns_cache_destroy (self->dns_cache);
+    if (self->dns_forwarder)
+        hev_dns_forwarder_destroy (self->dns_forwarder);
+
+    for (;;) {
+        HevListNode *node = hev_list_first (&self->dns_pool);
+        HevTProxySessionDNS *dns;
+
+        if (!node)
+            break;
+
+        dns = container_of (node, HevTProxySessionDNS, node);
+        hev_list_del (&self->dns_pool, node);
+        hev_object_unref (HEV_OBJECT (dns));
+    }
 
     if (self->event_fds[0] >= 0)
         close (self->event_fds[0]);
     if (self->event_fds[1] >= 0)
         close (self->event_fds[1]);
+    if (self->park_fd >= 0)
+        close (self->park_fd);
 
     hev_free (self);
     pthread_setspecific (key, NULL);
@@ -682,6 +1614,31 @@ hev_socks5_worker_start (HevSocks5Worker *self)
         hev_task_ref (self->task_dns);
         hev_task_run (self->task_dns, hev_socks5_dns_task_entry, self);
     }
+
+    if (self->task_dns_tcp) {
+        hev_task_ref (self->task_dns_tcp);
+        hev_task_run (self->task_dns_tcp, hev_socks5_dns_tcp_task_entry, self);
+    }
+
+    if (self->task_timer) {
+        hev_task_ref (self->task_timer);
+        hev_task_run (self->task_timer, hev_socks5_timer_task_entry, self);
+    }
+
+    if (self->task_park) {
+        hev_task_ref (self->task_park);
+        hev_task_run (self->task_park, hev_socks5_park_task_entry, self);
+    }
+
+    if (self->conn_pool)
+        hev_socks5_conn_pool_start (self->conn_pool);
+
+    if (self->prober)
+        hev_socks5_prober_start (self->prober);
+
+    /* in event mode the relay drives the forwarder from the dns task */
+    if (self->dns_forwarder && !self->dns_relay)
+        hev_dns_forwarder_start (self->dns_forwarder);
 }
 
 void
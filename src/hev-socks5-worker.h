@@ -12,7 +12,7 @@
 
 typedef struct _HevSocks5Worker HevSocks5Worker;
 
-HevSocks5Worker *hev_socks5_worker_new (int is_main);
+HevSocks5Worker *hev_socks5_worker_new (int id);
 void hev_socks5_worker_destroy (HevSocks5Worker *self);
 
 void hev_socks5_worker_start (HevSocks5Worker *self);
@@ -0,0 +1,294 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-splicer.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TCP Splicer
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-pipe.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-config.h"
+#include "hev-logger.h"
+
+#include "hev-tcp-splicer.h"
+
+#define COPY_BUF_SIZE (8192)
+
+typedef struct _HevTCPSplicer HevTCPSplicer;
+typedef struct _HevTCPSplicerPath HevTCPSplicerPath;
+
+struct _HevTCPSplicerPath
+{
+    int fd_i;
+    int fd_o;
+    int pfd[2];
+    size_t psize;
+    size_t pend;
+    size_t rpos;
+    size_t wpos;
+    unsigned char *buf;
+};
+
+struct _HevTCPSplicer
+{
+    HevTCPSplicerPath f;
+    HevTCPSplicerPath b;
+    size_t bytes;
+    size_t threshold;
+    int pipe_size;
+    int fallback;
+};
+
+static int
+hev_tcp_splicer_pipe (HevTCPSplicer *self, HevTCPSplicerPath *path)
+{
+    int res;
+
+    res = hev_task_io_pipe_pipe (path->pfd);
+    if (res < 0) {
+        path->pfd[0] = -1;
+        path->pfd[1] = -1;
+        return -1;
+    }
+
+    res = fcntl (path->pfd[1], F_SETPIPE_SZ, self->pipe_size);
+    if (res < 0) {
+        LOG_D ("%p tcp splicer pipe size", self);
+        res = fcntl (path->pfd[1], F_GETPIPE_SZ);
+        if (res <= 0)
+            res = 65536;
+    }
+    path->psize = res;
+
+    return 0;
+}
+
+static void
+hev_tcp_splicer_unpipe (HevTCPSplicerPath *path)
+{
+    if (path->pfd[0] < 0)
+        return;
+
+    close (path->pfd[0]);
+    close (path->pfd[1]);
+    path->pfd[0] = -1;
+    path->pfd[1] = -1;
+}
+
+static int
+hev_tcp_splicer_copy (HevTCPSplicer *self, HevTCPSplicerPath *path)
+{
+    ssize_t s;
+    int res = 0;
+
+    if (!path->buf) {
+        path->buf = hev_malloc (COPY_BUF_SIZE);
+        if (!path->buf)
+            return -1;
+    }
+
+    if (path->fd_i >= 0 && path->wpos < COPY_BUF_SIZE) {
+        s = read (path->fd_i, path->buf + path->wpos,
+                  COPY_BUF_SIZE - path->wpos);
+        if (s > 0) {
+            path->wpos += s;
+            res = 1;
+        } else if (s == 0) {
+            path->fd_i = -1;
+            res = 1;
+        } else if (errno != EAGAIN) {
+            return -1;
+        }
+    }
+
+    if (path->rpos < path->wpos) {
+        s = write (path->fd_o, path->buf + path->rpos,
+                   path->wpos - path->rpos);
+        if (s > 0) {
+            path->rpos += s;
+            self->bytes += s;
+            res = 1;
+            if (path->rpos == path->wpos) {
+                path->rpos = 0;
+                path->wpos = 0;
+            }
+        } else if (s < 0 && errno != EAGAIN) {
+            return -1;
+        }
+    }
+
+    if (path->fd_i < 0 && path->rpos == path->wpos) {
+        shutdown (path->fd_o, SHUT_WR);
+        return -1;
+    }
+
+    return res;
+}
+
+static int
+hev_tcp_splicer_kernel (HevTCPSplicer *self, HevTCPSplicerPath *path)
+{
+    ssize_t s;
+    int res = 0;
+
+    if (path->fd_i >= 0 && path->pend < path->psize) {
+        s = splice (path->fd_i, NULL, path->pfd[1], NULL,
+                    path->psize - path->pend,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (s > 0) {
+            path->pend += s;
+            res = 1;
+        } else if (s == 0) {
+            path->fd_i = -1;
+            res = 1;
+        } else if (errno != EAGAIN) {
+            if ((errno == EINVAL || errno == ENOSYS) && path->pend == 0) {
+                /* splice is not supported here, use the copying path */
+                LOG_D ("%p tcp splicer fallback", self);
+                hev_tcp_splicer_unpipe (path);
+                self->fallback = 1;
+                return 1;
+            }
+            return -1;
+        }
+    }
+
+    if (path->pend > 0) {
+        s = splice (path->pfd[0], NULL, path->fd_o, NULL, path->pend,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (s > 0) {
+            path->pend -= s;
+            self->bytes += s;
+            res = 1;
+        } else if (s == 0 || errno != EAGAIN) {
+            return -1;
+        }
+    }
+
+    if (path->fd_i < 0 && path->pend == 0) {
+        shutdown (path->fd_o, SHUT_WR);
+        return -1;
+    }
+
+    return res;
+}
+
+static int
+hev_tcp_splicer_step (HevTCPSplicer *self, HevTCPSplicerPath *path)
+{
+    if (path->pfd[0] < 0 && !self->fallback && path->rpos == path->wpos &&
+        self->bytes >= self->threshold) {
+        if (hev_tcp_splicer_pipe (self, path) < 0) {
+            LOG_D ("%p tcp splicer pipe", self);
+            self->fallback = 1;
+        }
+    }
+
+    if (path->pfd[0] >= 0)
+        return hev_tcp_splicer_kernel (self, path);
+
+    return hev_tcp_splicer_copy (self, path);
+}
+
+static void
+hev_tcp_splicer_path_init (HevTCPSplicerPath *path, int fd_i, int fd_o)
+{
+    path->fd_i = fd_i;
+    path->fd_o = fd_o;
+    path->pfd[0] = -1;
+    path->pfd[1] = -1;
+    path->psize = 0;
+    path->pend = 0;
+    path->rpos = 0;
+    path->wpos = 0;
+    path->buf = NULL;
+}
+
+static void
+hev_tcp_splicer_path_fini (HevTCPSplicerPath *path)
+{
+    hev_tcp_splicer_unpipe (path);
+
+    if (path->buf)
+        hev_free (path->buf);
+}
+
+static int
+hev_tcp_splicer_empty (HevTCPSplicerPath *path)
+{
+    return path->fd_i >= 0 && path->rpos == path->wpos && path->pend == 0;
+}
+
+int
+hev_tcp_splicer_splice (int fd_a, int fd_b, int idle,
+                        HevTaskIOYielder yielder, void *yielder_data)
+{
+    HevTask *task = hev_task_self ();
+    int res_f = 1, res_b = 1;
+    HevTCPSplicer self;
+    int parked = 0;
+
+    LOG_D ("%p tcp splicer splice", &self);
+
+    if (hev_task_mod_fd (task, fd_a, POLLIN | POLLOUT) < 0)
+        hev_task_add_fd (task, fd_a, POLLIN | POLLOUT);
+    if (hev_task_mod_fd (task, fd_b, POLLIN | POLLOUT) < 0)
+        hev_task_add_fd (task, fd_b, POLLIN | POLLOUT);
+
+    hev_tcp_splicer_path_init (&self.f, fd_a, fd_b);
+    hev_tcp_splicer_path_init (&self.b, fd_b, fd_a);
+    self.bytes = 0;
+    self.threshold = hev_config_get_misc_tcp_splice_threshold ();
+    self.pipe_size = hev_config_get_misc_tcp_splice_pipe_size ();
+    self.fallback = !hev_config_get_misc_tcp_kernel_splice ();
+
+    for (;;) {
+        HevTaskYieldType type;
+
+        if (res_f >= 0)
+            res_f = hev_tcp_splicer_step (&self, &self.f);
+        if (res_b >= 0)
+            res_b = hev_tcp_splicer_step (&self, &self.b);
+
+        if (res_f > 0 || res_b > 0)
+            type = HEV_TASK_YIELD;
+        else if ((res_f & res_b) == 0)
+            type = HEV_TASK_WAITIO;
+        else
+            break;
+
+        /* quiet in both directions, wait for the idle time at most */
+        if (idle > 0 && type == HEV_TASK_WAITIO && res_f == 0 && res_b == 0 &&
+            hev_tcp_splicer_empty (&self.f) &&
+            hev_tcp_splicer_empty (&self.b)) {
+            if (hev_task_sleep (idle) == 0) {
+                parked = 1;
+                break;
+            }
+            type = HEV_TASK_YIELD;
+        }
+
+        if (yielder) {
+            if (yielder (type, yielder_data))
+                break;
+        } else {
+            hev_task_yield (type);
+        }
+    }
+
+    hev_tcp_splicer_path_fini (&self.f);
+    hev_tcp_splicer_path_fini (&self.b);
+
+    return parked;
+}
@@ -0,0 +1,24 @@
+/*
+ ============================================================================
+ Name        : hev-tcp-splicer.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TCP Splicer
+ ============================================================================
+ */
+
+#ifndef __HEV_TCP_SPLICER_H__
+#define __HEV_TCP_SPLICER_H__
+
+#include <hev-task-io.h>
+
+/*
+ * Relay between the sockets until both directions are closed. With an
+ * idle time, it also returns once nothing was relayed for that long and
+ * no data is held in between, the sockets can be spliced again later.
+ * Returns 1 in that case, 0 otherwise.
+ */
+int hev_tcp_splicer_splice (int fd_a, int fd_b, int idle,
+                            HevTaskIOYielder yielder, void *yielder_data);
+
+#endif /* __HEV_TCP_SPLICER_H__ */
@@ -0,0 +1,221 @@
+/*
+ ============================================================================
+ Name        : hev-timing-wheel.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Timing Wheel
+ ============================================================================
+ */
+
+#include <string.h>
+
+#include <hev-task.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-logger.h"
+#include "hev-compiler.h"
+
+#include "hev-timing-wheel.h"
+
+#define TICK_MS (1000)
+#define SLOT_BITS (6)
+#define SLOT_NUM (1 << SLOT_BITS)
+#define SLOT_MASK (SLOT_NUM - 1)
+#define LEVEL_NUM (4)
+#define TICK_MAX ((1U << (SLOT_BITS * LEVEL_NUM)) - 1)
+
+struct _HevTimingWheel
+{
+    HevTask *task;
+    int run;
+    unsigned int now;
+    unsigned int count;
+    unsigned long reaped;
+
+    HevList slots[LEVEL_NUM][SLOT_NUM];
+};
+
+HevTimingWheel *
+hev_timing_wheel_new (void)
+{
+    HevTimingWheel *self;
+
+    self = hev_malloc0 (sizeof (HevTimingWheel));
+    if (!self)
+        return NULL;
+
+    LOG_D ("%p timing wheel new", self);
+
+    self->run = 1;
+
+    return self;
+}
+
+void
+hev_timing_wheel_destroy (HevTimingWheel *self)
+{
+    LOG_D ("%p timing wheel destroy", self);
+
+    if (self->reaped)
+        LOG_I ("%p timing wheel reaped %lu", self, self->reaped);
+
+    hev_free (self);
+}
+
+static void
+hev_timing_wheel_place (HevTimingWheel *self, HevTimingWheelEntry *entry)
+{
+    unsigned int delta = entry->expires - self->now;
+    unsigned int idx;
+    int level;
+
+    for (level = 0; level < LEVEL_NUM - 1; level++) {
+        if (delta < (1U << (SLOT_BITS * (level + 1))))
+            break;
+    }
+
+    idx = (entry->expires >> (SLOT_BITS * level)) & SLOT_MASK;
+    entry->slot = &self->slots[level][idx];
+    hev_list_add_tail (entry->slot, &entry->node);
+}
+
+static void
+hev_timing_wheel_cascade (HevTimingWheel *self, int level)
+{
+    unsigned int idx = (self->now >> (SLOT_BITS * level)) & SLOT_MASK;
+    HevList list = self->slots[level][idx];
+    HevListNode *node;
+
+    memset (&self->slots[level][idx], 0, sizeof (HevList));
+
+    node = hev_list_first (&list);
+    while (node) {
+        HevTimingWheelEntry *entry;
+
+        entry = container_of (node, HevTimingWheelEntry, node);
+        node = hev_list_node_next (node);
+        hev_timing_wheel_place (self, entry);
+    }
+}
+
+static unsigned int
+hev_timing_wheel_tick (HevTimingWheel *self)
+{
+    unsigned int reaped = 0;
+    HevListNode *node;
+    HevList list;
+    int level;
+
+    self->now++;
+
+    for (level = 1; level < LEVEL_NUM; level++) {
+        if ((self->now >> (SLOT_BITS * (level - 1))) & SLOT_MASK)
+            break;
+        hev_timing_wheel_cascade (self, level);
+    }
+
+    list = self->slots[0][self->now & SLOT_MASK];
+    memset (&self->slots[0][self->now & SLOT_MASK], 0, sizeof (HevList));
+
+    node = hev_list_first (&list);
+    while (node) {
+        HevTimingWheelEntry *entry;
+        unsigned int expires;
+
+        entry = container_of (node, HevTimingWheelEntry, node);
+        node = hev_list_node_next (node);
+
+        /* activity only moves the stamp, the entry is re-armed here */
+        expires = entry->stamp + entry->timeout;
+        if ((int)(expires - self->now) > 0) {
+            entry->expires = expires;
+            hev_timing_wheel_place (self, entry);
+            continue;
+        }
+
+        entry->slot = NULL;
+        self->count--;
+        reaped++;
+        hev_tproxy_session_terminate (entry->session);
+    }
+
+    return reaped;
+}
+
+void
+hev_timing_wheel_run (HevTimingWheel *self)
+{
+    int64_t base;
+
+    LOG_D ("%p timing wheel run", self);
+
+    self->task = hev_task_self ();
+    base = get_monotonic_ms () - (int64_t)self->now * TICK_MS;
+
+    while (READ_ONCE (self->run)) {
+        unsigned int reaped = 0;
+        unsigned int target;
+
+        hev_task_sleep (TICK_MS);
+
+        target = (get_monotonic_ms () - base) / TICK_MS;
+        while ((int)(target - self->now) > 0)
+            reaped += hev_timing_wheel_tick (self);
+
+        if (reaped) {
+            self->reaped += reaped;
+            LOG_D ("%p timing wheel reap %u of %u", self, reaped,
+                   self->count + reaped);
+        }
+    }
+
+    self->task = NULL;
+}
+
+void
+hev_timing_wheel_stop (HevTimingWheel *self)
+{
+    LOG_D ("%p timing wheel stop", self);
+
+    WRITE_ONCE (self->run, 0);
+    if (self->task)
+        hev_task_wakeup (self->task);
+}
+
+void
+hev_timing_wheel_add (HevTimingWheel *self, HevTimingWheelEntry *entry,
+                      HevTProxySession *session, int timeout)
+{
+    unsigned int ticks;
+
+    entry->slot = NULL;
+    entry->clock = NULL;
+    if (timeout <= 0)
+        return;
+
+    ticks = (timeout + TICK_MS - 1) / TICK_MS;
+    if (ticks > TICK_MAX)
+        ticks = TICK_MAX;
+
+    entry->session = session;
+    entry->clock = &self->now;
+    entry->stamp = self->now;
+    entry->timeout = ticks;
+    entry->expires = self->now + ticks;
+
+    hev_timing_wheel_place (self, entry);
+    self->count++;
+}
+
+void
+hev_timing_wheel_del (HevTimingWheel *self, HevTimingWheelEntry *entry)
+{
+    if (entry->slot) {
+        hev_list_del (entry->slot, &entry->node);
+        entry->slot = NULL;
+        self->count--;
+    }
+
+    entry->clock = NULL;
+}
@@ -0,0 +1,58 @@
+/*
+ ============================================================================
+ Name        : hev-timing-wheel.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Timing Wheel
+ ============================================================================
+ */
+
+#ifndef __HEV_TIMING_WHEEL_H__
+#define __HEV_TIMING_WHEEL_H__
+
+#include "hev-list.h"
+#include "hev-tproxy-session.h"
+
+typedef struct _HevTimingWheel HevTimingWheel;
+typedef struct _HevTimingWheelEntry HevTimingWheelEntry;
+
+struct _HevTimingWheelEntry
+{
+    HevListNode node;
+    HevList *slot;
+    HevTProxySession *session;
+    const unsigned int *clock;
+    unsigned int stamp;
+    unsigned int expires;
+    unsigned int timeout;
+};
+
+HevTimingWheel *hev_timing_wheel_new (void);
+void hev_timing_wheel_destroy (HevTimingWheel *self);
+
+/*
+ * Tick the wheel from the calling task until stopped. A session whose
+ * entry was not touched for its timeout is terminated.
+ */
+void hev_timing_wheel_run (HevTimingWheel *self);
+void hev_timing_wheel_stop (HevTimingWheel *self);
+
+/* A timeout of zero or less leaves the session to its own timers. */
+void hev_timing_wheel_add (HevTimingWheel *self, HevTimingWheelEntry *entry,
+                           HevTProxySession *session, int timeout);
+void hev_timing_wheel_del (HevTimingWheel *self, HevTimingWheelEntry *entry);
+
+static inline int
+hev_timing_wheel_active (HevTimingWheelEntry *entry)
+{
+    return !!entry->clock;
+}
+
+static inline void
+hev_timing_wheel_touch (HevTimingWheelEntry *entry)
+{
+    if (entry->clock)
+        entry->stamp = *entry->clock;
+}
+
+#endif /* __HEV_TIMING_WHEEL_H__ */
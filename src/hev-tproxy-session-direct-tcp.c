@@ -0,0 +1,211 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy-session-direct-tcp.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TProxy Session Direct TCP
+ ============================================================================
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-tcp-splicer.h"
+
+#include "hev-tproxy-session-direct-tcp.h"
+
+static int
+connect_yielder (HevTaskYieldType type, void *data)
+{
+    HevTProxySessionDirectTCP *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_task_yield (HEV_TASK_YIELD);
+        return self->timeout ? 0 : -1;
+    }
+
+    if (hev_task_sleep (hev_config_get_misc_connect_timeout ()) == 0)
+        return -1;
+
+    return self->timeout ? 0 : -1;
+}
+
+static int
+io_yielder (HevTaskYieldType type, void *data)
+{
+    HevTProxySessionDirectTCP *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_timing_wheel_touch (&self->timer);
+        hev_task_yield (HEV_TASK_YIELD);
+        return self->timeout ? 0 : -1;
+    }
+
+    if (hev_timing_wheel_active (&self->timer)) {
+        hev_task_yield (HEV_TASK_WAITIO);
+        return self->timeout ? 0 : -1;
+    }
+
+    if (hev_task_sleep (self->timeout) == 0)
+        return -1;
+
+    return self->timeout ? 0 : -1;
+}
+
+HevTProxySessionDirectTCP *
+hev_tproxy_session_direct_tcp_new (struct sockaddr_in6 *addr, int fd)
+{
+    HevTProxySessionDirectTCP *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevTProxySessionDirectTCP));
+    if (!self)
+        return NULL;
+
+    res = hev_tproxy_session_direct_tcp_construct (self, addr, fd);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p tproxy session direct tcp new", self);
+
+    return self;
+}
+
+static void
+hev_tproxy_session_direct_tcp_run (HevTProxySession *base)
+{
+    HevTProxySessionDirectTCP *self = HEV_TPROXY_SESSION_DIRECT_TCP (base);
+    unsigned int mark;
+    int res;
+    int fd;
+
+    LOG_D ("%p tproxy session direct tcp run", self);
+
+    fd = hev_task_io_socket_socket (AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0) {
+        LOG_I ("%p tproxy session direct tcp socket", self);
+        return;
+    }
+
+    mark = hev_config_get_bypass_mark ();
+    if (mark && set_sock_mark (fd, mark) < 0) {
+        LOG_I ("%p tproxy session direct tcp mark", self);
+        goto close;
+    }
+
+    hev_task_add_fd (self->task, fd, POLLIN | POLLOUT);
+    res = hev_task_io_socket_connect (fd, (struct sockaddr *)&self->addr,
+                                      sizeof (self->addr), connect_yielder,
+                                      self);
+    if (res < 0) {
+        LOG_I ("%p tproxy session direct tcp connect", self);
+        goto exit;
+    }
+
+    hev_tcp_splicer_splice (self->fd, fd, 0, io_yielder, self);
+    hev_task_del_fd (self->task, self->fd);
+
+exit:
+    hev_task_del_fd (self->task, fd);
+close:
+    close (fd);
+}
+
+static void
+hev_tproxy_session_direct_tcp_terminate (HevTProxySession *base)
+{
+    HevTProxySessionDirectTCP *self = HEV_TPROXY_SESSION_DIRECT_TCP (base);
+
+    LOG_D ("%p tproxy session direct tcp terminate", self);
+
+    self->timeout = 0;
+    hev_task_wakeup (self->task);
+}
+
+static void
+hev_tproxy_session_direct_tcp_set_task (HevTProxySession *base, HevTask *task)
+{
+    HevTProxySessionDirectTCP *self = HEV_TPROXY_SESSION_DIRECT_TCP (base);
+
+    self->task = task;
+}
+
+int
+hev_tproxy_session_direct_tcp_construct (HevTProxySessionDirectTCP *self,
+                                         struct sockaddr_in6 *addr, int fd)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return -1;
+
+    LOG_D ("%p tproxy session direct tcp construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_TPROXY_SESSION_DIRECT_TCP_TYPE;
+
+    memcpy (&self->addr, addr, sizeof (self->addr));
+    self->timeout = hev_config_get_misc_tcp_read_write_timeout ();
+    self->fd = fd;
+
+    return 0;
+}
+
+static void
+hev_tproxy_session_direct_tcp_destruct (HevObject *base)
+{
+    HevTProxySessionDirectTCP *self = HEV_TPROXY_SESSION_DIRECT_TCP (base);
+
+    LOG_D ("%p tproxy session direct tcp destruct", self);
+
+    if (self->fd >= 0)
+        close (self->fd);
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+static void *
+hev_tproxy_session_direct_tcp_iface (HevObject *base, void *type)
+{
+    HevTProxySessionDirectTCPClass *klass = HEV_OBJECT_GET_CLASS (base);
+
+    return &klass->session;
+}
+
+HevObjectClass *
+hev_tproxy_session_direct_tcp_class (void)
+{
+    static HevTProxySessionDirectTCPClass klass;
+    HevTProxySessionDirectTCPClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        HevTProxySessionIface *tiptr;
+
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevTProxySessionDirectTCP";
+        okptr->destruct = hev_tproxy_session_direct_tcp_destruct;
+        okptr->iface = hev_tproxy_session_direct_tcp_iface;
+
+        tiptr = &kptr->session;
+        memcpy (tiptr, HEV_TPROXY_SESSION_TYPE, sizeof (HevTProxySessionIface));
+        tiptr->runner = hev_tproxy_session_direct_tcp_run;
+        tiptr->terminator = hev_tproxy_session_direct_tcp_terminate;
+        tiptr->set_task = hev_tproxy_session_direct_tcp_set_task;
+    }
+
+    return okptr;
+}
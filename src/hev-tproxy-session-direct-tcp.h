@@ -0,0 +1,56 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy-session-direct-tcp.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TProxy Session Direct TCP
+ ============================================================================
+ */
+
+#ifndef __HEV_TPROXY_SESSION_DIRECT_TCP_H__
+#define __HEV_TPROXY_SESSION_DIRECT_TCP_H__
+
+#include <netinet/in.h>
+
+#include "hev-list.h"
+#include "hev-object.h"
+#include "hev-timing-wheel.h"
+#include "hev-tproxy-session.h"
+
+#define HEV_TPROXY_SESSION_DIRECT_TCP(p) ((HevTProxySessionDirectTCP *)p)
+#define HEV_TPROXY_SESSION_DIRECT_TCP_CLASS(p) \
+    ((HevTProxySessionDirectTCPClass *)p)
+#define HEV_TPROXY_SESSION_DIRECT_TCP_TYPE \
+    (hev_tproxy_session_direct_tcp_class ())
+
+typedef struct _HevTProxySessionDirectTCP HevTProxySessionDirectTCP;
+typedef struct _HevTProxySessionDirectTCPClass HevTProxySessionDirectTCPClass;
+
+struct _HevTProxySessionDirectTCP
+{
+    HevObject base;
+
+    int fd;
+    int timeout;
+    HevTask *task;
+    HevListNode node;
+    HevTimingWheelEntry timer;
+    struct sockaddr_in6 addr;
+};
+
+struct _HevTProxySessionDirectTCPClass
+{
+    HevObjectClass base;
+
+    HevTProxySessionIface session;
+};
+
+HevObjectClass *hev_tproxy_session_direct_tcp_class (void);
+
+int hev_tproxy_session_direct_tcp_construct (HevTProxySessionDirectTCP *self,
+                                             struct sockaddr_in6 *addr, int fd);
+
+HevTProxySessionDirectTCP *
+hev_tproxy_session_direct_tcp_new (struct sockaddr_in6 *addr, int fd);
+
+#endif /* __HEV_TPROXY_SESSION_DIRECT_TCP_H__ */
@@ -0,0 +1,382 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy-session-direct-udp.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TProxy Session Direct UDP
+ ============================================================================
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+#include "hev-config.h"
+#include "hev-logger.h"
+#include "hev-compiler.h"
+#include "hev-config-const.h"
+#include "hev-packet-pool.h"
+#include "hev-tsocks-cache.h"
+
+#include "hev-tproxy-session-direct-udp.h"
+
+typedef struct _HevTProxySessionDirectUDPFrame HevTProxySessionDirectUDPFrame;
+
+struct _HevTProxySessionDirectUDPFrame
+{
+    HevListNode node;
+    struct sockaddr_in6 addr;
+    void *data;
+    size_t len;
+};
+
+_Static_assert (sizeof (HevTProxySessionDirectUDPFrame) <=
+                    HEV_PACKET_POOL_HEADROOM,
+                "UDP frame must fit in the packet headroom");
+
+static int
+io_yielder (HevTaskYieldType type, void *data)
+{
+    HevTProxySessionDirectUDP *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_timing_wheel_touch (&self->timer);
+        hev_task_yield (HEV_TASK_YIELD);
+        return self->timeout ? 0 : -1;
+    }
+
+    if (hev_timing_wheel_active (&self->timer)) {
+        hev_task_yield (HEV_TASK_WAITIO);
+        return self->timeout ? 0 : -1;
+    }
+
+    if (hev_task_sleep (self->timeout) == 0)
+        return -1;
+
+    return self->timeout ? 0 : -1;
+}
+
+static int
+hev_tproxy_session_direct_udp_fwd_f (HevTProxySessionDirectUDP *self,
+                                     unsigned int num)
+{
+    HevTProxySessionDirectUDPFrame *frame;
+    struct mmsghdr msgv[num];
+    struct iovec iov[num];
+    HevListNode *node;
+    int i, res;
+
+    res = self->frames;
+    if (res <= 0)
+        return 0;
+
+    res = (res > num) ? num : res;
+    node = hev_list_first (&self->frame_list);
+    for (i = 0; i < res; i++) {
+        frame = container_of (node, HevTProxySessionDirectUDPFrame, node);
+        node = hev_list_node_next (node);
+
+        iov[i].iov_base = frame->data;
+        iov[i].iov_len = frame->len;
+        memset (&msgv[i].msg_hdr, 0, sizeof (msgv[i].msg_hdr));
+        msgv[i].msg_hdr.msg_name = &frame->addr;
+        msgv[i].msg_hdr.msg_namelen = sizeof (frame->addr);
+        msgv[i].msg_hdr.msg_iov = &iov[i];
+        msgv[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    res = sendmmsg (self->fd, msgv, res, 0);
+    if (res <= 0) {
+        if (res < 0 && errno == EAGAIN)
+            return 0;
+        /* an unroutable datagram is dropped, not the whole flow */
+        LOG_D ("%p tproxy session direct udp fwd f send", self);
+        res = 1;
+    }
+
+    for (i = 0; i < res; i++) {
+        node = hev_list_first (&self->frame_list);
+        frame = container_of (node, HevTProxySessionDirectUDPFrame, node);
+
+        hev_list_del (&self->frame_list, node);
+        hev_packet_pool_free (frame->data);
+        self->frames--;
+    }
+
+    return 1;
+}
+
+static int
+hev_tproxy_session_direct_udp_fwd_b (HevTProxySessionDirectUDP *self,
+                                     unsigned int num)
+{
+    char buf[UDP_BUF_SIZE * num];
+    struct sockaddr_in6 addrs[num];
+    struct mmsghdr smv[num];
+    struct iovec siov[num];
+    int i, res;
+    int s = 0;
+
+    for (i = 0; i < num; i++) {
+        siov[i].iov_base = buf + UDP_BUF_SIZE * i;
+        siov[i].iov_len = UDP_BUF_SIZE;
+        memset (&smv[i].msg_hdr, 0, sizeof (smv[i].msg_hdr));
+        smv[i].msg_hdr.msg_name = &addrs[i];
+        smv[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+        smv[i].msg_hdr.msg_iov = &siov[i];
+        smv[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    res = recvmmsg (self->fd, smv, num, 0, NULL);
+    if (res <= 0) {
+        if (res < 0 && errno == EAGAIN)
+            return 0;
+        LOG_D ("%p tproxy session direct udp fwd b recv", self);
+        return -1;
+    }
+
+    while (s < res) {
+        struct cmsghdr cmsg[HEV_TSOCKS_CACHE_CMSG_SIZE /
+                            sizeof (struct cmsghdr)];
+        struct sockaddr *saddr = (struct sockaddr *)&addrs[s];
+        struct mmsghdr dmv[res];
+        struct iovec iov[res];
+        size_t clen;
+        int fd, n, r;
+
+        /* replies from one peer go out on one transparent socket */
+        for (i = s, n = 0; i < res; i++) {
+            if (n > 0 && memcmp (&addrs[s], &addrs[i], sizeof (addrs[s])))
+                break;
+
+            memset (&dmv[n].msg_hdr, 0, sizeof (dmv[n].msg_hdr));
+            dmv[n].msg_hdr.msg_name = &self->addr;
+            dmv[n].msg_hdr.msg_namelen = sizeof (self->addr);
+            dmv[n].msg_hdr.msg_iov = &iov[n];
+            dmv[n].msg_hdr.msg_iovlen = 1;
+            iov[n].iov_base = siov[i].iov_base;
+            iov[n].iov_len = smv[i].msg_len;
+            n++;
+        }
+
+        fd = hev_tsocks_cache_get (saddr);
+        if (fd < 0) {
+            LOG_D ("%p tproxy session direct udp tsocks get", self);
+            return -1;
+        }
+
+        clen = hev_tsocks_cache_cmsg (saddr, cmsg);
+        for (i = 0; i < n; i++) {
+            dmv[i].msg_hdr.msg_control = clen ? cmsg : NULL;
+            dmv[i].msg_hdr.msg_controllen = clen;
+        }
+
+        r = hev_task_io_socket_sendmmsg (fd, dmv, n, MSG_WAITALL, NULL, NULL);
+        hev_tsocks_cache_put (saddr, fd);
+        if (r <= 0) {
+            LOG_D ("%p tproxy session direct udp fwd b send", self);
+            return -1;
+        }
+
+        s += n;
+    }
+
+    return 1;
+}
+
+HevTProxySessionDirectUDP *
+hev_tproxy_session_direct_udp_new (struct sockaddr *addr)
+{
+    HevTProxySessionDirectUDP *self;
+    int res;
+
+    self = hev_malloc0 (sizeof (HevTProxySessionDirectUDP));
+    if (!self)
+        return NULL;
+
+    res = hev_tproxy_session_direct_udp_construct (self, addr);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p tproxy session direct udp new", self);
+
+    return self;
+}
+
+int
+hev_tproxy_session_direct_udp_send (HevTProxySessionDirectUDP *self,
+                                    void *data, size_t len,
+                                    struct sockaddr *addr)
+{
+    HevTProxySessionDirectUDPFrame *frame;
+
+    if (self->frames > UDP_POOL_SIZE)
+        return -1;
+
+    frame = hev_packet_pool_headroom (data);
+    frame->len = len;
+    frame->data = data;
+    memset (&frame->node, 0, sizeof (frame->node));
+    memcpy (&frame->addr, addr, sizeof (frame->addr));
+
+    self->frames++;
+    hev_list_add_tail (&self->frame_list, &frame->node);
+    hev_task_wakeup (self->task);
+
+    return 0;
+}
+
+static void
+hev_tproxy_session_direct_udp_run (HevTProxySession *base)
+{
+    HevTProxySessionDirectUDP *self = HEV_TPROXY_SESSION_DIRECT_UDP (base);
+    int res_f = 1, res_b = 1;
+    unsigned int mark;
+    int num;
+
+    LOG_D ("%p tproxy session direct udp run", self);
+
+    self->fd = hev_task_io_socket_socket (AF_INET6, SOCK_DGRAM, 0);
+    if (self->fd < 0) {
+        LOG_I ("%p tproxy session direct udp socket", self);
+        return;
+    }
+
+    mark = hev_config_get_bypass_mark ();
+    if (mark && set_sock_mark (self->fd, mark) < 0) {
+        LOG_I ("%p tproxy session direct udp mark", self);
+        return;
+    }
+
+    num = hev_config_get_misc_udp_copy_buffer_nums ();
+    hev_task_add_fd (self->task, self->fd, POLLIN | POLLOUT);
+
+    for (;;) {
+        HevTaskYieldType type;
+
+        if (res_f >= 0)
+            res_f = hev_tproxy_session_direct_udp_fwd_f (self, num);
+        if (res_b >= 0)
+            res_b = hev_tproxy_session_direct_udp_fwd_b (self, num);
+
+        if (res_f > 0 || res_b > 0)
+            type = HEV_TASK_YIELD;
+        else if ((res_f & res_b) == 0)
+            type = HEV_TASK_WAITIO;
+        else
+            break;
+
+        if (io_yielder (type, self))
+            break;
+    }
+
+    hev_task_del_fd (self->task, self->fd);
+}
+
+static void
+hev_tproxy_session_direct_udp_terminate (HevTProxySession *base)
+{
+    HevTProxySessionDirectUDP *self = HEV_TPROXY_SESSION_DIRECT_UDP (base);
+
+    LOG_D ("%p tproxy session direct udp terminate", self);
+
+    self->timeout = 0;
+    hev_task_wakeup (self->task);
+}
+
+static void
+hev_tproxy_session_direct_udp_set_task (HevTProxySession *base, HevTask *task)
+{
+    HevTProxySessionDirectUDP *self = HEV_TPROXY_SESSION_DIRECT_UDP (base);
+
+    self->task = task;
+}
+
+int
+hev_tproxy_session_direct_udp_construct (HevTProxySessionDirectUDP *self,
+                                         struct sockaddr *addr)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return -1;
+
+    LOG_D ("%p tproxy session direct udp construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_TPROXY_SESSION_DIRECT_UDP_TYPE;
+
+    memcpy (&self->addr, addr, sizeof (self->addr));
+    self->timeout = hev_config_get_misc_udp_read_write_timeout ();
+    self->fd = -1;
+
+    return 0;
+}
+
+static void
+hev_tproxy_session_direct_udp_destruct (HevObject *base)
+{
+    HevTProxySessionDirectUDP *self = HEV_TPROXY_SESSION_DIRECT_UDP (base);
+    HevListNode *node;
+
+    LOG_D ("%p tproxy session direct udp destruct", self);
+
+    node = hev_list_first (&self->frame_list);
+    while (node) {
+        HevTProxySessionDirectUDPFrame *frame;
+
+        frame = container_of (node, HevTProxySessionDirectUDPFrame, node);
+        node = hev_list_node_next (node);
+        hev_packet_pool_free (frame->data);
+    }
+
+    if (self->fd >= 0)
+        close (self->fd);
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+static void *
+hev_tproxy_session_direct_udp_iface (HevObject *base, void *type)
+{
+    HevTProxySessionDirectUDPClass *klass = HEV_OBJECT_GET_CLASS (base);
+
+    return &klass->session;
+}
+
+HevObjectClass *
+hev_tproxy_session_direct_udp_class (void)
+{
+    static HevTProxySessionDirectUDPClass klass;
+    HevTProxySessionDirectUDPClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        HevTProxySessionIface *tiptr;
+
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevTProxySessionDirectUDP";
+        okptr->destruct = hev_tproxy_session_direct_udp_destruct;
+        okptr->iface = hev_tproxy_session_direct_udp_iface;
+
+        tiptr = &kptr->session;
+        memcpy (tiptr, HEV_TPROXY_SESSION_TYPE, sizeof (HevTProxySessionIface));
+        tiptr->runner = hev_tproxy_session_direct_udp_run;
+        tiptr->terminator = hev_tproxy_session_direct_udp_terminate;
+        tiptr->set_task = hev_tproxy_session_direct_udp_set_task;
+    }
+
+    return okptr;
+}
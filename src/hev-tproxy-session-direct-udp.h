@@ -0,0 +1,62 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy-session-direct-udp.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TProxy Session Direct UDP
+ ============================================================================
+ */
+
+#ifndef __HEV_TPROXY_SESSION_DIRECT_UDP_H__
+#define __HEV_TPROXY_SESSION_DIRECT_UDP_H__
+
+#include <netinet/in.h>
+
+#include "hev-list.h"
+#include "hev-object.h"
+#include "hev-timing-wheel.h"
+#include "hev-tproxy-session.h"
+
+#define HEV_TPROXY_SESSION_DIRECT_UDP(p) ((HevTProxySessionDirectUDP *)p)
+#define HEV_TPROXY_SESSION_DIRECT_UDP_CLASS(p) \
+    ((HevTProxySessionDirectUDPClass *)p)
+#define HEV_TPROXY_SESSION_DIRECT_UDP_TYPE \
+    (hev_tproxy_session_direct_udp_class ())
+
+typedef struct _HevTProxySessionDirectUDP HevTProxySessionDirectUDP;
+typedef struct _HevTProxySessionDirectUDPClass HevTProxySessionDirectUDPClass;
+
+struct _HevTProxySessionDirectUDP
+{
+    HevObject base;
+
+    int fd;
+    int timeout;
+    int frames;
+    HevTask *task;
+    HevList frame_list;
+    HevTimingWheelEntry timer;
+    struct sockaddr_in6 addr;
+};
+
+struct _HevTProxySessionDirectUDPClass
+{
+    HevObjectClass base;
+
+    HevTProxySessionIface session;
+};
+
+HevObjectClass *hev_tproxy_session_direct_udp_class (void);
+
+int hev_tproxy_session_direct_udp_construct (HevTProxySessionDirectUDP *self,
+                                             struct sockaddr *addr);
+
+HevTProxySessionDirectUDP *
+hev_tproxy_session_direct_udp_new (struct sockaddr *addr);
+
+/* Queue a datagram from the client, the data must come from a packet pool. */
+int hev_tproxy_session_direct_udp_send (HevTProxySessionDirectUDP *self,
+                                        void *data, size_t len,
+                                        struct sockaddr *addr);
+
+#endif /* __HEV_TPROXY_SESSION_DIRECT_UDP_H__ */
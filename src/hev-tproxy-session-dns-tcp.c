@@ -0,0 +1,491 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy-session-dns-tcp.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TProxy Session DNS over TCP
+ ============================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <hev-task.h>
+#include <hev-task-io.h>
+#include <hev-task-io-socket.h>
+#include <hev-memory-allocator.h>
+
+#include "hev-logger.h"
+#include "hev-compiler.h"
+#include "hev-dns-msg.h"
+#include "hev-fake-ip.h"
+#include "hev-config-const.h"
+#include "hev-socks5-preconnect.h"
+
+#include "hev-tproxy-session-dns-tcp.h"
+
+#define MSG_MAX (65535)
+#define RBUF_INIT (512)
+#define PIPELINE_MAX (16)
+
+typedef struct _HevTProxySessionDNSTCPQuery HevTProxySessionDNSTCPQuery;
+
+struct _HevTProxySessionDNSTCPQuery
+{
+    HevDNSQuery query;
+    HevTProxySessionDNSTCP *session;
+    HevListNode node;
+    int len;
+    int qlen;
+    unsigned char *buffer;
+};
+
+static int
+hev_tproxy_session_dns_tcp_wait (HevTProxySessionDNSTCP *self)
+{
+    if (hev_timing_wheel_active (&self->timer)) {
+        hev_task_yield (HEV_TASK_WAITIO);
+        return self->timeout ? 0 : -1;
+    }
+
+    if (hev_task_sleep (self->timeout) == 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+io_yielder (HevTaskYieldType type, void *data)
+{
+    HevTProxySessionDNSTCP *self = data;
+
+    if (type == HEV_TASK_YIELD) {
+        hev_timing_wheel_touch (&self->timer);
+        hev_task_yield (HEV_TASK_YIELD);
+        return 0;
+    }
+
+    return hev_tproxy_session_dns_tcp_wait (self);
+}
+
+HevTProxySessionDNSTCP *
+hev_tproxy_session_dns_tcp_new (int fd)
+{
+    HevTProxySessionDNSTCP *self;
+    int res;
+
+    self = hev_malloc (sizeof (HevTProxySessionDNSTCP));
+    if (!self)
+        return NULL;
+
+    memset (self, 0, sizeof (HevTProxySessionDNSTCP));
+
+    res = hev_tproxy_session_dns_tcp_construct (self, fd);
+    if (res < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    LOG_D ("%p tproxy session dns tcp new", self);
+
+    return self;
+}
+
+void
+hev_tproxy_session_dns_tcp_set_cache (HevTProxySessionDNSTCP *self,
+                                      HevDNSCache *cache)
+{
+    self->cache = cache;
+}
+
+void
+hev_tproxy_session_dns_tcp_set_forwarder (HevTProxySessionDNSTCP *self,
+                                          HevDNSForwarder *forwarder)
+{
+    self->forwarder = forwarder;
+}
+
+static void
+hev_tproxy_session_dns_tcp_done (HevDNSQuery *query, int len)
+{
+    HevTProxySessionDNSTCPQuery *q = query->data;
+    HevTProxySessionDNSTCP *self = q->session;
+
+    if (len > 0 && self->cache)
+        hev_dns_cache_insert (self->cache, query->buffer, len);
+
+    q->len = len;
+    hev_list_del (&self->queries, &q->node);
+    hev_list_add_tail (&self->replies, &q->node);
+    hev_task_wakeup (self->task);
+}
+
+/* the buffer starts at the size of a datagram and grows for big replies */
+static int
+hev_tproxy_session_dns_tcp_resize (HevDNSQuery *query, size_t size)
+{
+    HevTProxySessionDNSTCPQuery *q = query->data;
+    unsigned char *buffer;
+
+    if (size > MSG_MAX)
+        return -1;
+
+    buffer = hev_realloc (q->buffer, 2 + size);
+    if (!buffer)
+        return -1;
+
+    q->buffer = buffer;
+    query->buffer = buffer + 2;
+    query->size = size;
+
+    return 0;
+}
+
+static void
+hev_tproxy_session_dns_tcp_free (HevTProxySessionDNSTCPQuery *q)
+{
+    hev_free (q->buffer);
+    hev_free (q);
+}
+
+static void
+hev_tproxy_session_dns_tcp_query (HevTProxySessionDNSTCP *self,
+                                  const void *msg, size_t len)
+{
+    HevTProxySessionDNSTCPQuery *q;
+    size_t size;
+    int res;
+
+    q = hev_malloc (sizeof (HevTProxySessionDNSTCPQuery));
+    if (!q)
+        return;
+
+    size = (len > UDP_BUF_SIZE) ? len : UDP_BUF_SIZE;
+    q->buffer = hev_malloc (2 + size);
+    if (!q->buffer) {
+        hev_free (q);
+        return;
+    }
+
+    q->session = self;
+    q->qlen = len;
+    memcpy (q->buffer + 2, msg, len);
+    self->pending++;
+
+    res = hev_fake_ip_answer (q->buffer + 2, len, size);
+    if (res > 0) {
+        q->len = res;
+        hev_list_add_tail (&self->replies, &q->node);
+        return;
+    }
+
+    if (self->cache) {
+        HevDNSKey refresh;
+
+        res = hev_dns_cache_lookup (self->cache, q->buffer + 2, len, size, 1,
+                                    &refresh);
+        if (res > 0) {
+            if (refresh.len)
+                hev_dns_forwarder_refresh (self->forwarder, self->cache,
+                                           &refresh);
+            q->len = res;
+            hev_list_add_tail (&self->replies, &q->node);
+            return;
+        }
+    }
+
+    memset (&q->query, 0, sizeof (HevDNSQuery));
+    q->query.done = hev_tproxy_session_dns_tcp_done;
+    q->query.data = q;
+    q->query.buffer = q->buffer + 2;
+    q->query.len = len;
+    q->query.size = size;
+    q->query.resize = hev_tproxy_session_dns_tcp_resize;
+    q->query.stream = 1;
+
+    hev_list_add_tail (&self->queries, &q->node);
+    if (hev_dns_forwarder_submit (self->forwarder, &q->query) < 0) {
+        hev_list_del (&self->queries, &q->node);
+        q->len = -1;
+        hev_list_add_tail (&self->replies, &q->node);
+    }
+}
+
+static int
+hev_tproxy_session_dns_tcp_reply (HevTProxySessionDNSTCP *self)
+{
+    HevListNode *node;
+
+    while ((node = hev_list_first (&self->replies))) {
+        HevTProxySessionDNSTCPQuery *q;
+        unsigned char *buf;
+        size_t len;
+        int res = 0;
+
+        q = container_of (node, HevTProxySessionDNSTCPQuery, node);
+        hev_list_del (&self->replies, node);
+        self->pending--;
+
+        /* RFC 7766: a pipelining client waits for every answer */
+        if (q->len <= 0)
+            q->len = hev_dns_msg_error (q->buffer + 2, q->qlen,
+                                        HEV_DNS_RCODE_SERVFAIL);
+
+        buf = q->buffer;
+        len = q->len > 0 ? q->len + 2 : 0;
+        hev_dns_msg_set16 (buf, q->len);
+
+        while (len) {
+            ssize_t s;
+
+            s = hev_task_io_socket_send (self->fd, buf, len, MSG_NOSIGNAL,
+                                         io_yielder, self);
+            if (s <= 0) {
+                res = -1;
+                break;
+            }
+
+            buf += s;
+            len -= s;
+        }
+
+        if (!res && q->len > 0)
+            hev_socks5_preconnect_answer (q->buffer + 2, q->len);
+
+        hev_tproxy_session_dns_tcp_free (q);
+        if (res < 0)
+            return -1;
+
+        hev_timing_wheel_touch (&self->timer);
+    }
+
+    return 0;
+}
+
+static int
+hev_tproxy_session_dns_tcp_parse (HevTProxySessionDNSTCP *self)
+{
+    size_t off = 0;
+    int count = 0;
+
+    while (self->pending < PIPELINE_MAX) {
+        size_t len;
+
+        if (self->rlen - off < 2)
+            break;
+
+        len = hev_dns_msg_get16 (self->rbuf + off) + 2;
+        if (self->rlen - off < len)
+            break;
+
+        if (len - 2 >= HEV_DNS_MSG_HDR_SIZE)
+            hev_tproxy_session_dns_tcp_query (self, self->rbuf + off + 2,
+                                              len - 2);
+        off += len;
+        count++;
+    }
+
+    if (off) {
+        self->rlen -= off;
+        memmove (self->rbuf, self->rbuf + off, self->rlen);
+    }
+
+    return count;
+}
+
+static int
+hev_tproxy_session_dns_tcp_read (HevTProxySessionDNSTCP *self)
+{
+    int busy = 0;
+
+    for (;;) {
+        unsigned int need = self->rcap;
+        ssize_t res;
+
+        busy |= hev_tproxy_session_dns_tcp_parse (self);
+        if (self->pending >= PIPELINE_MAX)
+            break;
+
+        /* grow the read buffer only for a message that does not fit */
+        if (self->rlen >= 2)
+            need = hev_dns_msg_get16 (self->rbuf) + 2;
+        if (need > self->rcap) {
+            unsigned char *rbuf;
+
+            rbuf = hev_realloc (self->rbuf, need);
+            if (!rbuf)
+                return -1;
+
+            self->rbuf = rbuf;
+            self->rcap = need;
+        }
+
+        res = recv (self->fd, self->rbuf + self->rlen,
+                    self->rcap - self->rlen, 0);
+        if (res == 0 || (res < 0 && errno != EAGAIN))
+            return -1;
+        if (res < 0)
+            break;
+
+        self->rlen += res;
+        busy = 1;
+    }
+
+    return busy;
+}
+
+static void
+hev_tproxy_session_dns_tcp_run (HevTProxySession *base)
+{
+    HevTProxySessionDNSTCP *self = HEV_TPROXY_SESSION_DNS_TCP (base);
+    HevListNode *node;
+    int eof = 0;
+
+    LOG_D ("%p tproxy session dns tcp run", self);
+
+    hev_task_add_fd (self->task, self->fd, POLLIN | POLLOUT);
+
+    /* RFC 7766: queries are pipelined and answered as they complete */
+    while (self->timeout) {
+        int busy = 0;
+
+        if (hev_tproxy_session_dns_tcp_reply (self) < 0)
+            break;
+
+        if (!eof) {
+            int res = hev_tproxy_session_dns_tcp_read (self);
+
+            if (res < 0)
+                eof = 1;
+            busy = res > 0;
+        }
+
+        if (busy) {
+            hev_timing_wheel_touch (&self->timer);
+            continue;
+        }
+
+        if (eof && !self->pending)
+            break;
+
+        if (hev_list_first (&self->replies))
+            continue;
+
+        if (hev_tproxy_session_dns_tcp_wait (self) < 0)
+            break;
+    }
+
+    while ((node = hev_list_first (&self->queries))) {
+        HevTProxySessionDNSTCPQuery *q;
+
+        q = container_of (node, HevTProxySessionDNSTCPQuery, node);
+        hev_dns_forwarder_cancel (self->forwarder, &q->query);
+        hev_list_del (&self->queries, node);
+        hev_tproxy_session_dns_tcp_free (q);
+    }
+
+    while ((node = hev_list_first (&self->replies))) {
+        HevTProxySessionDNSTCPQuery *q;
+
+        q = container_of (node, HevTProxySessionDNSTCPQuery, node);
+        hev_list_del (&self->replies, node);
+        hev_tproxy_session_dns_tcp_free (q);
+    }
+
+    hev_task_del_fd (self->task, self->fd);
+}
+
+static void
+hev_tproxy_session_dns_tcp_terminate (HevTProxySession *base)
+{
+    HevTProxySessionDNSTCP *self = HEV_TPROXY_SESSION_DNS_TCP (base);
+
+    LOG_D ("%p tproxy session dns tcp terminate", self);
+
+    self->timeout = 0;
+    hev_task_wakeup (self->task);
+}
+
+static void
+hev_tproxy_session_dns_tcp_set_task (HevTProxySession *base, HevTask *task)
+{
+    HevTProxySessionDNSTCP *self = HEV_TPROXY_SESSION_DNS_TCP (base);
+
+    self->task = task;
+}
+
+int
+hev_tproxy_session_dns_tcp_construct (HevTProxySessionDNSTCP *self, int fd)
+{
+    int res;
+
+    res = hev_object_construct (&self->base);
+    if (res < 0)
+        return -1;
+
+    LOG_D ("%p tproxy session dns tcp construct", self);
+
+    HEV_OBJECT (self)->klass = HEV_TPROXY_SESSION_DNS_TCP_TYPE;
+
+    self->rbuf = hev_malloc (RBUF_INIT);
+    if (!self->rbuf)
+        return -1;
+
+    self->fd = fd;
+    self->rcap = RBUF_INIT;
+    self->timeout = 10000;
+
+    return 0;
+}
+
+static void
+hev_tproxy_session_dns_tcp_destruct (HevObject *base)
+{
+    HevTProxySessionDNSTCP *self = HEV_TPROXY_SESSION_DNS_TCP (base);
+
+    LOG_D ("%p tproxy session dns tcp destruct", self);
+
+    if (self->fd >= 0)
+        close (self->fd);
+    if (self->rbuf)
+        hev_free (self->rbuf);
+
+    HEV_OBJECT_TYPE->destruct (base);
+    hev_free (base);
+}
+
+static void *
+hev_tproxy_session_dns_tcp_iface (HevObject *base, void *type)
+{
+    HevTProxySessionDNSTCPClass *klass = HEV_OBJECT_GET_CLASS (base);
+
+    return &klass->session;
+}
+
+HevObjectClass *
+hev_tproxy_session_dns_tcp_class (void)
+{
+    static HevTProxySessionDNSTCPClass klass;
+    HevTProxySessionDNSTCPClass *kptr = &klass;
+    HevObjectClass *okptr = HEV_OBJECT_CLASS (kptr);
+
+    if (!okptr->name) {
+        HevTProxySessionIface *tiptr;
+
+        memcpy (kptr, HEV_OBJECT_TYPE, sizeof (HevObjectClass));
+
+        okptr->name = "HevTProxySessionDNSTCP";
+        okptr->destruct = hev_tproxy_session_dns_tcp_destruct;
+        okptr->iface = hev_tproxy_session_dns_tcp_iface;
+
+        tiptr = &kptr->session;
+        memcpy (tiptr, HEV_TPROXY_SESSION_TYPE, sizeof (HevTProxySessionIface));
+        tiptr->runner = hev_tproxy_session_dns_tcp_run;
+        tiptr->terminator = hev_tproxy_session_dns_tcp_terminate;
+        tiptr->set_task = hev_tproxy_session_dns_tcp_set_task;
+    }
+
+    return okptr;
+}
@@ -0,0 +1,65 @@
+/*
+ ============================================================================
+ Name        : hev-tproxy-session-dns-tcp.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : TProxy Session DNS over TCP
+ ============================================================================
+ */
+
+#ifndef __HEV_TPROXY_SESSION_DNS_TCP_H__
+#define __HEV_TPROXY_SESSION_DNS_TCP_H__
+
+#include "hev-list.h"
+#include "hev-object.h"
+#include "hev-dns-cache.h"
+#include "hev-dns-forwarder.h"
+#include "hev-timing-wheel.h"
+#include "hev-tproxy-session.h"
+
+#define HEV_TPROXY_SESSION_DNS_TCP(p) ((HevTProxySessionDNSTCP *)p)
+#define HEV_TPROXY_SESSION_DNS_TCP_CLASS(p) ((HevTProxySessionDNSTCPClass *)p)
+#define HEV_TPROXY_SESSION_DNS_TCP_TYPE (hev_tproxy_session_dns_tcp_class ())
+
+typedef struct _HevTProxySessionDNSTCP HevTProxySessionDNSTCP;
+typedef struct _HevTProxySessionDNSTCPClass HevTProxySessionDNSTCPClass;
+
+struct _HevTProxySessionDNSTCP
+{
+    HevObject base;
+
+    int fd;
+    HevTask *task;
+    HevDNSCache *cache;
+    HevDNSForwarder *forwarder;
+    HevListNode node;
+    HevTimingWheelEntry timer;
+    HevList queries;
+    HevList replies;
+    unsigned int pending;
+    unsigned int timeout;
+    unsigned int rlen;
+    unsigned int rcap;
+    unsigned char *rbuf;
+};
+
+struct _HevTProxySessionDNSTCPClass
+{
+    HevObjectClass base;
+
+    HevTProxySessionIface session;
+};
+
+HevObjectClass *hev_tproxy_session_dns_tcp_class (void);
+
+int hev_tproxy_session_dns_tcp_construct (HevTProxySessionDNSTCP *self,
+                                          int fd);
+
+HevTProxySessionDNSTCP *hev_tproxy_session_dns_tcp_new (int fd);
+
+void hev_tproxy_session_dns_tcp_set_cache (HevTProxySessionDNSTCP *self,
+                                           HevDNSCache *cache);
+void hev_tproxy_session_dns_tcp_set_forwarder (HevTProxySessionDNSTCP *self,
+                                               HevDNSForwarder *forwarder);
+
+#endif /* __HEV_TPROXY_SESSION_DNS_TCP_H__ */
@@ -2,26 +2,22 @@
  ============================================================================
  Name        : hev-tproxy-session-dns.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 - 2024 hev
+ Copyright   : Copyright (c) 2021 - 2025 hev
  Description : TProxy Session DNS
  ============================================================================
  */
 
 #include <string.h>
-#include <unistd.h>
-#include <arpa/inet.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
-#include <hev-task-io-socket.h>
 #include <hev-memory-allocator.h>
 
-#include "hev-utils.h"
 #include "hev-logger.h"
-#include "hev-config.h"
 #include "hev-compiler.h"
 #include "hev-config-const.h"
 #include "hev-tsocks-cache.h"
+#include "hev-socks5-preconnect.h"
 
 #include "hev-tproxy-session-dns.h"
 
@@ -35,6 +31,11 @@ io_yielder (HevTaskYieldType type, void *data)
         return 0;
     }
 
+    if (hev_timing_wheel_active (&self->timer)) {
+        hev_task_yield (HEV_TASK_WAITIO);
+        return self->timeout ? 0 : -1;
+    }
+
     if (hev_task_sleep (self->timeout) == 0)
         return -1;
 
@@ -65,6 +66,54 @@ hev_tproxy_session_dns_set_size (HevTProxySessionDNS *self, unsigned size)
     self->size = size;
 }
 
+void
+hev_tproxy_session_dns_set_cache (HevTProxySessionDNS *self,
+                                  HevDNSCache *cache)
+{
+    self->cache = cache;
+}
+
+void
+hev_tproxy_session_dns_set_forwarder (HevTProxySessionDNS *self,
+                                      HevDNSForwarder *forwarder)
+{
+    self->forwarder = forwarder;
+}
+
+void
+hev_tproxy_session_dns_reply (HevTProxySessionDNS *self, unsigned size)
+{
+    struct cmsghdr cmsg[HEV_TSOCKS_CACHE_CMSG_SIZE / sizeof (struct cmsghdr)];
+    struct sockaddr *sap;
+    struct sockaddr *dap;
+    struct msghdr mh;
+    struct iovec iov;
+    int tfd;
+
+    sap = (struct sockaddr *)&self->saddr;
+    dap = (struct sockaddr *)&self->daddr;
+
+    tfd = hev_tsocks_cache_get (dap);
+    if (tfd < 0)
+        return;
+
+    iov.iov_base = self->buffer;
+    iov.iov_len = size;
+    memset (&mh, 0, sizeof (mh));
+    mh.msg_name = sap;
+    mh.msg_namelen = sizeof (self->saddr);
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_controllen = hev_tsocks_cache_cmsg (dap, cmsg);
+    if (mh.msg_controllen)
+        mh.msg_control = cmsg;
+
+    sendmsg (tfd, &mh, 0);
+    hev_tsocks_cache_put (dap, tfd);
+
+    hev_socks5_preconnect_answer (self->buffer, size);
+}
+
 HevTProxySessionDNS *
 hev_tproxy_session_dns_new (void)
 {
@@ -88,128 +137,34 @@ hev_tproxy_session_dns_new (void)
     return self;
 }
 
-static int
-hev_tproxy_session_dns_parse_ipv4 (const char *addr, struct sockaddr_in6 *saddr)
-{
-    int res;
-
-    res = inet_pton (AF_INET, addr, &saddr->sin6_addr.s6_addr[12]);
-    if (res == 0)
-        return -1;
-
-    saddr->sin6_addr.s6_addr[10] = 0xff;
-    saddr->sin6_addr.s6_addr[11] = 0xff;
-
-    return 0;
-}
-
-static int
-hev_tproxy_session_dns_parse_ipv6 (const char *addr, struct sockaddr_in6 *saddr)
-{
-    int res;
-
-    res = inet_pton (AF_INET6, addr, &saddr->sin6_addr);
-    if (res == 0)
-        return -1;
-
-    return 0;
-}
-
-static int
-hev_tproxy_session_dns_parse_ip (const char *addr, int port,
-                                 struct sockaddr_in6 *saddr)
-{
-    int res;
-
-    saddr->sin6_family = AF_INET6;
-    saddr->sin6_port = htons (port);
-
-    res = hev_tproxy_session_dns_parse_ipv4 (addr, saddr);
-    if (res == 0)
-        return 0;
-
-    res = hev_tproxy_session_dns_parse_ipv6 (addr, saddr);
-    if (res == 0)
-        return 0;
-
-    return -1;
-}
-
-static int
-hev_tproxy_session_dns_bind (HevTProxySessionDNS *self, int fd)
+void
+hev_tproxy_session_dns_reset (HevTProxySessionDNS *self)
 {
-    HevConfigServer *srv;
-
-    LOG_D ("%p tproxy session dns bind", self);
-
-    srv = hev_config_get_socks5_server ();
-
-    if (srv->mark) {
-        int res;
-
-        res = set_sock_mark (fd, srv->mark);
-        if (res < 0)
-            return -1;
-    }
-
-    set_sock_tcp_fastopen (fd, srv->fastopen);
-
-    return 0;
+    self->task = NULL;
+    self->cache = NULL;
+    self->forwarder = NULL;
+    self->size = 0;
+    self->timeout = 10000;
 }
 
 static void
 hev_tproxy_session_dns_run (HevTProxySession *base)
 {
     HevTProxySessionDNS *self = HEV_TPROXY_SESSION_DNS (base);
-    static struct sockaddr_in6 addr;
-    struct sockaddr *sap;
-    struct sockaddr *dap;
     int res;
-    int tfd;
-    int fd;
 
     LOG_D ("tproxy session dns run");
 
-    fd = hev_task_io_socket_socket (AF_INET6, SOCK_DGRAM, 0);
-    if (fd < 0)
-        return;
-
-    hev_task_add_fd (hev_task_self (), fd, POLLIN | POLLOUT);
-
-    if (addr.sin6_family == 0) {
-        const char *upstream;
-
-        upstream = hev_config_get_dns_upstream ();
-        hev_tproxy_session_dns_parse_ip (upstream, 53, &addr);
-    }
-
-    res = hev_tproxy_session_dns_bind (self, fd);
-    if (res < 0)
-        goto exit;
-
-    res = hev_task_io_socket_sendto (fd, self->buffer, self->size, 0,
-                                     (struct sockaddr *)&addr, sizeof (addr),
-                                     io_yielder, self);
-    if (res <= 0)
-        goto exit;
-
-    res = hev_task_io_socket_recvfrom (fd, self->buffer, UDP_BUF_SIZE, 0, NULL,
-                                       NULL, io_yielder, self);
+    res = hev_dns_forwarder_exchange (self->forwarder, self->buffer,
+                                      self->size, UDP_BUF_SIZE, io_yielder,
+                                      self);
     if (res <= 0)
-        goto exit;
-
-    sap = (struct sockaddr *)&self->saddr;
-    dap = (struct sockaddr *)&self->daddr;
-
-    tfd = hev_tsocks_cache_get (dap);
-    if (tfd < 0)
-        goto exit;
+        return;
 
-    sendto (tfd, self->buffer, res, 0, sap, sizeof (self->saddr));
-    hev_tsocks_cache_put (tfd);
+    if (self->cache)
+        hev_dns_cache_insert (self->cache, self->buffer, res);
 
-exit:
-    close (fd);
+    hev_tproxy_session_dns_reply (self, res);
 }
 
 static void
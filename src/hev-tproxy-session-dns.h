@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-tproxy-session-dns.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2021 hev
+ Copyright   : Copyright (c) 2021 - 2025 hev
  Description : TProxy Session DNS
  ============================================================================
  */
@@ -14,6 +14,9 @@
 
 #include "hev-list.h"
 #include "hev-object.h"
+#include "hev-dns-cache.h"
+#include "hev-dns-forwarder.h"
+#include "hev-timing-wheel.h"
 #include "hev-tproxy-session.h"
 
 #define HEV_TPROXY_SESSION_DNS(p) ((HevTProxySessionDNS *)p)
@@ -28,7 +31,10 @@ struct _HevTProxySessionDNS
     HevObject base;
 
     HevTask *task;
+    HevDNSCache *cache;
+    HevDNSForwarder *forwarder;
     HevListNode node;
+    HevTimingWheelEntry timer;
     unsigned int size;
     unsigned int timeout;
     struct sockaddr_in6 saddr;
@@ -48,11 +54,18 @@ HevObjectClass *hev_tproxy_session_dns_class (void);
 int hev_tproxy_session_dns_construct (HevTProxySessionDNS *self);
 
 HevTProxySessionDNS *hev_tproxy_session_dns_new (void);
+void hev_tproxy_session_dns_reset (HevTProxySessionDNS *self);
 
 struct sockaddr *hev_tproxy_session_dns_get_saddr (HevTProxySessionDNS *self);
 struct sockaddr *hev_tproxy_session_dns_get_daddr (HevTProxySessionDNS *self);
 
 void *hev_tproxy_session_dns_get_buffer (HevTProxySessionDNS *self);
 void hev_tproxy_session_dns_set_size (HevTProxySessionDNS *self, unsigned size);
+void hev_tproxy_session_dns_set_cache (HevTProxySessionDNS *self,
+                                       HevDNSCache *cache);
+void hev_tproxy_session_dns_set_forwarder (HevTProxySessionDNS *self,
+                                           HevDNSForwarder *forwarder);
+
+void hev_tproxy_session_dns_reply (HevTProxySessionDNS *self, unsigned size);
 
 #endif /* __HEV_TPROXY_SESSION_DNS_H__ */
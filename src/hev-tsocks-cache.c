@@ -2,44 +2,62 @@
  ============================================================================
  Name        : hev-tsocks-cache.c
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2017 - 2021 hev
+ Copyright   : Copyright (c) 2017 - 2025 hev
  Description : Transparent Socket Cache
  ============================================================================
  */
 
+#define _GNU_SOURCE
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/socket.h>
 
 #include <hev-task.h>
 #include <hev-task-io.h>
 #include <hev-task-io-socket.h>
 #include <hev-memory-allocator.h>
 
-#include "hev-list.h"
-#include "hev-rbtree.h"
+#include "hev-config.h"
 #include "hev-logger.h"
 #include "hev-compiler.h"
-#include "hev-config-const.h"
+#include "hev-addr-table.h"
 
 #include "hev-tsocks-cache.h"
 
 typedef struct _HevTSock HevTSock;
+typedef struct _HevTSocksCache HevTSocksCache;
 
 struct _HevTSock
 {
-    HevListNode lnode;
-    HevRBTreeNode rnode;
-
     struct sockaddr_in6 addr;
+    unsigned int refs;
+    unsigned char used;
     int fd;
 };
 
-static int cached;
-static HevList lru;
-static HevRBTree cache;
-static pthread_rwlock_t rwlock;
-static pthread_spinlock_t spinlock;
+struct _HevTSocksCache
+{
+    HevTSocksCache *next;
+    HevAddrTable *table;
+    HevTSock **ring;
+    unsigned int size;
+    unsigned int count;
+    unsigned int hand;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evicts;
+};
+
+_Static_assert (CMSG_SPACE (sizeof (struct in6_pktinfo)) <=
+                    HEV_TSOCKS_CACHE_CMSG_SIZE,
+                "tsocks cmsg buffer too small");
+
+static pthread_key_t key;
+static pthread_mutex_t mutex;
+static HevTSocksCache *caches;
+static int pktinfo;
 
 int
 hev_tsocks_cache_init (void)
@@ -48,19 +66,20 @@ hev_tsocks_cache_init (void)
 
     LOG_D ("tsocks cache init");
 
-    cached = 0;
-    memset (&lru, 0, sizeof (lru));
-    memset (&cache, 0, sizeof (cache));
+    caches = NULL;
+    pktinfo = hev_config_get_misc_udp_reply_mode () ==
+              HEV_CONFIG_UDP_REPLY_PKTINFO;
 
-    res = pthread_rwlock_init (&rwlock, NULL);
-    if (res < 0) {
-        LOG_E ("tsocks rwlock init");
+    res = pthread_key_create (&key, NULL);
+    if (res != 0) {
+        LOG_E ("tsocks key create");
         return -1;
     }
 
-    res = pthread_spin_init (&spinlock, PTHREAD_PROCESS_PRIVATE);
-    if (res < 0) {
-        LOG_E ("tsocks spinlock init");
+    res = pthread_mutex_init (&mutex, NULL);
+    if (res != 0) {
+        LOG_E ("tsocks mutex init");
+        pthread_key_delete (key);
         return -1;
     }
 
@@ -95,7 +114,7 @@ hev_tsocks_cache_tsock_new (struct sockaddr *addr)
         goto close;
 
     self = hev_malloc0 (sizeof (HevTSock));
-    if (res < 0)
+    if (!self)
         goto close;
 
     LOG_D ("%p tsocks cache tsock new", self);
@@ -119,139 +138,241 @@ hev_tsocks_cache_tsock_destroy (HevTSock *self)
     hev_free (self);
 }
 
+static HevTSocksCache *
+hev_tsocks_cache_new (void)
+{
+    HevTSocksCache *self;
+
+    self = hev_malloc0 (sizeof (HevTSocksCache));
+    if (!self)
+        return NULL;
+
+    self->size = hev_config_get_misc_tsocks_cache_size ();
+    if (!self->size)
+        self->size = 1;
+
+    self->ring = hev_malloc0 (sizeof (HevTSock *) * self->size);
+    if (!self->ring)
+        goto free;
+
+    self->table = hev_addr_table_new (self->size);
+    if (!self->table)
+        goto free_ring;
+
+    LOG_D ("%p tsocks cache new", self);
+
+    pthread_mutex_lock (&mutex);
+    self->next = caches;
+    caches = self;
+    pthread_mutex_unlock (&mutex);
+
+    return self;
+
+free_ring:
+    hev_free (self->ring);
+free:
+    hev_free (self);
+    return NULL;
+}
+
+static void
+hev_tsocks_cache_destroy (HevTSocksCache *self)
+{
+    unsigned int i;
+
+    LOG_D ("%p tsocks cache destroy", self);
+    LOG_I ("%p tsocks cache hits %lu misses %lu evicts %lu", self, self->hits,
+           self->misses, self->evicts);
+
+    for (i = 0; i < self->count; i++)
+        hev_tsocks_cache_tsock_destroy (self->ring[i]);
+
+    hev_addr_table_destroy (self->table);
+    hev_free (self->ring);
+    hev_free (self);
+}
+
 void
 hev_tsocks_cache_fini (void)
 {
-    HevListNode *node;
+    HevTSocksCache *cache = caches;
 
     LOG_D ("tsocks cache fini");
 
-    node = hev_list_first (&lru);
-    while (node) {
-        HevTSock *ts;
+    while (cache) {
+        HevTSocksCache *next = cache->next;
 
-        ts = container_of (node, HevTSock, lnode);
-        node = hev_list_node_next (node);
-        hev_tsocks_cache_tsock_destroy (ts);
+        hev_tsocks_cache_destroy (cache);
+        cache = next;
     }
 
-    pthread_rwlock_destroy (&rwlock);
-    pthread_spin_destroy (&spinlock);
+    caches = NULL;
+    pthread_mutex_destroy (&mutex);
+    pthread_key_delete (key);
 }
 
-static HevTSock *
-hev_tsocks_cache_find (struct sockaddr *addr)
+static HevTSocksCache *
+hev_tsocks_cache_self (void)
 {
-    HevRBTreeNode *node = cache.root;
+    HevTSocksCache *self;
 
-    while (node) {
-        HevTSock *this;
-        int res;
+    self = pthread_getspecific (key);
+    if (self)
+        return self;
 
-        this = container_of (node, HevTSock, rnode);
-        res = memcmp (&this->addr, addr, sizeof (struct sockaddr_in6));
+    self = hev_tsocks_cache_new ();
+    if (self)
+        pthread_setspecific (key, self);
 
-        if (res < 0)
-            node = node->left;
-        else if (res > 0)
-            node = node->right;
-        else
-            return this;
-    }
-
-    return NULL;
+    return self;
 }
 
 static int
-hev_tsocks_cache_add (HevTSock *ts)
+hev_tsocks_cache_evict (HevTSocksCache *self)
 {
-    HevRBTreeNode **new = &cache.root, *parent = NULL;
-
-    while (*new) {
-        HevTSock *this;
-        int res;
-
-        this = container_of (*new, HevTSock, rnode);
-        res = memcmp (&this->addr, &ts->addr, sizeof (struct sockaddr_in6));
-
-        parent = *new;
-        if (res < 0)
-            new = &((*new)->left);
-        else if (res > 0)
-            new = &((*new)->right);
-        else
-            return -1;
-    }
+    unsigned int i;
 
-    cached++;
-    hev_list_add_tail (&lru, &ts->lnode);
-    hev_rbtree_node_link (&ts->rnode, parent, new);
-    hev_rbtree_insert_color (&cache, &ts->rnode);
+    /* CLOCK: clear the used bit on the first pass, evict on the second */
+    for (i = 0; i < self->size * 2; i++) {
+        unsigned int hand = self->hand;
+        HevTSock *ts = self->ring[hand];
 
-    return 0;
-}
+        self->hand = (hand + 1) % self->size;
 
-static void
-hev_tsocks_cache_del (HevTSock *ts)
-{
-    cached--;
-    hev_list_del (&lru, &ts->lnode);
-    hev_rbtree_erase (&cache, &ts->rnode);
+        if (ts->refs)
+            continue;
+
+        if (ts->used) {
+            ts->used = 0;
+            continue;
+        }
+
+        hev_addr_table_remove (self->table, &ts->addr);
+        hev_tsocks_cache_tsock_destroy (ts);
+        self->evicts++;
+
+        return hand;
+    }
+
+    return -1;
 }
 
-static void
-hev_tsocks_cache_update (HevTSock *ts)
+static struct sockaddr_in6 *
+hev_tsocks_cache_key (struct sockaddr *addr, struct sockaddr_in6 *key)
 {
-    hev_list_del (&lru, &ts->lnode);
-    hev_list_add_tail (&lru, &ts->lnode);
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)addr;
+
+    if (!pktinfo)
+        return sa6;
+
+    /*
+     * In pktinfo mode the source address is set per message, so one socket
+     * serves every address of a family on the same port.
+     */
+    memset (key, 0, sizeof (*key));
+    key->sin6_family = AF_INET6;
+    key->sin6_port = sa6->sin6_port;
+    if (IN6_IS_ADDR_V4MAPPED (&sa6->sin6_addr))
+        key->sin6_addr.s6_addr[10] = key->sin6_addr.s6_addr[11] = 0xff;
+
+    return key;
 }
 
 int
 hev_tsocks_cache_get (struct sockaddr *addr)
 {
-    for (;;) {
-        HevTSock *ts;
-        int res;
-
-        pthread_rwlock_rdlock (&rwlock);
-        ts = hev_tsocks_cache_find (addr);
-        if (ts) {
-            pthread_spin_lock (&spinlock);
-            hev_tsocks_cache_update (ts);
-            pthread_spin_unlock (&spinlock);
-            return ts->fd;
-        }
-        pthread_rwlock_unlock (&rwlock);
-
-        if (cached >= TSOCKS_MAX_CACHED) {
-            pthread_rwlock_wrlock (&rwlock);
-            if (cached >= TSOCKS_MAX_CACHED) {
-                HevListNode *node;
-                node = hev_list_first (&lru);
-                ts = container_of (node, HevTSock, lnode);
-                hev_tsocks_cache_del (ts);
-            }
-            pthread_rwlock_unlock (&rwlock);
-            if (ts)
-                hev_tsocks_cache_tsock_destroy (ts);
-        }
+    struct sockaddr_in6 *kp, key;
+    HevTSocksCache *self;
+    HevTSock *ts;
+    int slot;
+    int fd;
 
-        ts = hev_tsocks_cache_tsock_new (addr);
-        if (!ts)
-            break;
+    self = hev_tsocks_cache_self ();
+    if (!self)
+        return -1;
 
-        pthread_rwlock_wrlock (&rwlock);
-        res = hev_tsocks_cache_add (ts);
-        pthread_rwlock_unlock (&rwlock);
-        if (res < 0)
-            hev_tsocks_cache_tsock_destroy (ts);
+    kp = hev_tsocks_cache_key (addr, &key);
+    ts = hev_addr_table_find (self->table, kp);
+    if (ts) {
+        if (!ts->used)
+            ts->used = 1;
+        ts->refs++;
+        self->hits++;
+        return ts->fd;
     }
 
-    return -1;
+    self->misses++;
+
+    ts = hev_tsocks_cache_tsock_new (addr);
+    if (!ts)
+        return -1;
+
+    if (kp != (struct sockaddr_in6 *)addr)
+        memcpy (&ts->addr, kp, sizeof (ts->addr));
+
+    if (hev_addr_table_insert (self->table, &ts->addr, ts) < 0)
+        goto uncached;
+
+    if (self->count < self->size)
+        slot = self->count++;
+    else
+        slot = hev_tsocks_cache_evict (self);
+
+    /* every cached socket is in use, hand out an uncached one */
+    if (slot < 0) {
+        hev_addr_table_remove (self->table, &ts->addr);
+        goto uncached;
+    }
+
+    self->ring[slot] = ts;
+    ts->refs++;
+
+    return ts->fd;
+
+uncached:
+    fd = ts->fd;
+    hev_free (ts);
+    return fd;
 }
 
 void
-hev_tsocks_cache_put (int fd)
+hev_tsocks_cache_put (struct sockaddr *addr, int fd)
+{
+    struct sockaddr_in6 *kp, k;
+    HevTSocksCache *self;
+    HevTSock *ts;
+
+    self = pthread_getspecific (key);
+    if (self) {
+        kp = hev_tsocks_cache_key (addr, &k);
+        ts = hev_addr_table_find (self->table, kp);
+        if (ts && ts->fd == fd) {
+            ts->refs--;
+            return;
+        }
+    }
+
+    close (fd);
+}
+
+size_t
+hev_tsocks_cache_cmsg (struct sockaddr *addr, void *buf)
 {
-    pthread_rwlock_unlock (&rwlock);
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)addr;
+    struct in6_pktinfo *info;
+    struct cmsghdr *cmsg = buf;
+
+    if (!pktinfo)
+        return 0;
+
+    /* v4-mapped sources are accepted as IPV6_PKTINFO by the IPv4 path too */
+    memset (buf, 0, CMSG_SPACE (sizeof (*info)));
+    cmsg->cmsg_level = SOL_IPV6;
+    cmsg->cmsg_type = IPV6_PKTINFO;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (*info));
+
+    info = (struct in6_pktinfo *)CMSG_DATA (cmsg);
+    memcpy (&info->ipi6_addr, &sa6->sin6_addr, sizeof (info->ipi6_addr));
+
+    return CMSG_SPACE (sizeof (*info));
 }
@@ -2,7 +2,7 @@
  ============================================================================
  Name        : hev-tsocks-cache.h
  Author      : Heiher <r@hev.cc>
- Copyright   : Copyright (c) 2017 - 2021 hev
+ Copyright   : Copyright (c) 2017 - 2025 hev
  Description : Transparent Socket Cache
  ============================================================================
  */
@@ -10,12 +10,23 @@
 #ifndef __HEV_TSOCKS_CACHE_H__
 #define __HEV_TSOCKS_CACHE_H__
 
+#include <stddef.h>
 #include <netinet/in.h>
 
+#define HEV_TSOCKS_CACHE_CMSG_SIZE (64)
+
 int hev_tsocks_cache_init (void);
 void hev_tsocks_cache_fini (void);
 
 int hev_tsocks_cache_get (struct sockaddr *addr);
-void hev_tsocks_cache_put (int fd);
+void hev_tsocks_cache_put (struct sockaddr *addr, int fd);
+
+/*
+ * Fill the ancillary data that makes a reply sent on a socket from
+ * hev_tsocks_cache_get originate from addr. The buffer must hold
+ * HEV_TSOCKS_CACHE_CMSG_SIZE bytes and be aligned for struct cmsghdr.
+ * Returns the control length, or 0 if none is needed.
+ */
+size_t hev_tsocks_cache_cmsg (struct sockaddr *addr, void *buf);
 
 #endif /* __HEV_TSOCKS_CACHE_H__ */
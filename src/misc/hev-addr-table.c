@@ -0,0 +1,327 @@
+/*
+ ============================================================================
+ Name        : hev-addr-table.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Address Hash Table
+ ============================================================================
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <hev-memory-allocator.h>
+
+#include "hev-utils.h"
+
+#include "hev-addr-table.h"
+
+#define MIGRATE_STEP (8)
+
+enum
+{
+    SLOT_EMPTY,
+    SLOT_USED,
+    SLOT_DEAD,
+};
+
+typedef struct _HevAddrTableSlot HevAddrTableSlot;
+typedef struct _HevAddrTableArray HevAddrTableArray;
+
+struct _HevAddrTableSlot
+{
+    uint32_t addr[4];
+    uint16_t port;
+    uint16_t state;
+    uint32_t hash;
+    void *data;
+};
+
+struct _HevAddrTableArray
+{
+    HevAddrTableSlot *slots;
+    unsigned int mask;
+    unsigned int used;
+    unsigned int dead;
+};
+
+struct _HevAddrTable
+{
+    HevAddrTableArray cur;
+    HevAddrTableArray old;
+    unsigned int pos;
+    uint32_t seed;
+};
+
+static uint32_t
+hev_addr_table_hash (HevAddrTable *self, const uint32_t *addr, uint16_t port)
+{
+    uint64_t h = self->seed ^ port;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        h = (h ^ addr[i]) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+    }
+
+    return h;
+}
+
+static int
+hev_addr_table_array_init (HevAddrTableArray *array, unsigned int size)
+{
+    array->slots = hev_malloc0 (sizeof (HevAddrTableSlot) * size);
+    if (!array->slots)
+        return -1;
+
+    array->mask = size - 1;
+    array->used = 0;
+    array->dead = 0;
+
+    return 0;
+}
+
+static HevAddrTableSlot *
+hev_addr_table_array_find (HevAddrTableArray *array, const uint32_t *addr,
+                           uint16_t port, uint32_t hash)
+{
+    unsigned int i = hash & array->mask;
+
+    for (;; i = (i + 1) & array->mask) {
+        HevAddrTableSlot *slot = &array->slots[i];
+
+        if (slot->state == SLOT_EMPTY)
+            break;
+
+        if (slot->state == SLOT_USED && slot->hash == hash &&
+            slot->port == port && 0 == memcmp (slot->addr, addr, 16))
+            return slot;
+    }
+
+    return NULL;
+}
+
+static HevAddrTableSlot *
+hev_addr_table_array_slot (HevAddrTableArray *array, uint32_t hash)
+{
+    unsigned int i = hash & array->mask;
+
+    for (;; i = (i + 1) & array->mask) {
+        HevAddrTableSlot *slot = &array->slots[i];
+
+        if (slot->state == SLOT_EMPTY) {
+            array->used++;
+            return slot;
+        }
+
+        if (slot->state == SLOT_DEAD) {
+            array->dead--;
+            array->used++;
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+hev_addr_table_migrate (HevAddrTable *self, unsigned int step)
+{
+    HevAddrTableArray *old = &self->old;
+
+    if (!old->slots)
+        return;
+
+    for (; step && self->pos <= old->mask; step--, self->pos++) {
+        HevAddrTableSlot *src = &old->slots[self->pos];
+        HevAddrTableSlot *dst;
+
+        if (src->state != SLOT_USED)
+            continue;
+
+        dst = hev_addr_table_array_slot (&self->cur, src->hash);
+        memcpy (dst, src, sizeof (HevAddrTableSlot));
+
+        src->state = SLOT_DEAD;
+        old->used--;
+    }
+
+    if (self->pos > old->mask || !old->used) {
+        hev_free (old->slots);
+        old->slots = NULL;
+    }
+}
+
+static int
+hev_addr_table_grow (HevAddrTable *self)
+{
+    HevAddrTableArray *cur = &self->cur;
+    unsigned int size = cur->mask + 1;
+
+    if ((cur->used + cur->dead + 1) * 4 <= size * 3)
+        return 0;
+
+    /* finish the previous resize before starting a new one */
+    hev_addr_table_migrate (self, -1);
+
+    if (cur->used * 2 >= size)
+        size <<= 1;
+
+    self->old = *cur;
+    self->pos = 0;
+
+    if (hev_addr_table_array_init (cur, size) < 0) {
+        *cur = self->old;
+        self->old.slots = NULL;
+        return -1;
+    }
+
+    hev_addr_table_migrate (self, MIGRATE_STEP);
+
+    return 0;
+}
+
+HevAddrTable *
+hev_addr_table_new (unsigned int size)
+{
+    HevAddrTable *self;
+    unsigned int s;
+
+    self = hev_malloc0 (sizeof (HevAddrTable));
+    if (!self)
+        return NULL;
+
+    for (s = 16; s < size; s <<= 1)
+        ;
+
+    if (hev_addr_table_array_init (&self->cur, s) < 0) {
+        hev_free (self);
+        return NULL;
+    }
+
+    self->seed = (uintptr_t)self ^ get_monotonic_ms ();
+
+    return self;
+}
+
+void
+hev_addr_table_destroy (HevAddrTable *self)
+{
+    if (self->old.slots)
+        hev_free (self->old.slots);
+    hev_free (self->cur.slots);
+    hev_free (self);
+}
+
+unsigned int
+hev_addr_table_count (HevAddrTable *self)
+{
+    unsigned int count = self->cur.used;
+
+    if (self->old.slots)
+        count += self->old.used;
+
+    return count;
+}
+
+void *
+hev_addr_table_find (HevAddrTable *self, const struct sockaddr_in6 *key)
+{
+    const uint32_t *addr = (const uint32_t *)&key->sin6_addr;
+    HevAddrTableSlot *slot;
+    uint32_t hash;
+
+    hash = hev_addr_table_hash (self, addr, key->sin6_port);
+
+    slot = hev_addr_table_array_find (&self->cur, addr, key->sin6_port, hash);
+    if (slot)
+        return slot->data;
+
+    if (self->old.slots) {
+        slot = hev_addr_table_array_find (&self->old, addr, key->sin6_port,
+                                          hash);
+        if (slot)
+            return slot->data;
+    }
+
+    return NULL;
+}
+
+int
+hev_addr_table_insert (HevAddrTable *self, const struct sockaddr_in6 *key,
+                       void *data)
+{
+    const uint32_t *addr = (const uint32_t *)&key->sin6_addr;
+    HevAddrTableSlot *slot;
+    uint32_t hash;
+
+    if (hev_addr_table_find (self, key))
+        return -1;
+
+    hev_addr_table_migrate (self, MIGRATE_STEP);
+    if (hev_addr_table_grow (self) < 0)
+        return -1;
+
+    hash = hev_addr_table_hash (self, addr, key->sin6_port);
+    slot = hev_addr_table_array_slot (&self->cur, hash);
+
+    memcpy (slot->addr, addr, 16);
+    slot->port = key->sin6_port;
+    slot->state = SLOT_USED;
+    slot->hash = hash;
+    slot->data = data;
+
+    return 0;
+}
+
+void *
+hev_addr_table_remove (HevAddrTable *self, const struct sockaddr_in6 *key)
+{
+    const uint32_t *addr = (const uint32_t *)&key->sin6_addr;
+    HevAddrTableArray *array = &self->cur;
+    HevAddrTableSlot *slot;
+    uint32_t hash;
+    void *data;
+
+    hash = hev_addr_table_hash (self, addr, key->sin6_port);
+
+    slot = hev_addr_table_array_find (array, addr, key->sin6_port, hash);
+    if (!slot && self->old.slots) {
+        array = &self->old;
+        slot = hev_addr_table_array_find (array, addr, key->sin6_port, hash);
+    }
+    if (!slot)
+        return NULL;
+
+    data = slot->data;
+    slot->state = SLOT_DEAD;
+    array->used--;
+    array->dead++;
+
+    hev_addr_table_migrate (self, MIGRATE_STEP);
+
+    return data;
+}
+
+void
+hev_addr_table_foreach (HevAddrTable *self, HevAddrTableForeach func,
+                        void *user)
+{
+    HevAddrTableArray *arrays[] = { &self->old, &self->cur };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        HevAddrTableArray *array = arrays[i];
+        unsigned int j;
+
+        if (!array->slots)
+            continue;
+
+        for (j = 0; j <= array->mask; j++) {
+            HevAddrTableSlot *slot = &array->slots[j];
+
+            if (slot->state == SLOT_USED)
+                func (slot->data, user);
+        }
+    }
+}
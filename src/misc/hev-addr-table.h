@@ -0,0 +1,41 @@
+/*
+ ============================================================================
+ Name        : hev-addr-table.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : Address Hash Table
+ ============================================================================
+ */
+
+#ifndef __HEV_ADDR_TABLE_H__
+#define __HEV_ADDR_TABLE_H__
+
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _HevAddrTable HevAddrTable;
+typedef void (*HevAddrTableForeach) (void *data, void *user);
+
+HevAddrTable *hev_addr_table_new (unsigned int size);
+void hev_addr_table_destroy (HevAddrTable *self);
+
+unsigned int hev_addr_table_count (HevAddrTable *self);
+
+void *hev_addr_table_find (HevAddrTable *self, const struct sockaddr_in6 *key);
+int hev_addr_table_insert (HevAddrTable *self, const struct sockaddr_in6 *key,
+                           void *data);
+void *hev_addr_table_remove (HevAddrTable *self,
+                             const struct sockaddr_in6 *key);
+
+/* The table must not be modified from the callback. */
+void hev_addr_table_foreach (HevAddrTable *self, HevAddrTableForeach func,
+                             void *user);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_ADDR_TABLE_H__ */
@@ -0,0 +1,281 @@
+/*
+ ============================================================================
+ Name        : hev-dns-msg.c
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Message
+ ============================================================================
+ */
+
+#include "hev-dns-msg.h"
+
+static int
+hev_dns_msg_skip_name (const unsigned char *msg, size_t len, size_t off)
+{
+    while (off < len) {
+        unsigned int l = msg[off];
+
+        if (l == 0)
+            return off + 1;
+
+        if ((l & 0xc0) == 0xc0)
+            return (off + 2 <= len) ? off + 2 : -1;
+
+        if (l & 0xc0)
+            return -1;
+
+        off += l + 1;
+    }
+
+    return -1;
+}
+
+static int
+hev_dns_msg_skip_question (const unsigned char *msg, size_t len)
+{
+    unsigned int qdcount;
+    int off = HEV_DNS_MSG_HDR_SIZE;
+
+    if (len < HEV_DNS_MSG_HDR_SIZE)
+        return -1;
+
+    qdcount = hev_dns_msg_get16 (msg + 4);
+    for (; qdcount; qdcount--) {
+        off = hev_dns_msg_skip_name (msg, len, off);
+        if (off < 0 || off + 4 > len)
+            return -1;
+        off += 4;
+    }
+
+    return off;
+}
+
+int
+hev_dns_msg_foreach_rr (void *msg, size_t len, HevDNSMsgRRFunc func,
+                        void *user)
+{
+    unsigned char *buf = msg;
+    int section;
+    int off;
+
+    off = hev_dns_msg_skip_question (buf, len);
+    if (off < 0)
+        return -1;
+
+    for (section = HEV_DNS_SECTION_ANSWER;
+         section <= HEV_DNS_SECTION_ADDITIONAL; section++) {
+        unsigned int count;
+
+        count = hev_dns_msg_get16 (buf + 6 + section * 2);
+        for (; count; count--) {
+            unsigned int rdlen;
+
+            off = hev_dns_msg_skip_name (buf, len, off);
+            if (off < 0 || off + 10 > len)
+                return -1;
+
+            rdlen = hev_dns_msg_get16 (buf + off + 8);
+            if (off + 10 + rdlen > len)
+                return -1;
+
+            if (func && func (buf + off, section, user))
+                return 0;
+
+            off += 10 + rdlen;
+        }
+    }
+
+    return 0;
+}
+
+static int
+hev_dns_msg_find_opt (unsigned char *rr, int section, void *user)
+{
+    HevDNSKey *key = user;
+    unsigned int size;
+
+    if (section != HEV_DNS_SECTION_ADDITIONAL)
+        return 0;
+
+    if (hev_dns_msg_get16 (rr) != HEV_DNS_TYPE_OPT)
+        return 0;
+
+    /* the class field carries the payload size, the ttl field the flags */
+    size = hev_dns_msg_get16 (rr + 2);
+    if (size > key->udp_size)
+        key->udp_size = size;
+    if (rr[6] & 0x80)
+        key->data[key->len] |= 1;
+
+    return 1;
+}
+
+int
+hev_dns_msg_key (const void *msg, size_t len, HevDNSKey *key)
+{
+    const unsigned char *buf = msg;
+    size_t off = HEV_DNS_MSG_HDR_SIZE;
+    size_t klen = 0;
+
+    if (len < HEV_DNS_MSG_HDR_SIZE || hev_dns_msg_get16 (buf + 4) != 1)
+        return -1;
+
+    for (;;) {
+        unsigned int l;
+
+        if (off >= len)
+            return -1;
+
+        l = buf[off];
+        if (l & 0xc0)
+            return -1;
+
+        if (off + l + 1 > len || klen + l + 1 > 255)
+            return -1;
+
+        key->data[klen++] = l;
+        off++;
+        if (l == 0)
+            break;
+
+        for (; l; l--) {
+            unsigned char c = buf[off++];
+
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            key->data[klen++] = c;
+        }
+    }
+
+    if (off + 4 > len)
+        return -1;
+
+    memcpy (&key->data[klen], buf + off, 4);
+    klen += 4;
+    off += 4;
+
+    key->len = klen;
+    key->udp_size = 512;
+    key->data[klen] = (buf[3] & 0x10) ? 2 : 0;
+
+    if (hev_dns_msg_foreach_rr ((void *)msg, len, hev_dns_msg_find_opt,
+                                key) < 0)
+        return -1;
+
+    key->len++;
+
+    return off;
+}
+
+int
+hev_dns_msg_answer (void *msg, size_t qend, size_t size, const void *reply,
+                    size_t len)
+{
+    unsigned char question[HEV_DNS_KEY_MAX];
+    size_t qlen = qend - HEV_DNS_MSG_HDR_SIZE;
+    unsigned char *buf = msg;
+    unsigned int id, rd;
+    int copy;
+
+    if (len > size || len < HEV_DNS_MSG_HDR_SIZE || qlen > sizeof (question))
+        return -1;
+
+    /* error replies may come without a question section */
+    copy = hev_dns_msg_get16 ((const unsigned char *)reply + 4) && qend <= len;
+
+    id = hev_dns_msg_id (buf);
+    rd = buf[2] & 0x01;
+    if (copy)
+        memcpy (question, buf + HEV_DNS_MSG_HDR_SIZE, qlen);
+
+    memcpy (buf, reply, len);
+
+    if (copy)
+        memcpy (buf + HEV_DNS_MSG_HDR_SIZE, question, qlen);
+    hev_dns_msg_set_id (buf, id);
+    buf[2] = (buf[2] & ~0x01) | rd;
+
+    return len;
+}
+
+int
+hev_dns_msg_error (void *msg, size_t len, int rcode)
+{
+    unsigned char *buf = msg;
+    int qend;
+
+    qend = hev_dns_msg_skip_question (buf, len);
+    if (qend < 0)
+        return -1;
+
+    buf[2] = 0x80 | (buf[2] & 0x79);
+    buf[3] = 0x80 | rcode;
+    hev_dns_msg_set16 (buf + 6, 0);
+    hev_dns_msg_set16 (buf + 8, 0);
+    hev_dns_msg_set16 (buf + 10, 0);
+
+    return qend;
+}
+
+int
+hev_dns_msg_truncate (void *msg, size_t qend, const void *reply)
+{
+    const unsigned char *rbuf = reply;
+    unsigned char *buf = msg;
+
+    /* keep the ID, RD bit and question, drop every record */
+    buf[2] = (rbuf[2] & ~0x01) | (buf[2] & 0x01) | 0x02;
+    buf[3] = rbuf[3];
+    hev_dns_msg_set16 (buf + 6, 0);
+    hev_dns_msg_set16 (buf + 8, 0);
+    hev_dns_msg_set16 (buf + 10, 0);
+
+    return qend;
+}
+
+uint32_t
+hev_dns_key_hash (const HevDNSKey *key, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    unsigned int i;
+
+    for (i = 0; i < key->len; i++) {
+        h ^= key->data[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+int
+hev_dns_msg_query (void *msg, size_t size, const HevDNSKey *key)
+{
+    unsigned char *buf = msg;
+    size_t qlen = key->len - 1;
+    unsigned int flags = key->data[qlen];
+    unsigned int udp_size = key->udp_size;
+    unsigned char *opt;
+
+    if (HEV_DNS_MSG_HDR_SIZE + qlen + 11 > size)
+        return -1;
+
+    memset (buf, 0, HEV_DNS_MSG_HDR_SIZE);
+    buf[2] = 0x01;
+    if (flags & 2)
+        buf[3] = 0x10;
+    hev_dns_msg_set16 (buf + 4, 1);
+    hev_dns_msg_set16 (buf + 10, 1);
+    memcpy (buf + HEV_DNS_MSG_HDR_SIZE, key->data, qlen);
+
+    /* root name, OPT, payload size, extended rcode, version, DO, rdlen */
+    opt = buf + HEV_DNS_MSG_HDR_SIZE + qlen;
+    opt[0] = 0;
+    hev_dns_msg_set16 (opt + 1, HEV_DNS_TYPE_OPT);
+    if (udp_size > size)
+        udp_size = size;
+    hev_dns_msg_set16 (opt + 3, udp_size);
+    hev_dns_msg_set32 (opt + 5, (flags & 1) ? 0x8000 : 0);
+    hev_dns_msg_set16 (opt + 9, 0);
+
+    return HEV_DNS_MSG_HDR_SIZE + qlen + 11;
+}
@@ -0,0 +1,183 @@
+/*
+ ============================================================================
+ Name        : hev-dns-msg.h
+ Author      : Heiher <r@hev.cc>
+ Copyright   : Copyright (c) 2025 hev
+ Description : DNS Message
+ ============================================================================
+ */
+
+#ifndef __HEV_DNS_MSG_H__
+#define __HEV_DNS_MSG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEV_DNS_MSG_HDR_SIZE (12)
+#define HEV_DNS_KEY_MAX (255 + 5)
+
+enum
+{
+    HEV_DNS_SECTION_ANSWER,
+    HEV_DNS_SECTION_AUTHORITY,
+    HEV_DNS_SECTION_ADDITIONAL,
+};
+
+enum
+{
+    HEV_DNS_TYPE_SOA = 6,
+    HEV_DNS_TYPE_OPT = 41,
+};
+
+enum
+{
+    HEV_DNS_RCODE_NOERROR = 0,
+    HEV_DNS_RCODE_SERVFAIL = 2,
+    HEV_DNS_RCODE_NXDOMAIN = 3,
+};
+
+typedef struct _HevDNSKey HevDNSKey;
+
+/*
+ * Identity of a question: the lowercased wire qname, qtype, qclass and a
+ * flags byte carrying the DO and CD bits. The UDP payload size the sender
+ * accepts is kept aside, it is not part of the identity.
+ */
+struct _HevDNSKey
+{
+    unsigned short len;
+    unsigned short udp_size;
+    unsigned char data[HEV_DNS_KEY_MAX];
+};
+
+/*
+ * Resource record callback. The rr pointer addresses the fixed part of the
+ * record (type, class, ttl, rdlength) followed by rdata. A non-zero return
+ * stops the walk.
+ */
+typedef int (*HevDNSMsgRRFunc) (unsigned char *rr, int section, void *user);
+
+static inline unsigned int
+hev_dns_msg_get16 (const void *p)
+{
+    const unsigned char *b = p;
+
+    return (b[0] << 8) | b[1];
+}
+
+static inline uint32_t
+hev_dns_msg_get32 (const void *p)
+{
+    const unsigned char *b = p;
+
+    return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static inline void
+hev_dns_msg_set16 (void *p, unsigned int v)
+{
+    unsigned char *b = p;
+
+    b[0] = v >> 8;
+    b[1] = v;
+}
+
+static inline void
+hev_dns_msg_set32 (void *p, uint32_t v)
+{
+    unsigned char *b = p;
+
+    b[0] = v >> 24;
+    b[1] = v >> 16;
+    b[2] = v >> 8;
+    b[3] = v;
+}
+
+static inline unsigned int
+hev_dns_msg_id (const void *msg)
+{
+    return hev_dns_msg_get16 (msg);
+}
+
+static inline void
+hev_dns_msg_set_id (void *msg, unsigned int id)
+{
+    hev_dns_msg_set16 (msg, id);
+}
+
+static inline int
+hev_dns_msg_is_response (const void *msg)
+{
+    return ((const unsigned char *)msg)[2] & 0x80;
+}
+
+static inline int
+hev_dns_msg_is_truncated (const void *msg)
+{
+    return ((const unsigned char *)msg)[2] & 0x02;
+}
+
+static inline int
+hev_dns_msg_rcode (const void *msg)
+{
+    return ((const unsigned char *)msg)[3] & 0x0f;
+}
+
+/*
+ * Build the key of the single question in msg. Returns the offset just
+ * past the question section, or -1 if the message is malformed.
+ */
+int hev_dns_msg_key (const void *msg, size_t len, HevDNSKey *key);
+
+/*
+ * Overwrite the query in msg with reply, an answer to an equal question.
+ * The query's transaction ID, RD bit and question spelling are kept, qend
+ * is the offset returned by hev_dns_msg_key for it. Returns the answer
+ * length, or -1 if it does not fit in size.
+ */
+int hev_dns_msg_answer (void *msg, size_t qend, size_t size,
+                        const void *reply, size_t len);
+
+/*
+ * Turn the query of len bytes in msg into an empty reply with rcode,
+ * keeping its ID, opcode, RD bit and question. Returns the reply length,
+ * or -1 if the message is malformed.
+ */
+int hev_dns_msg_error (void *msg, size_t len, int rcode);
+
+/*
+ * Overwrite the query in msg with an empty reply that has reply's flags
+ * and rcode and the TC bit set, for a sender that cannot take all of
+ * reply over UDP. Returns the reply length.
+ */
+int hev_dns_msg_truncate (void *msg, size_t qend, const void *reply);
+
+/*
+ * Build a recursive query for key into msg, with an EDNS OPT record that
+ * carries key's payload size, capped at size, and DO bit. The ID is left
+ * zero. Returns the query length, or -1 if it does not fit in size.
+ */
+int hev_dns_msg_query (void *msg, size_t size, const HevDNSKey *key);
+
+/* Walk the answer, authority and additional records. */
+int hev_dns_msg_foreach_rr (void *msg, size_t len, HevDNSMsgRRFunc func,
+                            void *user);
+
+uint32_t hev_dns_key_hash (const HevDNSKey *key, uint32_t seed);
+
+static inline int
+hev_dns_key_equal (const HevDNSKey *a, const void *data, size_t len)
+{
+    return a->len == len && 0 == memcmp (a->data, data, len);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __HEV_DNS_MSG_H__ */
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/resource.h>
 #include <netinet/tcp.h>
@@ -154,3 +155,13 @@ resolve_to_sockaddr (const char *addr, const char *port, int type,
 
     return 0;
 }
+
+int64_t
+get_monotonic_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
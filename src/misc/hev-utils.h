@@ -10,6 +10,7 @@
 #ifndef __HEV_UTILS_H__
 #define __HEV_UTILS_H__
 
+#include <stdint.h>
 #include <netinet/in.h>
 
 void run_as_daemon (const char *pid_file);
@@ -19,5 +20,6 @@ void msg_to_sock_addr (struct msghdr *msg, struct sockaddr *addr);
 int resolve_to_sockaddr (const char *addr, const char *port, int type,
                          struct sockaddr_in6 *saddr);
 void set_sock_tcp_fastopen (int fd, int enable);
+int64_t get_monotonic_ms (void);
 
 #endif /* __HEV_UTILS_H__ */